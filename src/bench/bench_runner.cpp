@@ -0,0 +1,332 @@
+#include "bench_runner.h"
+#include "bench_service.h"
+
+#include <jcon/json_rpc_local_client.h>
+#include <jcon/json_rpc_local_server.h>
+#include <jcon/json_rpc_tcp_client.h>
+#include <jcon/json_rpc_tcp_server.h>
+#include <jcon/json_rpc_websocket_client.h>
+#include <jcon/json_rpc_websocket_server.h>
+
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QTimer>
+
+#include <chrono>
+
+namespace {
+
+/// Longest wait for the calls outstanding at the end of a scenario.
+const int DrainTimeout = 5000;
+
+QJsonObject latencyToJson(const jcon::JsonRpcHistogram::Snapshot& latency)
+{
+    const double nsecs_per_usec = 1000.0;
+    return QJsonObject {
+        { "mean", latency.count ?
+                  latency.sum / nsecs_per_usec / latency.count : 0.0 },
+        { "p50", latency.p50 / nsecs_per_usec },
+        { "p99", latency.p99 / nsecs_per_usec },
+        { "p999", latency.p999 / nsecs_per_usec },
+        { "max", latency.max / nsecs_per_usec }
+    };
+}
+
+}
+
+qint64 benchClockNsecs()
+{
+    // The steady clock is CLOCK_MONOTONIC on Linux, which is the same in
+    // every process, so subprocess servers can be timed against it too.
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(
+        steady_clock::now().time_since_epoch()).count();
+}
+
+QJsonObject BenchResult::toJson() const
+{
+    return QJsonObject {
+        { "transport", config.transport },
+        { "scenario", config.scenario },
+        { "payload", config.payload },
+        { "depth", config.depth },
+        { "connections", config.connections },
+        { "fanout", config.fanout },
+        { "operations", static_cast<double>(operations) },
+        { "errors", static_cast<double>(errors) },
+        { "seconds", seconds },
+        { "throughput", seconds > 0 ? operations / seconds : 0.0 },
+        { "latency_us", latencyToJson(latency) }
+    };
+}
+
+QString BenchResult::toString() const
+{
+    return QString("%1 %2 payload=%3 depth=%4 connections=%5 fanout=%6: "
+                   "%7 ops/s, %8 errors, latency p50 %9 us, p99 %10 us, "
+                   "p99.9 %11 us")
+        .arg(config.transport)
+        .arg(config.scenario)
+        .arg(config.payload)
+        .arg(config.depth)
+        .arg(config.connections)
+        .arg(config.fanout)
+        .arg(seconds > 0 ? operations / seconds : 0.0, 0, 'f', 0)
+        .arg(errors)
+        .arg(latency.p50 / 1000.0, 0, 'f', 1)
+        .arg(latency.p99 / 1000.0, 0, 'f', 1)
+        .arg(latency.p999 / 1000.0, 0, 'f', 1);
+}
+
+BenchServerThread::BenchServerThread(int tcp_port, int ws_port)
+    : m_tcp_port(tcp_port)
+    , m_ws_port(ws_port)
+    , m_listening(false)
+{
+}
+
+BenchServerThread::~BenchServerThread()
+{
+    quit();
+    wait();
+}
+
+bool BenchServerThread::startServers()
+{
+    start();
+    m_started.acquire();
+    return m_listening;
+}
+
+void BenchServerThread::run()
+{
+    auto logger = std::make_shared<NullLogger>();
+    BenchService service;
+
+    jcon::JsonRpcTcpServer tcp_server(nullptr, logger);
+    tcp_server.registerService(&service);
+
+    jcon::JsonRpcWebSocketServer ws_server(nullptr, logger);
+    ws_server.registerService(&service);
+
+    jcon::JsonRpcLocalServer local_server(nullptr, logger);
+    local_server.registerService(&service);
+
+    m_listening = tcp_server.listen(m_tcp_port) &&
+        ws_server.listen(m_ws_port) && local_server.listen(m_tcp_port);
+    m_started.release();
+
+    if (m_listening)
+        exec();
+}
+
+struct BenchRunner::LoadState {
+    jcon::JsonRpcHistogram latency;
+    quint64 operations = 0;
+    quint64 errors = 0;
+    int outstanding = 0;
+    bool recording = false;
+    bool stopping = false;
+    double seconds = 0;
+    QEventLoop loop;
+};
+
+BenchRunner::BenchRunner(const QString& host, int tcp_port, int ws_port,
+                         int warmup_msecs, int duration_msecs)
+    : m_host(host)
+    , m_tcp_port(tcp_port)
+    , m_ws_port(ws_port)
+    , m_warmup_msecs(warmup_msecs)
+    , m_duration_msecs(duration_msecs)
+    , m_logger(std::make_shared<NullLogger>())
+{
+}
+
+BenchResult BenchRunner::run(const BenchConfig& config)
+{
+    if (config.scenario == "fanout")
+        return runFanout(config);
+    return runEcho(config);
+}
+
+jcon::JsonRpcClientPtr BenchRunner::connectClient(const QString& transport)
+{
+    jcon::JsonRpcClientPtr client;
+    int port;
+    if (transport == "ws") {
+        client = std::make_shared<jcon::JsonRpcWebSocketClient>(nullptr,
+                                                                m_logger);
+        port = m_ws_port;
+    } else if (transport == "local") {
+        // The local server listens on a name derived from the TCP port.
+        client = std::make_shared<jcon::JsonRpcLocalClient>(nullptr,
+                                                            m_logger);
+        if (!client->connectToServer(QString(), m_tcp_port))
+            return nullptr;
+        return client;
+    } else {
+        client = std::make_shared<jcon::JsonRpcTcpClient>(nullptr, m_logger);
+        port = m_tcp_port;
+    }
+
+    if (!client->connectToServer(m_host, port))
+        return nullptr;
+    return client;
+}
+
+std::vector<jcon::JsonRpcClientPtr>
+BenchRunner::connectClients(const QString& transport, int count)
+{
+    std::vector<jcon::JsonRpcClientPtr> clients;
+    for (int i = 0; i < count; ++i) {
+        auto client = connectClient(transport);
+        if (!client)
+            return std::vector<jcon::JsonRpcClientPtr>();
+        clients.push_back(client);
+    }
+    return clients;
+}
+
+void BenchRunner::issueCall(const std::shared_ptr<LoadState>& state,
+                            jcon::JsonRpcClient* client,
+                            const QString& method,
+                            const QString& payload)
+{
+    // Broadcasts carry their send time, so that subscribers can measure the
+    // delivery latency; calls are timed here.
+    const bool broadcast = method == "broadcast";
+    const qint64 start = benchClockNsecs();
+    const QVariantList params = broadcast ?
+        QVariantList { start / 1000, payload } : QVariantList { payload };
+
+    auto finished = [state, client, method, payload, start, broadcast](
+        bool success)
+    {
+        --state->outstanding;
+        if (state->recording) {
+            if (!success) {
+                ++state->errors;
+            } else if (!broadcast) {
+                state->latency.record(
+                    static_cast<quint64>(benchClockNsecs() - start));
+                ++state->operations;
+            }
+        }
+
+        if (!state->stopping)
+            issueCall(state, client, method, payload);
+        else if (state->outstanding == 0)
+            state->loop.quit();
+    };
+
+    ++state->outstanding;
+    client->callAsyncWithHandlers(
+        method, params,
+        [finished](const QVariant&) { finished(true); },
+        [finished](int, const QString&, const QVariant&) { finished(false); });
+}
+
+void BenchRunner::measure(const std::shared_ptr<LoadState>& state)
+{
+    // Timers are owned by the context, so none of them outlives the scenario.
+    QObject context;
+    QElapsedTimer timer;
+
+    QTimer::singleShot(m_warmup_msecs, &context, [state, &timer]() {
+        state->recording = true;
+        timer.start();
+    });
+
+    QTimer::singleShot(m_warmup_msecs + m_duration_msecs, &context,
+                       [state, &timer]() {
+        state->recording = false;
+        state->seconds = timer.nsecsElapsed() / 1e9;
+        state->stopping = true;
+        if (state->outstanding == 0)
+            state->loop.quit();
+    });
+
+    QTimer::singleShot(m_warmup_msecs + m_duration_msecs + DrainTimeout,
+                       &context, [state]() {
+        state->loop.quit();
+    });
+
+    state->loop.exec();
+}
+
+BenchResult BenchRunner::runEcho(const BenchConfig& config)
+{
+    BenchResult result;
+    result.config = config;
+
+    auto clients = connectClients(config.transport, config.connections);
+    if (clients.empty())
+        return result;
+
+    auto state = std::make_shared<LoadState>();
+    const QString payload(config.payload, QChar('x'));
+    for (const auto& client : clients) {
+        for (int i = 0; i < config.depth; ++i)
+            issueCall(state, client.get(), "echo", payload);
+    }
+
+    measure(state);
+
+    result.operations = state->operations;
+    result.errors = state->errors;
+    result.seconds = state->seconds;
+    result.latency = state->latency.snapshot();
+    return result;
+}
+
+BenchResult BenchRunner::runFanout(const BenchConfig& config)
+{
+    BenchResult result;
+    result.config = config;
+
+    auto clients = connectClients(config.transport, config.fanout);
+    auto publisher = connectClient(config.transport);
+    if (clients.empty() || !publisher)
+        return result;
+
+    auto state = std::make_shared<LoadState>();
+
+    // Subscriptions are confirmed during the warmup.
+    std::vector<std::unique_ptr<BenchSubscriber>> subscribers;
+    for (const auto& client : clients) {
+        subscribers.emplace_back(new BenchSubscriber([state](qint64 sent_usecs) {
+            if (!state->recording)
+                return;
+            const qint64 usecs = benchClockNsecs() / 1000 - sent_usecs;
+            state->latency.record(static_cast<quint64>(qMax<qint64>(usecs, 0))
+                                  * 1000);
+            ++state->operations;
+        }));
+        client->registerNotificationHandler(subscribers.back().get(),
+                                            "onBroadcast(qint64,QString)",
+                                            "broadcasted");
+    }
+
+    const QString payload(config.payload, QChar('x'));
+    for (int i = 0; i < config.depth; ++i)
+        issueCall(state, publisher.get(), "broadcast", payload);
+
+    measure(state);
+
+    result.operations = state->operations;
+    result.errors = state->errors;
+    result.seconds = state->seconds;
+    result.latency = state->latency.snapshot();
+    return result;
+}
+
+BenchSubscriber::BenchSubscriber(std::function<void(qint64)> on_notification)
+    : m_on_notification(std::move(on_notification))
+{
+}
+
+void BenchSubscriber::onBroadcast(qint64 sent_usecs, const QString& payload)
+{
+    Q_UNUSED(payload)
+    m_on_notification(sent_usecs);
+}
@@ -0,0 +1,143 @@
+#ifndef BENCH_RUNNER_H
+#define BENCH_RUNNER_H
+
+#include <jcon/json_rpc_client.h>
+#include <jcon/json_rpc_logger.h>
+#include <jcon/json_rpc_metrics.h>
+
+#include <QJsonObject>
+#include <QObject>
+#include <QSemaphore>
+#include <QString>
+#include <QThread>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+/// Nanoseconds of a clock that is shared by all processes on the machine.
+qint64 benchClockNsecs();
+
+/// A logger that discards everything, so logging doesn't skew the results.
+class NullLogger : public jcon::JsonRpcLogger
+{
+public:
+    NullLogger() { setLevel(LL_None); }
+
+    void logInfo(const QString&) override {}
+    void logWarning(const QString&) override {}
+    void logError(const QString&) override {}
+};
+
+/// One point of the sweep.
+struct BenchConfig {
+    /// "tcp", "ws" or "local".
+    QString transport;
+
+    /// "echo" for request/response, "fanout" for notifications.
+    QString scenario;
+
+    /// Size of the string sent with every call, in characters.
+    int payload = 0;
+
+    /// Number of calls each connection keeps outstanding.
+    int depth = 1;
+
+    /// Number of connections making calls.
+    int connections = 1;
+
+    /// Number of connections subscribed to the notifications.
+    int fanout = 0;
+};
+
+struct BenchResult {
+    BenchConfig config;
+
+    /// Calls answered, or notifications received, while measuring.
+    quint64 operations = 0;
+    quint64 errors = 0;
+    double seconds = 0;
+    jcon::JsonRpcHistogram::Snapshot latency;
+
+    QJsonObject toJson() const;
+
+    /// One line summary for the console.
+    QString toString() const;
+};
+
+/// Servers for all transports, running in a thread of their own.
+class BenchServerThread : public QThread
+{
+public:
+    BenchServerThread(int tcp_port, int ws_port);
+    ~BenchServerThread();
+
+    /// Start the thread and wait until the servers are listening.
+    bool startServers();
+
+protected:
+    void run() override;
+
+private:
+    int m_tcp_port;
+    int m_ws_port;
+    bool m_listening;
+    QSemaphore m_started;
+};
+
+/**
+ * Runs the scenarios against servers on \p host. Each scenario is warmed
+ * up first, then measured for the given duration.
+ */
+class BenchRunner
+{
+public:
+    BenchRunner(const QString& host, int tcp_port, int ws_port,
+                int warmup_msecs, int duration_msecs);
+
+    BenchResult run(const BenchConfig& config);
+
+private:
+    struct LoadState;
+
+    jcon::JsonRpcClientPtr connectClient(const QString& transport);
+    std::vector<jcon::JsonRpcClientPtr> connectClients(const QString& transport,
+                                                       int count);
+
+    /// Keep a call outstanding on \p client until the state is stopping.
+    static void issueCall(const std::shared_ptr<LoadState>& state,
+                          jcon::JsonRpcClient* client,
+                          const QString& method,
+                          const QString& payload);
+
+    /// Run the event loop through warmup and measurement, then wait for the
+    /// outstanding calls.
+    void measure(const std::shared_ptr<LoadState>& state);
+
+    BenchResult runEcho(const BenchConfig& config);
+    BenchResult runFanout(const BenchConfig& config);
+
+    QString m_host;
+    int m_tcp_port;
+    int m_ws_port;
+    int m_warmup_msecs;
+    int m_duration_msecs;
+    jcon::JsonRpcLoggerPtr m_logger;
+};
+
+/// Receives the notifications of the fanout scenario.
+class BenchSubscriber : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit BenchSubscriber(std::function<void(qint64)> on_notification);
+
+public slots:
+    void onBroadcast(qint64 sent_usecs, const QString& payload);
+
+private:
+    std::function<void(qint64)> m_on_notification;
+};
+
+#endif
@@ -0,0 +1,20 @@
+#include "bench_service.h"
+
+BenchService::BenchService()
+{
+}
+
+BenchService::~BenchService()
+{
+}
+
+QString BenchService::echo(const QString& payload)
+{
+    return payload;
+}
+
+int BenchService::broadcast(qint64 sent_usecs, const QString& payload)
+{
+    emit broadcasted(sent_usecs, payload);
+    return 0;
+}
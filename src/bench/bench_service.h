@@ -0,0 +1,26 @@
+#ifndef BENCH_SERVICE_H
+#define BENCH_SERVICE_H
+
+#include <QObject>
+#include <QString>
+
+/// The service called by the benchmarks.
+class BenchService : public QObject
+{
+    Q_OBJECT
+
+public:
+    BenchService();
+    virtual ~BenchService();
+
+    Q_INVOKABLE QString echo(const QString& payload);
+
+    /// Send \p payload to every subscriber of broadcasted(). \p sent_usecs is
+    /// the time of the call, so subscribers can measure the delivery latency.
+    Q_INVOKABLE int broadcast(qint64 sent_usecs, const QString& payload);
+
+signals:
+    void broadcasted(qint64 sent_usecs, const QString& payload);
+};
+
+#endif
@@ -0,0 +1,222 @@
+#include "bench_runner.h"
+#include "bench_service.h"
+
+#include <jcon/json_rpc_local_server.h>
+#include <jcon/json_rpc_tcp_server.h>
+#include <jcon/json_rpc_websocket_server.h>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QProcess>
+#include <QTextStream>
+
+#include <memory>
+
+namespace {
+
+QList<int> toIntList(const QString& values)
+{
+    QList<int> result;
+    for (const auto& value : values.split(',', QString::SkipEmptyParts))
+        result.append(value.trimmed().toInt());
+    return result;
+}
+
+/// Run the servers until killed, for the subprocess mode.
+int serve(int tcp_port, int ws_port)
+{
+    auto logger = std::make_shared<NullLogger>();
+    BenchService service;
+
+    jcon::JsonRpcTcpServer tcp_server(nullptr, logger);
+    tcp_server.registerService(&service);
+
+    jcon::JsonRpcWebSocketServer ws_server(nullptr, logger);
+    ws_server.registerService(&service);
+
+    jcon::JsonRpcLocalServer local_server(nullptr, logger);
+    local_server.registerService(&service);
+
+    if (!tcp_server.listen(tcp_port) || !ws_server.listen(ws_port) ||
+        !local_server.listen(tcp_port))
+    {
+        return 1;
+    }
+
+    QTextStream(stdout) << "ready" << endl;
+    return QCoreApplication::exec();
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("jcon_bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Measures throughput and latency of jcon servers and clients over "
+        "loopback TCP and WebSocket connections.");
+    parser.addHelpOption();
+
+    QCommandLineOption mode_option(
+        "mode", "Where the servers run: inprocess (in a thread), subprocess "
+        "or external (at --host).", "mode", "inprocess");
+    QCommandLineOption host_option(
+        "host", "Host of external servers.", "host", "127.0.0.1");
+    QCommandLineOption port_option(
+        "port", "TCP port; the WebSocket server listens on the next one, "
+        "the local server on a name derived from it.",
+        "port", "6100");
+    QCommandLineOption transports_option(
+        "transports", "Transports to measure: tcp, ws and local.", "list",
+        "tcp,ws,local");
+    QCommandLineOption scenarios_option(
+        "scenarios", "Scenarios to run, echo and fanout.", "list",
+        "echo,fanout");
+    QCommandLineOption payloads_option(
+        "payloads", "Payload sizes in characters.", "list", "16,1024,65536");
+    QCommandLineOption depths_option(
+        "depths", "Calls kept outstanding per connection.", "list",
+        "1,16,128");
+    QCommandLineOption connections_option(
+        "connections", "Numbers of connections making echo calls.", "list",
+        "1,4,16");
+    QCommandLineOption fanouts_option(
+        "fanouts", "Numbers of connections receiving notifications.", "list",
+        "1,8,64");
+    QCommandLineOption warmup_option(
+        "warmup", "Warmup before each measurement, in milliseconds.", "msecs",
+        "200");
+    QCommandLineOption duration_option(
+        "duration", "Duration of each measurement, in milliseconds.", "msecs",
+        "1000");
+    QCommandLineOption output_option(
+        "output", "File the results are written to, as JSON.", "file",
+        "jcon_bench.json");
+    QCommandLineOption serve_option(
+        "serve", "Only run the servers, as used by the subprocess mode.");
+
+    parser.addOptions({
+        mode_option, host_option, port_option, transports_option,
+        scenarios_option, payloads_option, depths_option, connections_option,
+        fanouts_option, warmup_option, duration_option, output_option,
+        serve_option
+    });
+    parser.process(app);
+
+    const int tcp_port = parser.value(port_option).toInt();
+    const int ws_port = tcp_port + 1;
+
+    if (parser.isSet(serve_option))
+        return serve(tcp_port, ws_port);
+
+    QTextStream out(stdout);
+    const QString mode = parser.value(mode_option);
+    QString host = "127.0.0.1";
+
+    std::unique_ptr<BenchServerThread> server_thread;
+    QProcess server_process;
+
+    if (mode == "inprocess") {
+        server_thread.reset(new BenchServerThread(tcp_port, ws_port));
+        if (!server_thread->startServers()) {
+            out << "servers could not listen on ports " << tcp_port
+                << " and " << ws_port << endl;
+            return 1;
+        }
+    } else if (mode == "subprocess") {
+        server_process.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+        server_process.start(QCoreApplication::applicationFilePath(),
+                             { "--serve", "--port", QString::number(tcp_port) });
+        if (!server_process.waitForReadyRead(10000)) {
+            out << "server process did not start" << endl;
+            return 1;
+        }
+    } else if (mode == "external") {
+        host = parser.value(host_option);
+    } else {
+        out << "unknown mode " << mode << endl;
+        return 1;
+    }
+
+    BenchRunner runner(host, tcp_port, ws_port,
+                       parser.value(warmup_option).toInt(),
+                       parser.value(duration_option).toInt());
+
+    const QStringList scenarios =
+        parser.value(scenarios_option).split(',', QString::SkipEmptyParts);
+    const QList<int> payloads = toIntList(parser.value(payloads_option));
+    const QList<int> depths = toIntList(parser.value(depths_option));
+    const QList<int> connections = toIntList(parser.value(connections_option));
+    const QList<int> fanouts = toIntList(parser.value(fanouts_option));
+
+    QJsonArray results;
+    auto run = [&](const BenchConfig& config) {
+        const BenchResult result = runner.run(config);
+        out << result.toString() << endl;
+        results.append(result.toJson());
+    };
+
+    for (const auto& transport :
+         parser.value(transports_option).split(',', QString::SkipEmptyParts))
+    {
+        if (scenarios.contains("echo")) {
+            for (int payload : payloads) {
+                for (int depth : depths) {
+                    for (int connection_count : connections) {
+                        BenchConfig config;
+                        config.transport = transport;
+                        config.scenario = "echo";
+                        config.payload = payload;
+                        config.depth = depth;
+                        config.connections = connection_count;
+                        run(config);
+                    }
+                }
+            }
+        }
+
+        // One publisher makes one call at a time, so the fan-out alone
+        // decides the load.
+        if (scenarios.contains("fanout")) {
+            for (int payload : payloads) {
+                for (int fanout : fanouts) {
+                    BenchConfig config;
+                    config.transport = transport;
+                    config.scenario = "fanout";
+                    config.payload = payload;
+                    config.fanout = fanout;
+                    run(config);
+                }
+            }
+        }
+    }
+
+    if (server_process.state() != QProcess::NotRunning) {
+        server_process.kill();
+        server_process.waitForFinished();
+    }
+
+    const QJsonObject report {
+        { "date", QDateTime::currentDateTimeUtc().toString(Qt::ISODate) },
+        { "qt", QString(qVersion()) },
+        { "mode", mode },
+        { "warmup_ms", parser.value(warmup_option).toInt() },
+        { "duration_ms", parser.value(duration_option).toInt() },
+        { "results", results }
+    };
+
+    QFile file(parser.value(output_option));
+    if (!file.open(QIODevice::WriteOnly)) {
+        out << "could not write " << file.fileName() << endl;
+        return 1;
+    }
+    file.write(QJsonDocument(report).toJson());
+    return 0;
+}
@@ -0,0 +1,165 @@
+#include "json_rpc_async_logger.h"
+
+#include <QFile>
+
+#include <chrono>
+#include <map>
+
+namespace jcon {
+
+JsonRpcAsyncLogger::JsonRpcAsyncLogger(const QString& filename)
+    : JsonRpcAsyncLogger(filename, Options())
+{
+}
+
+JsonRpcAsyncLogger::JsonRpcAsyncLogger(const QString& filename,
+                                       const Options& options)
+    : m_filename(filename)
+    , m_options(options)
+    , m_queue(static_cast<size_t>(qMax(options.capacity, 2)))
+    , m_dropped(0)
+    , m_stop(false)
+    , m_sleeping(false)
+{
+    m_thread = std::thread([this]() { run(); });
+}
+
+JsonRpcAsyncLogger::~JsonRpcAsyncLogger()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop.store(true);
+    }
+    m_wake.notify_one();
+    m_thread.join();
+}
+
+void JsonRpcAsyncLogger::logInfo(const QString& message)
+{
+    push(message);
+}
+
+void JsonRpcAsyncLogger::logWarning(const QString& message)
+{
+    push(message);
+}
+
+void JsonRpcAsyncLogger::logError(const QString& message)
+{
+    push(message);
+}
+
+JsonRpcLoggerPtr JsonRpcAsyncLogger::shared(const QString& filename)
+{
+    static std::mutex mutex;
+    static std::map<QString, std::weak_ptr<JsonRpcLogger>> loggers;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto& entry = loggers[filename];
+    JsonRpcLoggerPtr logger = entry.lock();
+    if (!logger) {
+        logger = std::make_shared<JsonRpcAsyncLogger>(filename);
+        entry = logger;
+    }
+    return logger;
+}
+
+void JsonRpcAsyncLogger::push(const QString& message)
+{
+    if (!m_queue.tryPush(QString(message))) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // Wake the writer only if it is waiting; a wakeup lost to the race with
+    // it going to sleep just delays the message until the flush interval.
+    if (m_sleeping.load(std::memory_order_relaxed) &&
+        m_sleeping.exchange(false))
+    {
+        m_wake.notify_one();
+    }
+}
+
+void JsonRpcAsyncLogger::run()
+{
+    QFile file(m_filename);
+    file.open(QIODevice::WriteOnly);
+
+    QByteArray batch;
+    QString message;
+    quint64 reported_dropped = 0;
+
+    for (;;) {
+        // Read the flag before draining, so that everything logged before
+        // the destructor ran is written.
+        const bool stop = m_stop.load();
+
+        batch.clear();
+        int count = 0;
+        while (count < MaxBatchSize && m_queue.tryPop(message)) {
+            batch += message.toUtf8();
+            batch += '\n';
+            ++count;
+        }
+
+        const quint64 dropped = m_dropped.load(std::memory_order_relaxed);
+        if (dropped != reported_dropped) {
+            batch += QString("%1 log messages dropped\n")
+                .arg(dropped - reported_dropped).toUtf8();
+            reported_dropped = dropped;
+        }
+
+        if (!batch.isEmpty())
+            write(file, batch);
+
+        if (count == MaxBatchSize)
+            continue;
+
+        if (stop)
+            break;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_stop.load())
+            continue;
+        m_sleeping.store(true);
+        m_wake.wait_for(lock, std::chrono::milliseconds(
+                            qMax(m_options.flush_interval, 1)));
+        m_sleeping.store(false);
+    }
+
+    file.close();
+}
+
+void JsonRpcAsyncLogger::write(QFile& file, const QByteArray& bytes)
+{
+    if (m_options.max_file_size > 0 && file.size() > 0 &&
+        file.size() + bytes.size() > m_options.max_file_size)
+    {
+        rotate(file);
+    }
+
+    file.write(bytes);
+    file.flush();
+}
+
+void JsonRpcAsyncLogger::rotate(QFile& file)
+{
+    file.close();
+
+    const int max_files = qMax(m_options.max_files, 0);
+    if (max_files == 0) {
+        QFile::remove(m_filename);
+    } else {
+        QFile::remove(QString("%1.%2").arg(m_filename).arg(max_files));
+        for (int i = max_files - 1; i >= 1; --i) {
+            QFile::rename(QString("%1.%2").arg(m_filename).arg(i),
+                          QString("%1.%2").arg(m_filename).arg(i + 1));
+        }
+        QFile::rename(m_filename, m_filename + ".1");
+    }
+
+    file.open(QIODevice::WriteOnly);
+}
+
+}
@@ -0,0 +1,92 @@
+#ifndef JSON_RPC_ASYNC_LOGGER_H
+#define JSON_RPC_ASYNC_LOGGER_H
+
+#include "jcon.h"
+#include "json_rpc_logger.h"
+#include "mpsc_ring_buffer.h"
+
+#include <QString>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+class QFile;
+
+namespace jcon {
+
+/**
+ * Logger that writes to a file from a background thread.
+ *
+ * Logging only moves the message into a lock-free ring buffer, so it never
+ * blocks the calling thread. The background thread writes the messages in
+ * batches, and starts a new file when the current one exceeds the size
+ * limit, keeping a number of old files as "<name>.1", "<name>.2" etc. When
+ * the ring buffer is full, messages are dropped and counted, and the number
+ * of dropped messages is written to the file.
+ *
+ * Servers and clients created without a logger share one instance per file
+ * name, see shared().
+ */
+class JCON_API JsonRpcAsyncLogger : public JsonRpcLogger
+{
+public:
+    struct Options {
+        /// Number of messages the ring buffer holds.
+        int capacity = 8192;
+
+        /// Size in bytes after which a new file is started, or 0 to never
+        /// start a new file.
+        qint64 max_file_size = 10 * 1024 * 1024;
+
+        /// Number of old files kept besides the current one.
+        int max_files = 3;
+
+        /// Longest time a message waits before it is written, in
+        /// milliseconds.
+        int flush_interval = 100;
+    };
+
+    explicit JsonRpcAsyncLogger(const QString& filename);
+    JsonRpcAsyncLogger(const QString& filename, const Options& options);
+    virtual ~JsonRpcAsyncLogger();
+
+    void logInfo(const QString& message) override;
+    void logWarning(const QString& message) override;
+    void logError(const QString& message) override;
+
+    /// Number of messages dropped because the ring buffer was full.
+    quint64 droppedCount() const {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * The logger for \p filename shared by everyone asking for it while it
+     * is in use. Servers and clients use this as their default logger.
+     */
+    static JsonRpcLoggerPtr shared(const QString& filename);
+
+private:
+    enum { MaxBatchSize = 256 };
+
+    void push(const QString& message);
+    void run();
+    void write(QFile& file, const QByteArray& bytes);
+    void rotate(QFile& file);
+
+    const QString m_filename;
+    const Options m_options;
+    MpscRingBuffer<QString> m_queue;
+    std::atomic<quint64> m_dropped;
+
+    std::atomic<bool> m_stop;
+    std::atomic<bool> m_sleeping;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::thread m_thread;
+};
+
+}
+
+#endif
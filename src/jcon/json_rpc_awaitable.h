@@ -0,0 +1,122 @@
+#ifndef JSON_RPC_AWAITABLE_H
+#define JSON_RPC_AWAITABLE_H
+
+#include "json_rpc_client.h"
+#include "json_rpc_serialization.h"
+#include "json_rpc_success.h"
+
+// The library itself is C++14, so the awaitable is only available to code
+// compiled with coroutine support.
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+#include <coroutine>
+#include <memory>
+
+namespace jcon {
+
+/**
+ * Awaitable RPC call, for use in C++20 coroutines running in the client's
+ * thread:
+ *
+ *     JsonRpcResultPtr result =
+ *         co_await jcon::awaitCall(*rpc_client, "getRandomInt", 10);
+ *
+ * The coroutine is suspended until the call finishes, and resumed by the
+ * client's thread with a JsonRpcSuccess or JsonRpcError, including timeouts
+ * and lost connections. Nothing blocks while the call is in flight.
+ *
+ * A coroutine destroyed while suspended cancels its call, so it is never
+ * resumed. The client must outlive the awaitable.
+ */
+class JsonRpcAwaitable
+{
+public:
+    JsonRpcAwaitable(JsonRpcClient& client,
+                     const QString& method,
+                     const QVariantList& params,
+                     int msecs = -1)
+        : m_client(client)
+        , m_method(method)
+        , m_params(params)
+        , m_msecs(msecs)
+        , m_id(0)
+        , m_state(std::make_shared<State>())
+    {
+    }
+
+    JsonRpcAwaitable(JsonRpcAwaitable&&) = default;
+    JsonRpcAwaitable(const JsonRpcAwaitable&) = delete;
+    JsonRpcAwaitable& operator=(const JsonRpcAwaitable&) = delete;
+
+    ~JsonRpcAwaitable()
+    {
+        // Destroyed with a suspended coroutine, whose handle the handlers
+        // must not resume anymore.
+        if (m_state && !m_state->result && m_id != 0)
+            m_client.cancelRequest(m_id);
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        // The handlers only refer to the state, which they share, so they
+        // never touch an awaitable that has gone away.
+        std::shared_ptr<State> state = m_state;
+        auto finish = [state](JsonRpcResultPtr result) {
+            state->result = std::move(result);
+            if (state->handle)
+                state->handle.resume();
+        };
+
+        const JsonRpcClient::RequestId id = m_client.callAsyncWithHandlers(
+            m_method, m_params,
+            [finish](const QVariant& result) {
+                finish(std::make_shared<JsonRpcSuccess>(result));
+            },
+            [finish](int code, const QString& message, const QVariant& data) {
+                finish(std::make_shared<JsonRpcError>(code, message, data));
+            },
+            m_msecs);
+
+        // A call that failed right away, e.g. while disconnected, doesn't
+        // suspend the coroutine.
+        if (state->result)
+            return false;
+
+        m_id = id;
+        state->handle = handle;
+        return true;
+    }
+
+    JsonRpcResultPtr await_resume() { return m_state->result; }
+
+private:
+    struct State {
+        JsonRpcResultPtr result;
+        std::coroutine_handle<> handle;
+    };
+
+    JsonRpcClient& m_client;
+    QString m_method;
+    QVariantList m_params;
+    int m_msecs;
+    JsonRpcClient::RequestId m_id;
+    std::shared_ptr<State> m_state;
+};
+
+/// Make an awaitable RPC call; see JsonRpcAwaitable.
+template<typename... T>
+JsonRpcAwaitable awaitCall(JsonRpcClient& client,
+                           const QString& method,
+                           T&&... params)
+{
+    return JsonRpcAwaitable(client, method,
+                            QVariantList { valueToJson(params)... });
+}
+
+}
+
+#endif
+
+#endif
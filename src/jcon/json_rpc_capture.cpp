@@ -0,0 +1,143 @@
+#include "json_rpc_capture.h"
+
+#include <QDateTime>
+#include <QtEndian>
+
+#include <cstring>
+
+namespace jcon {
+
+namespace {
+
+const char Magic[] = { 'J', 'C', 'A', 'P' };
+const int HeaderSize = 16;
+
+}
+
+JsonRpcCapture::JsonRpcCapture(const QString& filename)
+    : m_file(filename)
+    , m_last_usecs(0)
+    , m_next_connection(0)
+{
+    if (!m_file.open(QIODevice::WriteOnly))
+        return;
+
+    char header[HeaderSize] = {};
+    memcpy(header, Magic, sizeof(Magic));
+    header[4] = Version;
+    qToLittleEndian<quint64>(
+        static_cast<quint64>(QDateTime::currentMSecsSinceEpoch()) * 1000,
+        reinterpret_cast<uchar*>(header + 8));
+    m_file.write(header, HeaderSize);
+
+    m_clock.start();
+}
+
+JsonRpcCapture::~JsonRpcCapture()
+{
+    flush();
+}
+
+quint32 JsonRpcCapture::addConnection()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_next_connection++;
+}
+
+void JsonRpcCapture::record(quint32 connection, const QByteArray& message)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_file.isOpen())
+        return;
+
+    const qint64 usecs = m_clock.nsecsElapsed() / 1000;
+    writeNumber(static_cast<quint64>(usecs - m_last_usecs));
+    writeNumber(connection);
+    writeNumber(static_cast<quint64>(message.size()));
+    m_file.write(message);
+    m_last_usecs = usecs;
+}
+
+void JsonRpcCapture::flush()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_file.isOpen())
+        m_file.flush();
+}
+
+void JsonRpcCapture::writeNumber(quint64 value)
+{
+    char bytes[10];
+    int size = 0;
+    do {
+        char byte = static_cast<char>(value & 0x7f);
+        value >>= 7;
+        if (value != 0)
+            byte |= 0x80;
+        bytes[size++] = byte;
+    } while (value != 0);
+
+    m_file.write(bytes, size);
+}
+
+JsonRpcCaptureReader::JsonRpcCaptureReader(const QString& filename)
+    : m_file(filename)
+    , m_valid(false)
+    , m_start_time(0)
+    , m_time(0)
+{
+    if (!m_file.open(QIODevice::ReadOnly))
+        return;
+
+    const QByteArray header = m_file.read(HeaderSize);
+    if (header.size() != HeaderSize ||
+        memcmp(header.constData(), Magic, sizeof(Magic)) != 0 ||
+        header[4] != Version)
+    {
+        return;
+    }
+
+    m_start_time = static_cast<qint64>(qFromLittleEndian<quint64>(
+        reinterpret_cast<const uchar*>(header.constData() + 8)));
+    m_valid = true;
+}
+
+bool JsonRpcCaptureReader::readNext(Message& message)
+{
+    if (!m_valid)
+        return false;
+
+    quint64 delta, connection, size;
+    if (!readNumber(delta) || !readNumber(connection) || !readNumber(size))
+        return false;
+
+    // A truncated or corrupt file must not make us allocate a huge size.
+    if (size > static_cast<quint64>(m_file.bytesAvailable()))
+        return false;
+
+    message.data = m_file.read(static_cast<qint64>(size));
+    if (static_cast<quint64>(message.data.size()) != size)
+        return false;
+
+    m_time += static_cast<qint64>(delta);
+    message.time = m_time;
+    message.connection = static_cast<quint32>(connection);
+    return true;
+}
+
+bool JsonRpcCaptureReader::readNumber(quint64& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        char byte;
+        if (!m_file.getChar(&byte))
+            return false;
+
+        value |= static_cast<quint64>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+}
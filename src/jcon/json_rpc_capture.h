@@ -0,0 +1,93 @@
+#ifndef JSON_RPC_CAPTURE_H
+#define JSON_RPC_CAPTURE_H
+
+#include "jcon.h"
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QString>
+
+#include <memory>
+#include <mutex>
+
+namespace jcon {
+
+/**
+ * Records the messages received by endpoints to a file, with the time and
+ * connection they were received on, so that the traffic can be replayed
+ * later, e.g. with jcon_replay.
+ *
+ * The file starts with the magic "JCAP", a version byte, three reserved
+ * bytes and the start time of the capture in microseconds since the epoch,
+ * as 64 bit little endian number. Every message follows as three unsigned
+ * LEB128 numbers: the microseconds since the previous message, the
+ * connection number and the length of the message; then the message itself.
+ */
+class JCON_API JsonRpcCapture
+{
+public:
+    enum { Version = 1 };
+
+    explicit JsonRpcCapture(const QString& filename);
+    ~JsonRpcCapture();
+
+    JsonRpcCapture(const JsonRpcCapture&) = delete;
+    JsonRpcCapture& operator=(const JsonRpcCapture&) = delete;
+
+    bool isOpen() const { return m_file.isOpen(); }
+
+    /// Number for a new connection, to pass to record().
+    quint32 addConnection();
+
+    /// Record a complete message received on \p connection.
+    void record(quint32 connection, const QByteArray& message);
+
+    void flush();
+
+private:
+    void writeNumber(quint64 value);
+
+    QFile m_file;
+    QElapsedTimer m_clock;
+    qint64 m_last_usecs;
+    quint32 m_next_connection;
+    std::mutex m_mutex;
+};
+
+typedef std::shared_ptr<JsonRpcCapture> JsonRpcCapturePtr;
+
+/// Reads the messages of a file written by JsonRpcCapture.
+class JCON_API JsonRpcCaptureReader
+{
+public:
+    struct Message {
+        /// Microseconds since the start of the capture.
+        qint64 time = 0;
+        quint32 connection = 0;
+        QByteArray data;
+    };
+
+    explicit JsonRpcCaptureReader(const QString& filename);
+
+    /// Whether the file could be opened and has a valid header.
+    bool isValid() const { return m_valid; }
+
+    /// Start of the capture, in microseconds since the epoch.
+    qint64 startTime() const { return m_start_time; }
+
+    /// Read the next message. Returns false at the end of the file.
+    bool readNext(Message& message);
+
+private:
+    bool readNumber(quint64& value);
+
+    QFile m_file;
+    bool m_valid;
+    qint64 m_start_time;
+    qint64 m_time;
+};
+
+}
+
+#endif
@@ -1,30 +1,111 @@
 #include "json_rpc_client.h"
-#include "json_rpc_file_logger.h"
+#include "json_rpc_async_logger.h"
+#include "json_rpc_prepared_call.h"
 #include "json_rpc_success.h"
 #include "jcon_assert.h"
 #include "string_util.h"
 
-#include <QSignalSpy>
-#include <QUuid>
-
+#include <QCoreApplication>
+#include <QEvent>
+#include <QEventLoop>
+#include <QFutureInterface>
+#include <QThread>
+#include <QTimer>
+#include <QTimerEvent>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <future>
 #include <memory>
+#include <vector>
 
 namespace jcon {
 
-const QString JsonRpcClient::InvalidRequestId = "";
+namespace {
+
+/// Event running a function in the thread of the object it is posted to.
+class FunctorEvent : public QEvent
+{
+public:
+    explicit FunctorEvent(std::function<void()> functor)
+        : QEvent(eventType())
+        , m_functor(std::move(functor))
+    {
+    }
+
+    static QEvent::Type eventType()
+    {
+        static const QEvent::Type type =
+            static_cast<QEvent::Type>(QEvent::registerEventType());
+        return type;
+    }
+
+    void run() { m_functor(); }
+
+private:
+    std::function<void()> m_functor;
+};
+
+/**
+ * Future of a call, shared by its handlers. If the handlers are destroyed
+ * without either of them being called, as by cancelRequest(), the future is
+ * finished as cancelled, so that nobody waits for it forever.
+ */
+class CallFuture
+{
+public:
+    CallFuture() { m_future.reportStarted(); }
+
+    ~CallFuture()
+    {
+        if (!m_future.isFinished()) {
+            m_future.reportCanceled();
+            m_future.reportFinished();
+        }
+    }
+
+    CallFuture(const CallFuture&) = delete;
+    CallFuture& operator=(const CallFuture&) = delete;
+
+    QFutureInterface<QVariant>& futureInterface() { return m_future; }
+
+private:
+    QFutureInterface<QVariant> m_future;
+};
+
+}
 
 JsonRpcClient::JsonRpcClient(JsonRpcSocketPtr socket,
                              QObject* parent,
                              JsonRpcLoggerPtr logger)
     : QObject(parent)
     , m_logger(logger)
+    , m_timeout_timer_id(0)
+    , m_next_request_id(1)
+    , m_call_timeout(CallTimeout)
+    , m_request_timeout(RequestTimeout)
+    , m_port(0)
+    , m_should_reconnect(false)
+    , m_reconnect_delay(0)
+    , m_reconnect_timer_id(0)
+    , m_random(std::random_device()())
+    , m_batch_timer_id(0)
+    , m_batch_window(0)
+    , m_mean_message_interval(0)
+    , m_last_message_time(0)
+    , m_subscription_flush_scheduled(false)
 {
     if (!m_logger) {
-        m_logger = std::make_shared<JsonRpcFileLogger>("client_log.txt");
+        m_logger = JsonRpcAsyncLogger::shared("client_log.txt");
     }
 
     m_endpoint = std::make_shared<JsonRpcEndpoint>(socket, m_logger, this);
 
+    // Restore the session before anyone else hears about the connection.
+    connect(m_endpoint.get(), &JsonRpcEndpoint::socketConnected,
+            this, [this]() { connectionEstablished(); });
+
     connect(m_endpoint.get(), &JsonRpcEndpoint::socketConnected,
             this, &JsonRpcClient::socketConnected);
 
@@ -33,70 +114,201 @@ JsonRpcClient::JsonRpcClient(JsonRpcSocketPtr socket,
 
     connect(m_endpoint.get(), &JsonRpcEndpoint::socketError,
             this, &JsonRpcClient::socketError);
+
+    connect(m_endpoint.get(), &JsonRpcEndpoint::socketDisconnected,
+            this, [this]() { connectionLost(); });
+
+    // A failed connection attempt reports an error, but no disconnect.
+    connect(m_endpoint.get(), &JsonRpcEndpoint::socketError,
+            this, [this]() {
+                if (!isConnected())
+                    scheduleReconnect();
+            });
+
+    m_clock.start();
 }
 
 JsonRpcClient::~JsonRpcClient()
 {
     disconnectFromServer();
+
+    // The socket may report the disconnect later, or not at all, and the
+    // callers of the remaining requests must not wait for them forever.
+    failOutstandingRequests(JsonRpcError::EC_ConnectionLost,
+                            "client destroyed", false);
 }
 
-JsonRpcResultPtr
-JsonRpcClient::waitForSyncCallbacks(const JsonRpcRequest* request)
+JsonRpcResultPtr JsonRpcClient::callSync(const QString& method,
+                                         const QVariantList& params,
+                                         int msecs)
 {
+    if (QThread::currentThread() != thread()) {
+        return callFromOtherThread(method, params, msecs);
+    }
+
     m_last_result = QVariant();
     m_last_error = JsonRpcError();
 
-    connect(request, &JsonRpcRequest::result,
-            this, &JsonRpcClient::syncCallResult);
+    JsonRpcResultPtr result;
+    QEventLoop loop;
+
+    // The request is sent with the call's timeout, so one of the handlers is
+    // called with a timeout error if there is no response in time.
+    const RequestId id = callAsyncWithHandlers(
+        method, params,
+        [this, &result, &loop](const QVariant& res) {
+            syncCallResult(res);
+            result = std::make_shared<JsonRpcSuccess>(res);
+            loop.quit();
+        },
+        [this, &result, &loop](int code,
+                               const QString& message,
+                               const QVariant& data)
+        {
+            syncCallError(code, message, data);
+            result = std::make_shared<JsonRpcError>(m_last_error);
+            loop.quit();
+        },
+        qMax(msecs, 1));
+
+    if (!result) {
+        loop.exec(QEventLoop::ExcludeUserInputEvents);
+    }
 
-    connect(request, &JsonRpcRequest::error,
-            this, &JsonRpcClient::syncCallError);
+    if (!result) {
+        // The event loop was exited by someone else, so the handlers must
+        // not outlive this call.
+        cancelRequest(id);
+        m_last_error = JsonRpcError(JsonRpcError::EC_InternalError,
+                                    "RPC call interrupted");
+        result = std::make_shared<JsonRpcError>(m_last_error);
+    }
+    return result;
+}
 
-    QSignalSpy res_spy(this, &JsonRpcClient::syncCallSucceeded);
-    QSignalSpy err_spy(this, &JsonRpcClient::syncCallFailed);
-    QTime timer;
-    timer.start();
-    while (res_spy.isEmpty() && err_spy.isEmpty() &&
-           timer.elapsed() < CallTimeout) {
-        QCoreApplication::processEvents();
+JsonRpcResultPtr JsonRpcClient::callFromOtherThread(const QString& method,
+                                                    const QVariantList& params,
+                                                    int msecs)
+{
+    auto promise = std::make_shared<std::promise<JsonRpcResultPtr>>();
+    std::future<JsonRpcResultPtr> future = promise->get_future();
+
+    // The request is sent by the client's thread, and the result is handed
+    // back through the promise. The calling thread never touches the client.
+    QCoreApplication::postEvent(this, new FunctorEvent(
+        [this, method, params, msecs, promise]() {
+            callAsyncWithHandlers(
+                method, params,
+                [promise](const QVariant& result) {
+                    promise->set_value(
+                        std::make_shared<JsonRpcSuccess>(result));
+                },
+                [promise](int code,
+                          const QString& message,
+                          const QVariant& data)
+                {
+                    promise->set_value(
+                        std::make_shared<JsonRpcError>(code, message, data));
+                },
+                qMax(msecs, 1));
+        }));
+
+    if (future.wait_for(std::chrono::milliseconds(msecs)) !=
+        std::future_status::ready)
+    {
+        return std::make_shared<JsonRpcError>(JsonRpcError::EC_RequestTimeout,
+                                              "RPC call timed out");
     }
-    if (!res_spy.isEmpty()) {
-        return std::make_shared<JsonRpcSuccess>(m_last_result);
-    } else if (!err_spy.isEmpty()) {
-        return std::make_shared<JsonRpcError>(m_last_error);
-    } else {
-        return std::make_shared<JsonRpcError>(
-            JsonRpcError::EC_InternalError,
-            "RPC call timed out"
-        );
+    return future.get();
+}
+
+void JsonRpcClient::syncCallResult(const QVariant& result)
+{
+    m_last_result = result;
+    emit syncCallSucceeded();
+}
+
+void JsonRpcClient::syncCallError(int code,
+                                  const QString& message,
+                                  const QVariant& data)
+{
+    m_last_error = JsonRpcError(code, message, data);
+    emit syncCallFailed();
+}
+
+bool JsonRpcClient::event(QEvent* event)
+{
+    if (event->type() == FunctorEvent::eventType()) {
+        static_cast<FunctorEvent*>(event)->run();
+        return true;
+    }
+    return QObject::event(event);
+}
+
+void JsonRpcClient::timerEvent(QTimerEvent* event)
+{
+    if (event->timerId() == m_batch_timer_id) {
+        flushBatch();
+        return;
+    }
+
+    if (event->timerId() == m_reconnect_timer_id) {
+        killTimer(m_reconnect_timer_id);
+        m_reconnect_timer_id = 0;
+
+        if (m_should_reconnect && !isConnected()) {
+            JCON_LOG_INFO(m_logger, QString("reconnecting to %1:%2")
+                                    .arg(m_host).arg(m_port));
+            connectToServerAsync(m_host, m_port);
+        }
+        return;
+    }
+
+    if (event->timerId() != m_timeout_timer_id) {
+        QObject::timerEvent(event);
+        return;
+    }
+
+    expireRequests();
+
+    // Stop ticking while there is nothing to expire. The timer is restarted
+    // by the next request with a timeout.
+    if (m_request_timeouts.isEmpty()) {
+        killTimer(m_timeout_timer_id);
+        m_timeout_timer_id = 0;
     }
 }
 
 JsonRpcResultPtr JsonRpcClient::callExpandArgs(const QString& method,
-                                               const QVariantList& params)
+                                               const QVariantList& params,
+                                               int msecs)
 {
-    JsonRpcRequestPtr req = callAsyncExpandArgs(method, params);
-    return waitForSyncCallbacks(req.get());
+    return callSync(method, params, msecs < 0 ? m_call_timeout : msecs);
 }
 
 JsonRpcRequestPtr JsonRpcClient::callAsyncExpandArgs(const QString& method,
-                                                     const QVariantList& params)
+                                                     const QVariantList& params,
+                                                     int msecs)
 {
     JsonRpcRequestPtr request;
     QJsonObject req_json_obj;
-    std::tie(request, req_json_obj) = prepareCall(method);
+    std::tie(request, req_json_obj) = prepareCall(method, msecs);
 
     if (params.size() > 0) {
         req_json_obj["params"] = QJsonArray::fromVariantList(params);
     }
 
-    m_logger->logInfo(getCallLogMessage(method, params));
-    m_endpoint->send(QJsonDocument(req_json_obj));
+    JCON_LOG_INFO(m_logger, getCallLogMessage(method, params));
+    const JsonRpcTracer::Span span = startSpan(method);
+    transmitRequest(request->id(), method,
+                    serializeRequest(req_json_obj, span),
+                    methodMetrics(method), span);
 
     return request;
 }
 
-void JsonRpcClient::registerNotificationHandler(QObject* obj, const char* methodName, const QString& notificationName)
+void JsonRpcClient::registerNotificationHandler(QObject* obj, const char* methodName, const QString& notificationName,
+                                                const QVariantMap& filter)
 {
   if (obj == nullptr)
     return;
@@ -126,58 +338,784 @@ void JsonRpcClient::registerNotificationHandler(QObject* obj, const char* method
     if (!m_registered_notification_handlers.contains(notificationName, {obj, metaMethod}))
       m_registered_notification_handlers.insert(notificationName, {obj, metaMethod});
 
-    if (isConnected())
-      registerSignalHandler(notificationSignature);
-    else
-      QObject::connect(this, &JsonRpcClient::socketConnected, this, [this,notificationSignature](){registerSignalHandler(notificationSignature);});
+    // Subscriptions are registered again by resubscribe() on every connect.
+    m_subscriptions.insert(notificationSignature, filter);
+
+    if (isConnected()) {
+      m_pending_unsubscriptions.remove(notificationSignature);
+      m_pending_subscriptions.insert(notificationSignature);
+      scheduleSubscriptionFlush();
+    }
   } else {
     qDebug() << QString("Given method %1 is not invokable.").arg(methodName);
   }
 }
 
-void JsonRpcClient::registerSignalHandler(const QString &name) {
+void JsonRpcClient::unregisterNotificationHandler(QObject* obj, const QString& notificationName)
+{
+  for (auto it = m_registered_notification_handlers.find(notificationName);
+       it != m_registered_notification_handlers.end() && it.key() == notificationName;)
+  {
+    if (it.value().first == obj)
+      it = m_registered_notification_handlers.erase(it);
+    else
+      ++it;
+  }
 
-  const auto parts = name.split("/");
-  QString domain, signalName(name);
+  if (m_registered_notification_handlers.contains(notificationName))
+    return;
+
+  for (auto it = m_subscriptions.begin(); it != m_subscriptions.end();) {
+    if (it.key() != notificationName && it.key().section('(', 0, 0) != notificationName) {
+      ++it;
+      continue;
+    }
 
-  if (parts.size() > 1) {
-    domain = parts.first() + "/";
-    signalName = parts.at(1);
+    if (isConnected()) {
+      m_pending_subscriptions.remove(it.key());
+      m_pending_unsubscriptions.insert(it.key());
+      scheduleSubscriptionFlush();
+    }
+    it = m_subscriptions.erase(it);
+  }
+}
+
+JsonRpcRequestPtr JsonRpcClient::subscribeSignals(const QStringList& signatures,
+                                                  const QString& domain)
+{
+  const QString prefix = domain.isEmpty() ? QString() : domain + "/";
+  QVariantList entries;
+
+  for (const auto& signature : signatures) {
+    const QString name = prefix + signature;
+    // Keep the filter of an existing subscription.
+    const QVariantMap filter = m_subscriptions.value(name);
+    m_subscriptions.insert(name, filter);
+    m_pending_subscriptions.remove(name);
+    m_pending_unsubscriptions.remove(name);
+
+    if (filter.isEmpty())
+      entries.append(signature);
+    else
+      entries.append(QVariantMap { { "signal", signature }, { "filter", filter } });
   }
 
-  auto request = callAsync(domain + "registerSignalHandler", signalName);
-  QObject::connect(request.get(), &JsonRpcRequest::error, this, [](int code, const QString& msg, const QVariant& data){ qDebug() << "Error registering signal handler. Error message is" << msg;});
+  return callAsyncExpandArgs(prefix + "registerSignalHandlers", entries);
 }
 
-std::pair<JsonRpcRequestPtr, QJsonObject>
-JsonRpcClient::prepareCall(const QString& method)
+JsonRpcRequestPtr JsonRpcClient::unsubscribeSignals(const QStringList& signatures,
+                                                    const QString& domain)
+{
+  const QString prefix = domain.isEmpty() ? QString() : domain + "/";
+  QVariantList entries;
+
+  for (const auto& signature : signatures) {
+    const QString name = prefix + signature;
+    m_subscriptions.remove(name);
+    m_pending_subscriptions.remove(name);
+    m_pending_unsubscriptions.remove(name);
+    entries.append(signature);
+  }
+
+  return callAsyncExpandArgs(prefix + "unregisterSignalHandlers", entries);
+}
+
+QString JsonRpcClient::splitSignalName(const QString& name, QString& signature)
+{
+  const int separator = name.indexOf('/');
+  if (separator == -1) {
+    signature = name;
+    return QString();
+  }
+  signature = name.mid(separator + 1);
+  return name.left(separator + 1);
+}
+
+JsonRpcRequestPtr JsonRpcClient::sendRequest(const QString& method,
+                                             const QVariantList& params,
+                                             int msecs)
 {
     JsonRpcRequestPtr request;
-    RequestId id;
-    std::tie(request, id) = createRequest();
-    m_outstanding_requests[id] = request;
+    QJsonObject req_json_obj;
+    std::tie(request, req_json_obj) = prepareCall(method, msecs);
+
+    req_json_obj["params"] = QJsonArray::fromVariantList(params);
+
+    JCON_LOG_INFO(m_logger, getCallLogMessage(method, params));
+    const JsonRpcTracer::Span span = startSpan(method);
+    transmitRequest(request->id(), method,
+                    serializeRequest(req_json_obj, span),
+                    methodMetrics(method), span);
+
+    return request;
+}
+
+JsonRpcClient::RequestId
+JsonRpcClient::callAsyncWithHandlers(const QString& method,
+                                     const QVariantList& params,
+                                     ResultHandler on_result,
+                                     ErrorHandler on_error,
+                                     int msecs)
+{
+    const RequestId id = m_next_request_id++;
+    addOutstandingRequest(id, std::move(on_result), std::move(on_error),
+                          msecs);
+
     QJsonObject req_json_obj = createRequestJsonObject(method, id);
-    return std::make_pair(request, req_json_obj);
+    req_json_obj["params"] = QJsonArray::fromVariantList(params);
+
+    JCON_LOG_INFO(m_logger, getCallLogMessage(method, params));
+    const JsonRpcTracer::Span span = startSpan(method);
+    transmitRequest(id, method,
+                    serializeRequest(req_json_obj, span),
+                    methodMetrics(method), span);
+
+    return id;
 }
 
-std::pair<JsonRpcRequestPtr, JsonRpcClient::RequestId>
-JsonRpcClient::createRequest()
+QFuture<QVariant> JsonRpcClient::callFutureExpandArgs(const QString& method,
+                                                     const QVariantList& params,
+                                                     int msecs)
 {
-    auto id = createUuid();
-    auto request = std::make_shared<JsonRpcRequest>(this, id);
-    return std::make_pair(request, id);
+    // The handlers share the future's state, and finish it as cancelled
+    // when they are destroyed without being called.
+    auto call = std::make_shared<CallFuture>();
+    QFuture<QVariant> future = call->futureInterface().future();
+
+    callAsyncWithHandlers(
+        method, params,
+        [call](const QVariant& result) {
+            call->futureInterface().reportResult(result);
+            call->futureInterface().reportFinished();
+        },
+        [call](int code, const QString& message, const QVariant& data) {
+            call->futureInterface().reportException(
+                JsonRpcException(code, message, data));
+            call->futureInterface().reportFinished();
+        },
+        msecs);
+
+    return future;
 }
 
-JsonRpcClient::RequestId JsonRpcClient::createUuid()
+JsonRpcPreparedCall JsonRpcClient::prepare(const QString& method)
 {
-    RequestId id = QUuid::createUuid().toString();
-    int len = id.length();
-    id = id.left(len - 1).right(len - 2);
+    return JsonRpcPreparedCall(this, method);
+}
+
+JsonRpcClient::RequestId
+JsonRpcClient::callPrepared(const JsonRpcPreparedCall& call,
+                            const QVariantList& params,
+                            ResultHandler on_result,
+                            ErrorHandler on_error,
+                            int msecs)
+{
+    const RequestId id = m_next_request_id++;
+    addOutstandingRequest(id, std::move(on_result), std::move(on_error),
+                          msecs);
+
+    JCON_LOG_INFO(m_logger, getCallLogMessage(call.method(), params));
+    const JsonRpcTracer::Span span = startSpan(call.method());
+    transmitRequest(id, call.method(),
+                    serializePrepared(call, params, id, span),
+                    *call.m_metrics, span);
+
     return id;
 }
 
+void JsonRpcClient::notifyPrepared(const JsonRpcPreparedCall& call,
+                                   const QVariantList& params)
+{
+    JCON_LOG_INFO(m_logger, getCallLogMessage(call.method(), params));
+    const JsonRpcTracer::Span span = startSpan(call.method());
+    sendMessage(serializePrepared(call, params, 0, span));
+
+    // Notifications have no response, so their span ends once sent.
+    if (span.isRecording())
+        m_tracer->endSpan(span, "send", JsonRpcTracer::SK_Client);
+}
+
+void JsonRpcClient::addRequestInterceptor(RequestInterceptor interceptor)
+{
+    m_request_interceptors.push_back(std::move(interceptor));
+}
+
+void JsonRpcClient::addResponseInterceptor(ResponseInterceptor interceptor)
+{
+    m_response_interceptors.push_back(std::move(interceptor));
+}
+
+JsonRpcTracer::Span JsonRpcClient::startSpan(const QString& method)
+{
+    return m_tracer ? m_tracer->startSpan(method) : JsonRpcTracer::Span();
+}
+
+JsonRpcMethodMetrics& JsonRpcClient::methodMetrics(const QString& method)
+{
+    auto it = m_method_metrics.find(method);
+    if (it == m_method_metrics.end())
+        it = m_method_metrics.insert(method, &m_metrics.method(method));
+    return **it;
+}
+
+QByteArray JsonRpcClient::serializeRequest(QJsonObject& request,
+                                           const JsonRpcTracer::Span& span)
+{
+    // Calls that aren't sampled say so, so that the server doesn't start
+    // a trace of its own for them.
+    if (m_tracer)
+        request["trace"] = span.context.toJson();
+
+    for (const auto& interceptor : m_request_interceptors)
+        interceptor(request);
+
+    return QJsonDocument(request).toJson(QJsonDocument::Compact);
+}
+
+QByteArray JsonRpcClient::serializePrepared(const JsonRpcPreparedCall& call,
+                                            const QVariantList& params,
+                                            RequestId id,
+                                            const JsonRpcTracer::Span& span)
+{
+    if (m_request_interceptors.empty() && !span.isRecording())
+        return call.serialize(params, id, m_tracer != nullptr);
+
+    // Interceptors and the trace context need the request as JSON object,
+    // which prepared calls otherwise skip.
+    QJsonObject request = createRequestJsonObject(call.method(), id);
+    if (id == 0)
+        request.remove("id");
+    request["params"] = QJsonArray::fromVariantList(params);
+    return serializeRequest(request, span);
+}
+
+bool JsonRpcClient::cancelRequest(RequestId id)
+{
+    OutstandingRequest request;
+    if (!takeOutstandingRequest(id, request))
+        return false;
+
+    recordRequestEnd(request, false, false);
+    return true;
+}
+
+std::pair<JsonRpcRequestPtr, QJsonObject>
+JsonRpcClient::prepareCall(const QString& method, int msecs)
+{
+    const RequestId id = m_next_request_id++;
+    auto request = std::make_shared<JsonRpcRequest>(this, id);
+
+    // The handlers forward to the signals of the request object, and keep it
+    // alive until the request is finished.
+    addOutstandingRequest(
+        id,
+        [request](const QVariant& result) {
+            emit request->result(result);
+        },
+        [request](int code, const QString& message, const QVariant& data) {
+            emit request->error(code, message, data);
+        },
+        msecs);
+
+    QJsonObject req_json_obj = createRequestJsonObject(method, id);
+    return std::make_pair(request, req_json_obj);
+}
+
+void JsonRpcClient::addOutstandingRequest(RequestId id,
+                                          ResultHandler on_result,
+                                          ErrorHandler on_error,
+                                          int msecs)
+{
+    OutstandingRequest outstanding;
+    outstanding.on_result = std::move(on_result);
+    outstanding.on_error = std::move(on_error);
+
+    if (msecs < 0)
+        msecs = m_request_timeout;
+
+    if (msecs > 0) {
+        const JsonRpcTimerWheel::Tick now = elapsedTicks();
+
+        // The wheel stands still while it is empty and the timer is off.
+        // Catch up at once, rather than tick by tick on the next expiry.
+        if (m_request_timeouts.isEmpty())
+            m_request_timeouts.advanceTo(now, [](JsonRpcTimerWheel::Key) {});
+
+        // The wheel lags behind the clock by up to a tick while the timer is
+        // running, so measure the deadline from the clock.
+        const JsonRpcTimerWheel::Tick deadline = now +
+            (msecs + TimeoutResolution - 1) / TimeoutResolution;
+        outstanding.timer = m_request_timeouts.schedule(
+            id, deadline - m_request_timeouts.currentTick());
+
+        if (m_timeout_timer_id == 0) {
+            m_timeout_timer_id = startTimer(TimeoutResolution,
+                                            Qt::CoarseTimer);
+        }
+    }
+
+    m_outstanding_requests.insert(id, std::move(outstanding));
+}
+
+void JsonRpcClient::transmitRequest(RequestId id,
+                                    const QString& method,
+                                    const QByteArray& bytes,
+                                    JsonRpcMethodMetrics& metrics,
+                                    const JsonRpcTracer::Span& span)
+{
+    OutstandingRequest* outstanding = m_outstanding_requests.find(id);
+    if (outstanding) {
+        outstanding->metrics = &metrics;
+        outstanding->sent = m_clock.nsecsElapsed();
+        outstanding->span = span;
+        metrics.callStarted();
+    }
+
+    if (m_reconnect_policy.enabled && m_idempotent_methods.contains(method)) {
+        if (outstanding)
+            outstanding->replay = bytes;
+
+        // Sent by replayRequests() once connected.
+        if (!isConnected())
+            return;
+    }
+
+    sendMessage(bytes);
+}
+
+void JsonRpcClient::recordRequestEnd(const OutstandingRequest& request,
+                                     bool answered,
+                                     bool error)
+{
+    if (request.span.isRecording() && m_tracer) {
+        m_tracer->endSpan(request.span, "send", JsonRpcTracer::SK_Client,
+                          error);
+    }
+
+    if (!request.metrics)
+        return;
+
+    if (answered) {
+        const qint64 nsecs = m_clock.nsecsElapsed() - request.sent;
+        request.metrics->callFinished(error, static_cast<quint64>(nsecs));
+    } else {
+        request.metrics->callAbandoned(error);
+    }
+}
+
+JsonRpcTimerWheel::Tick JsonRpcClient::elapsedTicks() const
+{
+    return static_cast<JsonRpcTimerWheel::Tick>(m_clock.elapsed()) /
+        TimeoutResolution;
+}
+
+bool JsonRpcClient::takeOutstandingRequest(RequestId id,
+                                           OutstandingRequest& request)
+{
+    if (!m_outstanding_requests.take(id, request))
+        return false;
+
+    if (request.timer != JsonRpcTimerWheel::InvalidTimer)
+        m_request_timeouts.cancel(request.timer);
+    return true;
+}
+
+void JsonRpcClient::expireRequests()
+{
+    std::vector<RequestId> expired;
+    m_request_timeouts.advanceTo(elapsedTicks(),
+                                 [&expired](JsonRpcTimerWheel::Key id) {
+                                     expired.push_back(id);
+                                 });
+
+    for (RequestId id : expired) {
+        // The wheel has already released the timer.
+        OutstandingRequest* outstanding = m_outstanding_requests.find(id);
+        if (!outstanding)
+            continue;
+        outstanding->timer = JsonRpcTimerWheel::InvalidTimer;
+
+        OutstandingRequest request;
+        takeOutstandingRequest(id, request);
+        recordRequestEnd(request, false, true);
+
+        if (m_logger->isEnabled(JsonRpcLogger::LL_Error))
+            logError(QString("request %1 timed out").arg(id));
+        if (request.on_error) {
+            request.on_error(JsonRpcError::EC_RequestTimeout,
+                             "RPC call timed out", QVariant());
+        }
+    }
+}
+
+void JsonRpcClient::failOutstandingRequests(int code,
+                                            const QString& message,
+                                            bool keep_replayable)
+{
+    if (m_outstanding_requests.isEmpty())
+        return;
+
+    // Take the requests before calling any handler, since the handlers may
+    // well make new calls.
+    std::vector<std::pair<RequestMap::Key, OutstandingRequest>> requests;
+    if (keep_replayable) {
+        std::vector<RequestId> failed;
+        m_outstanding_requests.forEach(
+            [&failed](RequestMap::Key id, OutstandingRequest& request) {
+                if (request.replay.isEmpty())
+                    failed.push_back(id);
+            });
+
+        for (RequestId id : failed) {
+            requests.emplace_back(id, OutstandingRequest());
+            m_outstanding_requests.take(id, requests.back().second);
+        }
+    } else {
+        m_outstanding_requests.takeAll(requests);
+    }
+
+    if (requests.empty())
+        return;
+
+    for (auto& entry : requests) {
+        if (entry.second.timer != JsonRpcTimerWheel::InvalidTimer)
+            m_request_timeouts.cancel(entry.second.timer);
+        recordRequestEnd(entry.second, false, true);
+    }
+
+    if (m_logger->isEnabled(JsonRpcLogger::LL_Error)) {
+        logError(QString("failing %1 outstanding requests: %2")
+                 .arg(requests.size()).arg(message));
+    }
+
+    for (auto& entry : requests) {
+        if (entry.second.on_error)
+            entry.second.on_error(code, message, QVariant());
+    }
+}
+
+void JsonRpcClient::setReconnectPolicy(const ReconnectPolicy& policy)
+{
+    m_reconnect_policy = policy;
+    m_reconnect_delay = policy.initial_delay;
+}
+
+void JsonRpcClient::setMethodIdempotent(const QString& method,
+                                        bool idempotent)
+{
+    if (idempotent)
+        m_idempotent_methods.insert(method);
+    else
+        m_idempotent_methods.remove(method);
+}
+
+void JsonRpcClient::setBatchingPolicy(const BatchingPolicy& policy)
+{
+    m_batching_policy = policy;
+    m_batch_window = 0;
+    m_mean_message_interval = qMax(0, policy.max_window_usecs);
+
+    if (!policy.enabled)
+        flushBatch();
+}
+
+void JsonRpcClient::sendMessage(const QByteArray& bytes)
+{
+    if (!m_batching_policy.enabled) {
+        m_endpoint->send(bytes);
+        return;
+    }
+
+    updateBatchWindow();
+    m_batch.append(bytes);
+
+    if (m_batch.size() >= m_batching_policy.max_batch_size) {
+        flushBatch();
+        return;
+    }
+
+    // A zero timer fires once control returns to the event loop.
+    if (m_batch_timer_id == 0) {
+        m_batch_timer_id = startTimer(static_cast<int>(m_batch_window / 1000),
+                                      Qt::PreciseTimer);
+    }
+}
+
+void JsonRpcClient::updateBatchWindow()
+{
+    const qint64 max_window = qMax(0, m_batching_policy.max_window_usecs);
+    const qint64 now = m_clock.nsecsElapsed() / 1000;
+    const qint64 interval = qMin(now - m_last_message_time, max_window);
+    m_last_message_time = now;
+
+    // Waiting for the next message only pays off when it is likely to come
+    // within the window, so the window is the part of the longest window not
+    // covered by the average time between messages.
+    m_mean_message_interval += (interval - m_mean_message_interval) / 8;
+    m_batch_window = max_window - static_cast<qint64>(m_mean_message_interval);
+}
+
+void JsonRpcClient::flushBatch()
+{
+    if (m_batch_timer_id != 0) {
+        killTimer(m_batch_timer_id);
+        m_batch_timer_id = 0;
+    }
+
+    if (m_batch.isEmpty())
+        return;
+
+    if (m_batch.size() == 1) {
+        m_endpoint->send(m_batch.first());
+    } else {
+        int size = m_batch.size() + 1;
+        for (const auto& message : m_batch)
+            size += message.size();
+
+        QByteArray bytes;
+        bytes.reserve(size);
+        bytes.append('[');
+        for (int i = 0; i < m_batch.size(); ++i) {
+            if (i > 0)
+                bytes.append(',');
+            bytes.append(m_batch.at(i));
+        }
+        bytes.append(']');
+        m_endpoint->send(bytes);
+    }
+
+    m_batch.clear();
+}
+
+void JsonRpcClient::connectionEstablished()
+{
+    m_reconnect_delay = m_reconnect_policy.initial_delay;
+    if (m_reconnect_timer_id != 0) {
+        killTimer(m_reconnect_timer_id);
+        m_reconnect_timer_id = 0;
+    }
+
+    resubscribe();
+    replayRequests();
+}
+
+void JsonRpcClient::connectionLost()
+{
+    const bool reconnect = m_reconnect_policy.enabled && m_should_reconnect;
+
+    // Messages still waiting for their batch can't be sent anymore.
+    m_batch.clear();
+
+    // Nothing will answer the requests sent over the lost connection, but
+    // the replayable ones get another chance after reconnecting.
+    failOutstandingRequests(JsonRpcError::EC_ConnectionLost,
+                            "connection to server lost", reconnect);
+
+    if (reconnect)
+        scheduleReconnect();
+}
+
+void JsonRpcClient::scheduleReconnect()
+{
+    if (!m_reconnect_policy.enabled || !m_should_reconnect ||
+        m_reconnect_timer_id != 0)
+    {
+        return;
+    }
+
+    const int delay = qMax(m_reconnect_delay, 1);
+    const double jitter = qBound(0.0, m_reconnect_policy.jitter, 1.0);
+    std::uniform_real_distribution<double> random(0.0, 1.0);
+    const int msecs = qMax(1, static_cast<int>(
+        delay * (1.0 - jitter + jitter * random(m_random))));
+
+    m_reconnect_delay = static_cast<int>(qMin<double>(
+        delay * m_reconnect_policy.multiplier, m_reconnect_policy.max_delay));
+
+    m_reconnect_timer_id = startTimer(msecs);
+    emit reconnectScheduled(msecs);
+}
+
+void JsonRpcClient::replayRequests()
+{
+    std::vector<std::pair<RequestId, QByteArray>> requests;
+    m_outstanding_requests.forEach(
+        [&requests](RequestMap::Key id, OutstandingRequest& request) {
+            if (!request.replay.isEmpty())
+                requests.emplace_back(id, request.replay);
+        });
+
+    if (requests.empty())
+        return;
+
+    // Send in the order the requests were made.
+    std::sort(requests.begin(), requests.end(),
+              [](const std::pair<RequestId, QByteArray>& a,
+                 const std::pair<RequestId, QByteArray>& b) {
+                  return a.first < b.first;
+              });
+
+    JCON_LOG_INFO(m_logger, QString("sending %1 idempotent requests again")
+                            .arg(requests.size()));
+
+    for (const auto& request : requests)
+        sendMessage(request.second);
+}
+
+void JsonRpcClient::resubscribe()
+{
+    // A new connection starts without subscriptions on the server side.
+    m_pending_unsubscriptions.clear();
+    m_pending_subscriptions.clear();
+    for (auto it = m_subscriptions.constBegin();
+         it != m_subscriptions.constEnd();
+         ++it)
+    {
+        m_pending_subscriptions.insert(it.key());
+    }
+    flushSubscriptions();
+}
+
+void JsonRpcClient::scheduleSubscriptionFlush()
+{
+    if (m_subscription_flush_scheduled)
+        return;
+
+    m_subscription_flush_scheduled = true;
+    QTimer::singleShot(0, this, [this]() { flushSubscriptions(); });
+}
+
+void JsonRpcClient::flushSubscriptions()
+{
+    m_subscription_flush_scheduled = false;
+
+    if (!isConnected()) {
+        // Everything is sent again by resubscribe() after connecting.
+        m_pending_subscriptions.clear();
+        m_pending_unsubscriptions.clear();
+        return;
+    }
+
+    // One registerSignalHandlers and unregisterSignalHandlers request per
+    // service domain.
+    QHash<QString, QVariantList> subscriptions;
+    QHash<QString, QVariantList> unsubscriptions;
+
+    for (const auto& name : m_pending_unsubscriptions) {
+        QString signature;
+        const QString domain = splitSignalName(name, signature);
+        unsubscriptions[domain].append(signature);
+    }
+
+    for (const auto& name : m_pending_subscriptions) {
+        QString signature;
+        const QString domain = splitSignalName(name, signature);
+        const QVariantMap filter = m_subscriptions.value(name);
+        if (filter.isEmpty()) {
+            subscriptions[domain].append(signature);
+        } else {
+            subscriptions[domain].append(
+                QVariantMap { { "signal", signature }, { "filter", filter } });
+        }
+    }
+
+    m_pending_subscriptions.clear();
+    m_pending_unsubscriptions.clear();
+
+    for (auto it = unsubscriptions.constBegin();
+         it != unsubscriptions.constEnd();
+         ++it)
+    {
+        sendSubscriptions(it.key(), it.value(), false);
+    }
+
+    for (auto it = subscriptions.constBegin();
+         it != subscriptions.constEnd();
+         ++it)
+    {
+        sendSubscriptions(it.key(), it.value(), true);
+    }
+}
+
+void JsonRpcClient::sendSubscriptions(const QString& domain,
+                                      const QVariantList& entries,
+                                      bool subscribe)
+{
+    const QString method = domain + (subscribe ? "registerSignalHandlers"
+                                               : "unregisterSignalHandlers");
+
+    auto onResult = [this, domain](const QVariant& result) {
+        for (const auto& entry : result.toList()) {
+            const auto status = entry.toMap();
+            if (!status.value("resultCode").toBool()) {
+                subscriptionError(domain + status.value("signal").toString(),
+                                  status.value("resultText").toString());
+            }
+        }
+    };
+
+    auto onError = [this, domain, entries, subscribe](int code,
+                                                      const QString& message,
+                                                      const QVariant&)
+    {
+        // Servers from before the bulk methods only know the requests for
+        // single signals.
+        for (const auto& entry : entries) {
+            if (code == JsonRpcError::EC_MethodNotFound)
+                sendSubscription(domain, entry, subscribe);
+            else
+                subscriptionError(domain + signalOfEntry(entry), message);
+        }
+    };
+
+    callAsyncWithHandlers(method, entries, onResult, onError);
+}
+
+void JsonRpcClient::sendSubscription(const QString& domain,
+                                     const QVariant& entry,
+                                     bool subscribe)
+{
+    const QString name = domain + signalOfEntry(entry);
+
+    // The parameters as the single signal requests have always taken them.
+    QVariantList params { signalOfEntry(entry) };
+    const QVariantMap filter = entry.toMap().value("filter").toMap();
+    if (subscribe && !filter.isEmpty())
+        params.append(filter);
+
+    callAsyncWithHandlers(
+        domain + (subscribe ? "registerSignalHandler"
+                            : "unregisterSignalHandler"),
+        params,
+        [this, name](const QVariant& result) {
+            const auto status = result.toMap();
+            if (status.contains("resultCode") &&
+                !status.value("resultCode").toBool())
+            {
+                subscriptionError(name, status.value("resultText").toString());
+            }
+        },
+        [this, name](int, const QString& message, const QVariant&) {
+            subscriptionError(name, message);
+        });
+}
+
+QString JsonRpcClient::signalOfEntry(const QVariant& entry)
+{
+    return entry.type() == QVariant::Map ?
+        entry.toMap().value("signal").toString() : entry.toString();
+}
+
+void JsonRpcClient::subscriptionError(const QString& name,
+                                      const QString& message)
+{
+    logError(QString("changing the subscription of %1 failed: %2")
+             .arg(name, message));
+    emit subscriptionFailed(name, message);
+}
+
 QJsonObject JsonRpcClient::createRequestJsonObject(const QString& method,
-                                                   const QString& id)
+                                                   RequestId id)
 {
     return QJsonObject {
         { "jsonrpc", "2.0" },
@@ -188,32 +1126,56 @@ QJsonObject JsonRpcClient::createRequestJsonObject(const QString& method,
 
 bool JsonRpcClient::connectToServer(const QString& host, int port)
 {
+    m_host = host;
+    m_port = port;
+    m_should_reconnect = true;
+
     if (!m_endpoint->connectToHost(host, port)) {
+        scheduleReconnect();
         return false;
     }
 
     connect(m_endpoint.get(), &JsonRpcEndpoint::jsonObjectReceived,
             this, &JsonRpcClient::jsonResponseReceived);
+    connect(m_endpoint.get(), &JsonRpcEndpoint::jsonArrayReceived,
+            this, &JsonRpcClient::jsonBatchReceived);
 
     return true;
 }
 
 void JsonRpcClient::connectToServerAsync(const QString& host, int port) {
+  m_host = host;
+  m_port = port;
+  m_should_reconnect = true;
+
   m_endpoint->connectToHostAsync(host, port);
 
   QObject::disconnect(m_endpoint.get(), &JsonRpcEndpoint::jsonObjectReceived,
                    this, &JsonRpcClient::jsonResponseReceived);
+  QObject::disconnect(m_endpoint.get(), &JsonRpcEndpoint::jsonArrayReceived,
+                   this, &JsonRpcClient::jsonBatchReceived);
   QObject::connect(m_endpoint.get(), &JsonRpcEndpoint::jsonObjectReceived,
           this, &JsonRpcClient::jsonResponseReceived);
+  QObject::connect(m_endpoint.get(), &JsonRpcEndpoint::jsonArrayReceived,
+          this, &JsonRpcClient::jsonBatchReceived);
 }
 
 
 
 void JsonRpcClient::disconnectFromServer()
 {
+    m_should_reconnect = false;
+    if (m_reconnect_timer_id != 0) {
+        killTimer(m_reconnect_timer_id);
+        m_reconnect_timer_id = 0;
+    }
+
+    flushBatch();
     m_endpoint->disconnectFromHost();
     QObject::disconnect(m_endpoint.get(), &JsonRpcEndpoint::jsonObjectReceived,
                      this, &JsonRpcClient::jsonResponseReceived);
+    QObject::disconnect(m_endpoint.get(), &JsonRpcEndpoint::jsonArrayReceived,
+                     this, &JsonRpcClient::jsonBatchReceived);
 }
 
 bool JsonRpcClient::isConnected() const
@@ -232,22 +1194,21 @@ int JsonRpcClient::clientPort() const
 
 
 
-void JsonRpcClient::syncCallResult(const QVariant& result)
-{
-    m_last_result = result;
-    emit syncCallSucceeded();
-}
-
-void JsonRpcClient::syncCallError(int code,
-                                  const QString& message,
-                                  const QVariant& data)
+void JsonRpcClient::jsonBatchReceived(const QJsonArray& batch)
 {
-    m_last_error = JsonRpcError(code, message, data);
-    emit syncCallFailed();
+    for (const auto& response : batch) {
+        if (response.isObject())
+            jsonResponseReceived(response.toObject());
+        else
+            logError("invalid response in batch");
+    }
 }
 
 void JsonRpcClient::jsonResponseReceived(const QJsonObject& response)
 {
+    for (const auto& interceptor : m_response_interceptors)
+        interceptor(response);
+
     JCON_ASSERT(response["jsonrpc"].toString() == "2.0");
 
     if (response.value("jsonrpc").toString() != "2.0") {
@@ -260,18 +1221,22 @@ void JsonRpcClient::jsonResponseReceived(const QJsonObject& response)
         QString msg;
         QVariant data;
         getJsonErrorInfo(response, code, msg, data);
-        logError(QString("(%1) - %2").arg(code).arg(msg));
-
-        RequestId id = response.value("id").toString(InvalidRequestId);
-        if (id != InvalidRequestId) {
-            auto it = m_outstanding_requests.find(id);
-            if (it == m_outstanding_requests.end()) {
-                logError(QString("got error response for non-existing "
-                                 "request: %1").arg(id));
+        if (m_logger->isEnabled(JsonRpcLogger::LL_Error))
+            logError(QString("(%1) - %2").arg(code).arg(msg));
+
+        RequestId id;
+        if (getResponseId(response, id)) {
+            OutstandingRequest request;
+            if (!takeOutstandingRequest(id, request)) {
+                if (m_logger->isEnabled(JsonRpcLogger::LL_Error)) {
+                    logError(QString("got error response for non-existing "
+                                     "request: %1").arg(id));
+                }
                 return;
             }
-            emit it->second->error(code, msg, data);
-            m_outstanding_requests.erase(it);
+            recordRequestEnd(request, true, true);
+            if (request.on_error)
+                request.on_error(code, msg, data);
         }
 
         return;
@@ -288,22 +1253,42 @@ void JsonRpcClient::jsonResponseReceived(const QJsonObject& response)
         return;
     }
 
-    RequestId id = response.value("id").toString(InvalidRequestId);
-    if (id == InvalidRequestId) {
+    RequestId id;
+    if (!getResponseId(response, id)) {
         logError("response ID is undefined");
         return;
     }
 
-    const auto it = m_outstanding_requests.find(id);
-    if (it == m_outstanding_requests.end()) {
-        logError(QString("got response to non-existing request: %1").arg(id));
+    OutstandingRequest request;
+    if (!takeOutstandingRequest(id, request)) {
+        if (m_logger->isEnabled(JsonRpcLogger::LL_Error))
+            logError(QString("got response to non-existing request: %1").arg(id));
         return;
     }
 
-    QVariant result = response.value(QStringLiteral("result")).toVariant();
+    recordRequestEnd(request, true, false);
+    if (request.on_result) {
+        request.on_result(
+            response.value(QStringLiteral("result")).toVariant());
+    }
+}
 
-    emit it->second->result(result);
-    m_outstanding_requests.erase(it);
+bool JsonRpcClient::getResponseId(const QJsonObject& response, RequestId& id)
+{
+    const QJsonValue value = response.value(QStringLiteral("id"));
+
+    if (value.isDouble()) {
+        id = static_cast<RequestId>(value.toDouble());
+    } else if (value.isString()) {
+        // Be lenient with servers that return the ID as string.
+        bool ok = false;
+        id = value.toString().toLongLong(&ok);
+        if (!ok)
+            return false;
+    } else {
+        return false;
+    }
+    return id > 0;
 }
 
 
@@ -350,7 +1335,7 @@ QString JsonRpcClient::getCallLogMessage(const QString& method,
 
 void JsonRpcClient::logError(const QString& msg)
 {
-    m_logger->logError("JSON RPC client error: " + msg);
+    JCON_LOG_ERROR(m_logger, "JSON RPC client error: " + msg);
 }
 
 }
@@ -4,22 +4,35 @@
 #include "jcon.h"
 #include "json_rpc_endpoint.h"
 #include "json_rpc_error.h"
+#include "json_rpc_exception.h"
 #include "json_rpc_logger.h"
+#include "json_rpc_metrics.h"
 #include "json_rpc_request.h"
 #include "json_rpc_result.h"
 #include "json_rpc_common.h"
 #include "json_rpc_serialization.h"
+#include "json_rpc_timer_wheel.h"
+#include "json_rpc_tracer.h"
+#include "request_table.h"
 
+#include <QElapsedTimer>
+#include <QFuture>
+#include <QHash>
 #include <QJsonArray>
 #include <QJsonObject>
 #include <QJsonDocument>
+#include <QSet>
+#include <QStringList>
 
-#include <map>
+#include <functional>
 #include <memory>
+#include <random>
 #include <utility>
+#include <vector>
 
 namespace jcon {
 
+class JsonRpcPreparedCall;
 class JsonRpcSocket;
 
 class JCON_API JsonRpcClient : public QObject, public JsonRpcCommon
@@ -27,7 +40,43 @@ class JCON_API JsonRpcClient : public QObject, public JsonRpcCommon
     Q_OBJECT
 
 public:
-    typedef QString RequestId;
+    /// Requests are numbered sequentially, starting from 1.
+    typedef JsonRpcRequest::Id RequestId;
+
+    /// Continuations for the outcome of callAsyncWithHandlers().
+    typedef std::function<void(const QVariant& result)> ResultHandler;
+    typedef std::function<void(int code,
+                               const QString& message,
+                               const QVariant& data)> ErrorHandler;
+
+    /// How to reconnect after the connection to the server is lost.
+    struct ReconnectPolicy {
+        bool enabled = false;
+
+        /// Delay before the first attempt to reconnect, in milliseconds.
+        int initial_delay = 100;
+
+        /// Upper bound of the delay between attempts, in milliseconds.
+        int max_delay = 30000;
+
+        /// Factor by which the delay grows after every failed attempt.
+        double multiplier = 2.0;
+
+        /// Fraction of each delay that is random, so that clients that lost
+        /// their connection at the same time don't reconnect in lockstep.
+        double jitter = 0.5;
+    };
+
+    /// How to combine messages into batches, see setBatchingPolicy().
+    struct BatchingPolicy {
+        bool enabled = false;
+
+        /// Longest time a message is held back for a batch, in microseconds.
+        int max_window_usecs = 1000;
+
+        /// Number of messages after which a batch is sent right away.
+        int max_batch_size = 100;
+    };
 
     JsonRpcClient(JsonRpcSocketPtr socket,
                   QObject* parent = nullptr,
@@ -53,23 +102,236 @@ public:
       return m_endpoint->peerPort();
     }
 
+    /**
+     * Make an RPC call and wait for its result, for at most callTimeout()
+     * milliseconds. When called from a thread other than the client's, the
+     * call is made by the client's thread, and the calling thread blocks
+     * until the result arrives.
+     */
     template<typename... T>
     JsonRpcResultPtr call(const QString& method, T&&... params);
 
+    /// Like call(), but wait for at most \p msecs milliseconds.
+    template<typename... T>
+    JsonRpcResultPtr callWithTimeout(int msecs,
+                                     const QString& method,
+                                     T&&... params);
+
+    /**
+     * Make an RPC call without waiting for its result. If there is no
+     * response within requestTimeout() milliseconds, the request fails with
+     * JsonRpcError::EC_RequestTimeout.
+     */
     template<typename... T>
     JsonRpcRequestPtr callAsync(const QString& method, T&&... params);
 
-    /// Expand arguments in list before making the RPC call
+    /// Like callAsync(), but time out after \p msecs milliseconds instead,
+    /// or never if \p msecs is 0.
+    template<typename... T>
+    JsonRpcRequestPtr callAsyncWithTimeout(int msecs,
+                                           const QString& method,
+                                           T&&... params);
+
+    /**
+     * Expand arguments in list before making the RPC call. Wait for at most
+     * \p msecs milliseconds, or callTimeout() if \p msecs is negative.
+     */
     JsonRpcResultPtr callExpandArgs(const QString& method,
-                                    const QVariantList& params);
+                                    const QVariantList& params,
+                                    int msecs = -1);
 
-    /// Expand arguments in list before making the RPC call
+    /**
+     * Expand arguments in list before making the RPC call. Time out after
+     * \p msecs milliseconds, or requestTimeout() if \p msecs is negative.
+     */
     JsonRpcRequestPtr callAsyncExpandArgs(const QString& method,
-                                          const QVariantList& params);
+                                          const QVariantList& params,
+                                          int msecs = -1);
+
+    /**
+     * Make an RPC call, and invoke \p on_result or \p on_error in the
+     * client's thread when it finishes.
+     *
+     * Unlike callAsync(), this doesn't create a JsonRpcRequest object: the
+     * handlers are stored with the outstanding request and called directly
+     * when the response arrives, the call times out (see
+     * callAsyncWithTimeout()), or the connection is lost. Exactly one of the
+     * handlers is called, unless the request is cancelled.
+     *
+     * @returns The ID of the request, which can be passed to cancelRequest().
+     */
+    RequestId callAsyncWithHandlers(const QString& method,
+                                    const QVariantList& params,
+                                    ResultHandler on_result,
+                                    ErrorHandler on_error = ErrorHandler(),
+                                    int msecs = -1);
+
+    /**
+     * Make an RPC call, returning a future for its result. If the call fails,
+     * the future reports a JsonRpcException, which QFuture::result() throws.
+     * If the call is cancelled with cancelRequest(), the future is finished
+     * as cancelled. The future is finished in the client's thread, so it can
+     * be watched with a QFutureWatcher there.
+     */
+    template<typename... T>
+    QFuture<QVariant> callFuture(const QString& method, T&&... params);
+
+    /**
+     * Like callFuture(), with the arguments expanded from a list. Time out
+     * after \p msecs milliseconds, or requestTimeout() if \p msecs is
+     * negative.
+     */
+    QFuture<QVariant> callFutureExpandArgs(const QString& method,
+                                           const QVariantList& params,
+                                           int msecs = -1);
+
+    /**
+     * Prepare repeated calls of \p method, serializing the request envelope
+     * once. See JsonRpcPreparedCall, declared in json_rpc_prepared_call.h.
+     */
+    JsonRpcPreparedCall prepare(const QString& method);
+
+    /**
+     * Create a typed proxy for calling the methods of a service; see
+     * JsonRpcProxy. \p Proxy is a JsonRpcProxy subclass, and \p domain the
+     * domain the service is registered under on the server.
+     */
+    template<typename Proxy>
+    std::shared_ptr<Proxy> proxy(const QString& domain = QString())
+    {
+        return std::make_shared<Proxy>(this, domain);
+    }
+
+    /**
+     * Stop waiting for the response to a request. Its handlers are destroyed
+     * without being called, and a late response is ignored.
+     *
+     * @returns false if the request is not outstanding.
+     */
+    bool cancelRequest(RequestId id);
 
     JsonRpcError lastError() const { return m_last_error; }
 
-    void registerNotificationHandler(QObject* obj, const char* methodName, const QString& notificationName);
+    /// Set the default number of milliseconds to wait for synchronous calls.
+    void setCallTimeout(int msecs) { m_call_timeout = msecs; }
+    int callTimeout() const { return m_call_timeout; }
+
+    /**
+     * Set the default number of milliseconds after which asynchronous calls
+     * fail if there is no response, or 0 to wait indefinitely. Requests that
+     * are already outstanding keep their timeout.
+     */
+    void setRequestTimeout(int msecs) { m_request_timeout = msecs; }
+    int requestTimeout() const { return m_request_timeout; }
+
+    /**
+     * Reconnect automatically when the connection to the server is lost, or
+     * cannot be made, until disconnectFromServer() is called.
+     *
+     * Outstanding requests of idempotent methods (see setMethodIdempotent())
+     * are kept while disconnected, and sent again once the connection is
+     * back. All other outstanding requests fail with
+     * JsonRpcError::EC_ConnectionLost. Notification handlers are registered
+     * with the server again after every reconnect.
+     */
+    void setReconnectPolicy(const ReconnectPolicy& policy);
+    ReconnectPolicy reconnectPolicy() const { return m_reconnect_policy; }
+
+    /**
+     * Combine the requests and notifications sent in the same event loop
+     * iteration, or within a short window, into JSON RPC batches. The
+     * responses are still delivered to each request individually.
+     *
+     * The window adapts to the rate of messages: it grows toward \c
+     * max_window_usecs while messages are sent in quick succession, and
+     * shrinks to zero when they are further apart, so that single calls
+     * aren't delayed. Qt timers have millisecond resolution, so windows
+     * shorter than one millisecond end with the current event loop
+     * iteration.
+     */
+    void setBatchingPolicy(const BatchingPolicy& policy);
+    BatchingPolicy batchingPolicy() const { return m_batching_policy; }
+
+    /**
+     * Mark \p method as safe to call more than once with the same arguments,
+     * so requests of it may be sent again after a reconnect. Note that a
+     * request may have been executed by the server even though its response
+     * was lost.
+     */
+    void setMethodIdempotent(const QString& method, bool idempotent = true);
+    bool isMethodIdempotent(const QString& method) const {
+      return m_idempotent_methods.contains(method);
+    }
+
+    /// Number of requests waiting for a response.
+    int outstandingRequestCount() const {
+      return static_cast<int>(m_outstanding_requests.size());
+    }
+
+    /**
+     * Calls, errors, requests in flight and round trip latencies per method.
+     * Notifications are not counted.
+     */
+    const JsonRpcMetrics& metrics() const { return m_metrics; }
+
+    /// Called with every request and notification before it is sent. The
+    /// interceptor may modify it, e.g. to add credentials.
+    typedef std::function<void(QJsonObject& request)> RequestInterceptor;
+
+    /// Called with every message received from the server before it is
+    /// handled.
+    typedef std::function<void(const QJsonObject& response)>
+        ResponseInterceptor;
+
+    /**
+     * Add an interceptor to the chain run for every message. Interceptors
+     * are called in the order they were added, and should be added before
+     * the first call. Prepared calls are serialized from JSON objects while
+     * there are request interceptors.
+     */
+    void addRequestInterceptor(RequestInterceptor interceptor);
+    void addResponseInterceptor(ResponseInterceptor interceptor);
+
+    /**
+     * Record a span for every sampled call, from sending the request to
+     * receiving its response, and pass its trace context to the server.
+     * Calls that aren't sampled tell the server not to record them either.
+     */
+    void setTracer(const JsonRpcTracerPtr& tracer) { m_tracer = tracer; }
+    JsonRpcTracerPtr tracer() const { return m_tracer; }
+
+    /**
+     * Invoke a method of \p obj for every notification of the given name.
+     *
+     * The \p filter is evaluated by the server for every emission of the
+     * signal, and only matching emissions are sent to this client. See
+     * JsonRpcSignalFilter for its format. The server keeps one filter per
+     * connection and signal, so the filter of the latest registration for a
+     * signal applies to all its handlers.
+     */
+    void registerNotificationHandler(QObject* obj, const char* methodName, const QString& notificationName,
+                                     const QVariantMap& filter = QVariantMap());
+
+    /**
+     * Remove the handlers of \p obj for the given notification. The signal is
+     * unsubscribed once no handlers for it are left.
+     *
+     * Subscriptions and unsubscriptions made in the same event loop iteration
+     * are sent to the server together, with one request per service domain.
+     */
+    void unregisterNotificationHandler(QObject* obj, const QString& notificationName);
+
+    /**
+     * Subscribe to several signals of the service registered under \p domain
+     * with a single request. The result of the request is a list with one
+     * {"signal", "resultCode", "resultText"} object per signal.
+     */
+    JsonRpcRequestPtr subscribeSignals(const QStringList& signatures,
+                                       const QString& domain = QString());
+
+    /// Unsubscribe from several signals with a single request.
+    JsonRpcRequestPtr unsubscribeSignals(const QStringList& signatures,
+                                         const QString& domain = QString());
 
 signals:
     /// Emitted when a connection has been made to the server.
@@ -81,34 +343,168 @@ signals:
     /// Emitted when the RPC socket has an error.
     void socketError(QObject* socket, QAbstractSocket::SocketError error);
 
+    /// Emitted when a reconnect attempt is scheduled in \p msecs milliseconds.
+    void reconnectScheduled(int msecs);
+
+    /**
+     * Emitted when the server refuses to subscribe to or unsubscribe from the
+     * notification \p name, e.g. because it has no such signal.
+     */
+    void subscriptionFailed(const QString& name, const QString& message);
+
+    /// Emitted when a synchronous call made on the client's thread
+    /// succeeds or fails.
     void syncCallSucceeded();
     void syncCallFailed();
 
 protected:
     void logError(const QString& msg);
+    bool event(QEvent* event) override;
+    void timerEvent(QTimerEvent* event) override;
 
 private slots:
     void syncCallResult(const QVariant& result);
     void syncCallError(int code, const QString& message, const QVariant& data);
     void jsonResponseReceived(const QJsonObject& obj);
-    void registerSignalHandler(const QString& name);
+    void jsonBatchReceived(const QJsonArray& batch);
 
 private:
+    friend class JsonRpcPreparedCall;
+
     static const int CallTimeout = 5000;
-    static const QString InvalidRequestId;
+    static const int RequestTimeout = 30000;
+
+    /// Milliseconds per tick of the request timeout wheel.
+    static const int TimeoutResolution = 10;
+
+    /// An outstanding request, stored inline in m_outstanding_requests.
+    struct OutstandingRequest {
+        ResultHandler on_result;
+        ErrorHandler on_error;
+        JsonRpcTimerWheel::TimerId timer = JsonRpcTimerWheel::InvalidTimer;
+
+        /// The serialized request, if it is to be sent again after a
+        /// reconnect.
+        QByteArray replay;
+
+        JsonRpcMethodMetrics* metrics = nullptr;
+
+        /// Time the request was sent, in nanoseconds of m_clock.
+        qint64 sent = 0;
+
+        JsonRpcTracer::Span span;
+    };
 
     static QString getCallLogMessage(const QString& method,
                                      const QVariantList& params);
 
-    JsonRpcResultPtr waitForSyncCallbacks(const JsonRpcRequest* request);
+    JsonRpcResultPtr callSync(const QString& method,
+                              const QVariantList& params,
+                              int msecs);
+    JsonRpcResultPtr callFromOtherThread(const QString& method,
+                                         const QVariantList& params,
+                                         int msecs);
+    JsonRpcRequestPtr sendRequest(const QString& method,
+                                  const QVariantList& params,
+                                  int msecs);
 
     std::pair<JsonRpcRequestPtr, QJsonObject>
-        prepareCall(const QString& method);
+        prepareCall(const QString& method, int msecs);
+
+    RequestId callPrepared(const JsonRpcPreparedCall& call,
+                           const QVariantList& params,
+                           ResultHandler on_result,
+                           ErrorHandler on_error,
+                           int msecs);
+    void notifyPrepared(const JsonRpcPreparedCall& call,
+                        const QVariantList& params);
+
+    void addOutstandingRequest(RequestId id,
+                               ResultHandler on_result,
+                               ErrorHandler on_error,
+                               int msecs);
+
+    /// Send a serialized request, keeping it for replay if \p method is
+    /// idempotent.
+    void transmitRequest(RequestId id,
+                         const QString& method,
+                         const QByteArray& bytes,
+                         JsonRpcMethodMetrics& metrics,
+                         const JsonRpcTracer::Span& span);
+
+    /// Start the span of a call of \p method, if there is a tracer.
+    JsonRpcTracer::Span startSpan(const QString& method);
+
+    /// The metrics of \p method, from m_method_metrics if possible.
+    JsonRpcMethodMetrics& methodMetrics(const QString& method);
+
+    /// Add the trace context of \p span to \p request, run the request
+    /// interceptors on it and serialize it.
+    QByteArray serializeRequest(QJsonObject& request,
+                                const JsonRpcTracer::Span& span);
+
+    /// Serialize a prepared call, as a notification if \p id is 0.
+    QByteArray serializePrepared(const JsonRpcPreparedCall& call,
+                                 const QVariantList& params,
+                                 RequestId id,
+                                 const JsonRpcTracer::Span& span);
+
+    /// Record the end of \p request in the metrics of its method, and end
+    /// its span.
+    void recordRequestEnd(const OutstandingRequest& request,
+                          bool answered,
+                          bool error);
+    JsonRpcTimerWheel::Tick elapsedTicks() const;
+
+    /// Remove an outstanding request, cancelling its timeout.
+    bool takeOutstandingRequest(RequestId id, OutstandingRequest& request);
+
+    /// Fail the requests whose timeout expired.
+    void expireRequests();
+
+    /**
+     * Fail all outstanding requests with the given error, except for the
+     * ones kept for replay if \p keep_replayable is true.
+     */
+    void failOutstandingRequests(int code,
+                                 const QString& message,
+                                 bool keep_replayable = false);
+
+    void connectionEstablished();
+    void connectionLost();
+    void scheduleReconnect();
+    void replayRequests();
+    void resubscribe();
+
+    /// Send a serialized message, or add it to the current batch.
+    void sendMessage(const QByteArray& bytes);
+    void updateBatchWindow();
+    void flushBatch();
+    void scheduleSubscriptionFlush();
+    void flushSubscriptions();
+
+    /**
+     * Change the subscriptions to the signals in \p entries, signatures or
+     * {"signal", "filter"} objects, with one request. Falls back to one
+     * request per signal if the server doesn't know the bulk methods.
+     */
+    void sendSubscriptions(const QString& domain,
+                           const QVariantList& entries,
+                           bool subscribe);
+    void sendSubscription(const QString& domain,
+                          const QVariant& entry,
+                          bool subscribe);
+    static QString signalOfEntry(const QVariant& entry);
+    void subscriptionError(const QString& name, const QString& message);
+
+    /// Split "domain/signature" into the domain prefix and the signature.
+    static QString splitSignalName(const QString& name, QString& signature);
 
-    std::pair<JsonRpcRequestPtr, RequestId> createRequest();
-    static RequestId createUuid();
     QJsonObject createRequestJsonObject(const QString& method,
-                                        const QString& id);
+                                        RequestId id);
+
+    /// Extract the ID of a response. Returns false if there is no valid ID.
+    static bool getResponseId(const QJsonObject& response, RequestId& id);
 
     void convertToQVariantList(QVariantList& result) { Q_UNUSED(result) }
 
@@ -125,13 +521,56 @@ private:
 
     void handleNotificationFromServer(const QJsonObject& notification);
 
-    typedef std::map<RequestId, JsonRpcRequestPtr> RequestMap;
+    typedef RequestTable<OutstandingRequest> RequestMap;
 
     JsonRpcLoggerPtr m_logger;
     JsonRpcEndpointPtr m_endpoint;
     RequestMap m_outstanding_requests;
+    JsonRpcMetrics m_metrics;
+
+    /// Metrics already looked up, so that calls only take the lock of
+    /// m_metrics for the first call of a method. Only used on the thread
+    /// of the client.
+    QHash<QString, JsonRpcMethodMetrics*> m_method_metrics;
+
+    std::vector<RequestInterceptor> m_request_interceptors;
+    std::vector<ResponseInterceptor> m_response_interceptors;
+    JsonRpcTracerPtr m_tracer;
+    JsonRpcTimerWheel m_request_timeouts;
+    QElapsedTimer m_clock;
+    int m_timeout_timer_id;
+    RequestId m_next_request_id;
     QVariant m_last_result;
     JsonRpcError m_last_error;
+    int m_call_timeout;
+    int m_request_timeout;
+
+    ReconnectPolicy m_reconnect_policy;
+    QSet<QString> m_idempotent_methods;
+    QString m_host;
+    int m_port;
+    bool m_should_reconnect;
+    int m_reconnect_delay;
+    int m_reconnect_timer_id;
+    std::minstd_rand m_random;
+
+    BatchingPolicy m_batching_policy;
+    QList<QByteArray> m_batch;
+    int m_batch_timer_id;
+
+    /// Current batching window, and the moving average of the time between
+    /// messages it is derived from, in microseconds.
+    qint64 m_batch_window;
+    double m_mean_message_interval;
+    qint64 m_last_message_time;
+
+    /// Signals subscribed to, with their filters, by notification signature.
+    QHash<QString, QVariantMap> m_subscriptions;
+
+    /// Changes to send to the server in the next subscription flush.
+    QSet<QString> m_pending_subscriptions;
+    QSet<QString> m_pending_unsubscriptions;
+    bool m_subscription_flush_scheduled;
 
     QMultiHash<QString,QPair<QObject*,QMetaMethod> > m_registered_notification_handlers;
 };
@@ -141,26 +580,45 @@ typedef std::shared_ptr<JsonRpcClient> JsonRpcClientPtr;
 template<typename... T>
 JsonRpcResultPtr JsonRpcClient::call(const QString& method, T&&... params)
 {
-    JsonRpcRequestPtr req = callAsync(method, std::forward<T>(params)...);
-    return waitForSyncCallbacks(req.get());
+    return callWithTimeout(m_call_timeout, method, std::forward<T>(params)...);
+}
+
+template<typename... T>
+JsonRpcResultPtr JsonRpcClient::callWithTimeout(int msecs,
+                                                const QString& method,
+                                                T&&... params)
+{
+    QVariantList param_list;
+    convertToQVariantList(param_list, std::forward<T>(params)...);
+    return callSync(method, param_list, msecs);
 }
 
 template<typename... T>
 JsonRpcRequestPtr JsonRpcClient::callAsync(const QString& method,
                                            T&&... params)
 {
-    JsonRpcRequestPtr request;
-    QJsonObject req_json_obj;
-    std::tie(request, req_json_obj) = prepareCall(method);
-
     QVariantList param_list;
     convertToQVariantList(param_list, std::forward<T>(params)...);
-    req_json_obj["params"] = QJsonArray::fromVariantList(param_list);
+    return sendRequest(method, param_list, -1);
+}
 
-    m_logger->logInfo(getCallLogMessage(method, param_list));
-    m_endpoint->send(QJsonDocument(req_json_obj));
+template<typename... T>
+QFuture<QVariant> JsonRpcClient::callFuture(const QString& method,
+                                           T&&... params)
+{
+    QVariantList param_list;
+    convertToQVariantList(param_list, std::forward<T>(params)...);
+    return callFutureExpandArgs(method, param_list);
+}
 
-    return request;
+template<typename... T>
+JsonRpcRequestPtr JsonRpcClient::callAsyncWithTimeout(int msecs,
+                                                      const QString& method,
+                                                      T&&... params)
+{
+    QVariantList param_list;
+    convertToQVariantList(param_list, std::forward<T>(params)...);
+    return sendRequest(method, param_list, qMax(msecs, 0));
 }
 
 template<typename T>
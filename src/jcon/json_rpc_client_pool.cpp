@@ -0,0 +1,534 @@
+#include "json_rpc_client_pool.h"
+#include "json_rpc_async_logger.h"
+#include "json_rpc_error.h"
+#include "json_rpc_exception.h"
+#include "json_rpc_tcp_client.h"
+
+#include <QFutureInterface>
+#include <QTimer>
+
+#include <algorithm>
+#include <memory>
+
+namespace jcon {
+
+struct JsonRpcClientPool::HedgedCall
+{
+    struct Attempt {
+        JsonRpcClient* client;
+        JsonRpcClient::RequestId id;
+        qint64 started;
+        bool active;
+    };
+
+    QString method;
+    QVariantList params;
+    int msecs;
+    JsonRpcClient::ResultHandler on_result;
+    JsonRpcClient::ErrorHandler on_error;
+
+    std::vector<Attempt> attempts;
+    int retries = 0;
+    int retry_delay = 0;
+    bool finished = false;
+
+    bool hasActiveAttempts() const {
+        return std::any_of(attempts.begin(), attempts.end(),
+                           [](const Attempt& attempt) {
+                               return attempt.active;
+                           });
+    }
+};
+
+JsonRpcClientPool::JsonRpcClientPool(QObject* parent,
+                                     JsonRpcLoggerPtr logger,
+                                     ClientFactory factory)
+    : QObject(parent)
+    , m_logger(logger)
+    , m_factory(factory)
+    , m_next_client(0)
+    , m_connecting(false)
+    , m_random(std::random_device()())
+{
+    if (!m_logger) {
+        m_logger = JsonRpcAsyncLogger::shared("client_log.txt");
+    }
+
+    if (!m_factory) {
+        m_factory = [](QObject* parent, JsonRpcLoggerPtr logger) {
+            return new JsonRpcTcpClient(parent, logger);
+        };
+    }
+
+    m_clock.start();
+}
+
+JsonRpcClientPool::~JsonRpcClientPool()
+{
+    disconnectFromServers();
+}
+
+void JsonRpcClientPool::addServer(const QString& host,
+                                  int port,
+                                  int connections)
+{
+    for (int i = 0; i < connections; ++i) {
+        JsonRpcClient* client = m_factory(this, m_logger);
+
+        connect(client, &JsonRpcClient::socketConnected,
+                this, [this, client]() { emit clientConnected(client); });
+
+        connect(client, &JsonRpcClient::socketDisconnected,
+                this, [this, client]() { emit clientDisconnected(client); });
+
+        m_connections.push_back(Connection { client, host, port });
+
+        if (m_connecting)
+            client->connectToServerAsync(host, port);
+    }
+}
+
+void JsonRpcClientPool::connectToServers()
+{
+    m_connecting = true;
+    for (const auto& connection : m_connections) {
+        if (!connection.client->isConnected())
+            connection.client->connectToServerAsync(connection.host,
+                                                    connection.port);
+    }
+}
+
+void JsonRpcClientPool::disconnectFromServers()
+{
+    m_connecting = false;
+    for (const auto& connection : m_connections)
+        connection.client->disconnectFromServer();
+}
+
+int JsonRpcClientPool::connectedCount() const
+{
+    int count = 0;
+    for (const auto& connection : m_connections) {
+        if (connection.client->isConnected())
+            ++count;
+    }
+    return count;
+}
+
+JsonRpcClient* JsonRpcClientPool::client(int index) const
+{
+    return m_connections.at(static_cast<size_t>(index)).client;
+}
+
+JsonRpcClient* JsonRpcClientPool::selectClient()
+{
+    return selectClient(std::vector<const JsonRpcClient*>());
+}
+
+JsonRpcClient*
+JsonRpcClientPool::selectClient(const std::vector<const JsonRpcClient*>& avoid)
+{
+    const size_t count = m_connections.size();
+    if (count == 0)
+        return nullptr;
+
+    // Start the scan at a rotating position, so that idle clients take
+    // turns instead of the first one getting every call.
+    const size_t start = m_next_client++ % count;
+
+    JsonRpcClient* best = nullptr;
+    bool best_other_server = false;
+    int best_outstanding = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        JsonRpcClient* client = m_connections[(start + i) % count].client;
+        if (!client->isConnected())
+            continue;
+        if (std::find(avoid.begin(), avoid.end(), client) != avoid.end())
+            continue;
+
+        const bool other_server =
+            std::none_of(avoid.begin(), avoid.end(),
+                         [this, client](const JsonRpcClient* used) {
+                             return isSameServer(client, used);
+                         });
+        const int outstanding = client->outstandingRequestCount();
+
+        if (!best || (other_server && !best_other_server) ||
+            (other_server == best_other_server &&
+             outstanding < best_outstanding))
+        {
+            best = client;
+            best_other_server = other_server;
+            best_outstanding = outstanding;
+            if (other_server && outstanding == 0)
+                break;
+        }
+    }
+    return best;
+}
+
+bool JsonRpcClientPool::isSameServer(const JsonRpcClient* a,
+                                     const JsonRpcClient* b) const
+{
+    const Connection* server_a = nullptr;
+    const Connection* server_b = nullptr;
+    for (const auto& connection : m_connections) {
+        if (connection.client == a)
+            server_a = &connection;
+        if (connection.client == b)
+            server_b = &connection;
+    }
+    return server_a && server_b && server_a->host == server_b->host &&
+        server_a->port == server_b->port;
+}
+
+void JsonRpcClientPool::setMethodIdempotent(const QString& method,
+                                            bool idempotent)
+{
+    if (idempotent)
+        m_idempotent_methods.insert(method);
+    else
+        m_idempotent_methods.remove(method);
+}
+
+bool JsonRpcClientPool::isHedged(const QString& method) const
+{
+    return (m_hedging_policy.enabled || m_retry_policy.max_retries > 0) &&
+        m_idempotent_methods.contains(method);
+}
+
+JsonRpcResultPtr JsonRpcClientPool::callExpandArgs(const QString& method,
+                                                   const QVariantList& params,
+                                                   int msecs)
+{
+    JsonRpcClient* client = selectClient();
+    if (!client)
+        return noConnectionResult();
+    return client->callExpandArgs(method, params, msecs);
+}
+
+JsonRpcRequestPtr
+JsonRpcClientPool::callAsyncExpandArgs(const QString& method,
+                                       const QVariantList& params,
+                                       int msecs)
+{
+    if (isHedged(method)) {
+        // The handlers forward to the signals of the request object, and
+        // keep it alive until the call is finished.
+        auto request = std::make_shared<JsonRpcRequest>(nullptr, 0);
+        callHedged(method, params,
+                   [request](const QVariant& result) {
+                       emit request->result(result);
+                   },
+                   [request](int code, const QString& message,
+                             const QVariant& data) {
+                       emit request->error(code, message, data);
+                   },
+                   msecs);
+        return request;
+    }
+
+    JsonRpcClient* client = selectClient();
+    if (!client)
+        return noConnectionRequest();
+    return client->callAsyncExpandArgs(method, params, msecs);
+}
+
+QFuture<QVariant>
+JsonRpcClientPool::callFutureExpandArgs(const QString& method,
+                                        const QVariantList& params,
+                                        int msecs)
+{
+    if (isHedged(method)) {
+        QFutureInterface<QVariant> future;
+        future.reportStarted();
+        callHedged(method, params,
+                   [future](const QVariant& result) mutable {
+                       future.reportResult(result);
+                       future.reportFinished();
+                   },
+                   [future](int code, const QString& message,
+                            const QVariant& data) mutable {
+                       future.reportException(
+                           JsonRpcException(code, message, data));
+                       future.reportFinished();
+                   },
+                   msecs);
+        return future.future();
+    }
+
+    JsonRpcClient* client = selectClient();
+    if (!client)
+        return noConnectionFuture();
+    return client->callFutureExpandArgs(method, params, msecs);
+}
+
+void JsonRpcClientPool::callAsyncWithHandlers(
+    const QString& method,
+    const QVariantList& params,
+    JsonRpcClient::ResultHandler on_result,
+    JsonRpcClient::ErrorHandler on_error,
+    int msecs)
+{
+    if (isHedged(method)) {
+        callHedged(method, params, std::move(on_result), std::move(on_error),
+                   msecs);
+        return;
+    }
+
+    JsonRpcClient* client = selectClient();
+    if (!client) {
+        if (on_error) {
+            QTimer::singleShot(0, this, [on_error]() {
+                on_error(JsonRpcError::EC_ConnectionLost,
+                         noConnectionMessage(), QVariant());
+            });
+        }
+        return;
+    }
+    client->callAsyncWithHandlers(method, params, std::move(on_result),
+                                  std::move(on_error), msecs);
+}
+
+void JsonRpcClientPool::callHedged(const QString& method,
+                                   const QVariantList& params,
+                                   JsonRpcClient::ResultHandler on_result,
+                                   JsonRpcClient::ErrorHandler on_error,
+                                   int msecs)
+{
+    auto call = std::make_shared<HedgedCall>();
+    call->method = method;
+    call->params = params;
+    call->msecs = msecs;
+    call->on_result = std::move(on_result);
+    call->on_error = std::move(on_error);
+    call->retry_delay = m_retry_policy.initial_delay;
+
+    if (startAttempt(call)) {
+        scheduleHedge(call);
+        return;
+    }
+
+    // Report from the event loop, never before the call returns.
+    QTimer::singleShot(0, this, [this, call]() {
+        retryOrFail(call, JsonRpcError::EC_ConnectionLost,
+                    noConnectionMessage(), QVariant());
+    });
+}
+
+bool JsonRpcClientPool::startAttempt(const HedgedCallPtr& call)
+{
+    std::vector<const JsonRpcClient*> used;
+    for (const auto& attempt : call->attempts) {
+        if (attempt.active)
+            used.push_back(attempt.client);
+    }
+
+    JsonRpcClient* client = selectClient(used);
+    if (!client)
+        return false;
+
+    const size_t index = call->attempts.size();
+    call->attempts.push_back(HedgedCall::Attempt {
+        client, 0, m_clock.nsecsElapsed() / 1000, true });
+
+    const auto id = client->callAsyncWithHandlers(
+        call->method, call->params,
+        [this, call, index](const QVariant& result) {
+            attemptSucceeded(call, index, result);
+        },
+        [this, call, index](int code, const QString& message,
+                            const QVariant& data) {
+            attemptFailed(call, index, code, message, data);
+        },
+        call->msecs);
+    call->attempts[index].id = id;
+
+    return true;
+}
+
+void JsonRpcClientPool::scheduleHedge(const HedgedCallPtr& call)
+{
+    if (!m_hedging_policy.enabled)
+        return;
+
+    QTimer::singleShot(hedgeDelay(call->method), this, [this, call]() {
+        // Without another client to send to, the hedge is skipped.
+        if (!call->finished && call->hasActiveAttempts())
+            startAttempt(call);
+    });
+}
+
+void JsonRpcClientPool::attemptSucceeded(const HedgedCallPtr& call,
+                                         size_t attempt,
+                                         const QVariant& result)
+{
+    call->attempts[attempt].active = false;
+    if (call->finished)
+        return;
+
+    call->finished = true;
+    recordLatency(call->method, m_clock.nsecsElapsed() / 1000 -
+                                call->attempts[attempt].started);
+    cancelAttempts(*call);
+
+    if (call->on_result)
+        call->on_result(result);
+}
+
+void JsonRpcClientPool::attemptFailed(const HedgedCallPtr& call,
+                                      size_t attempt,
+                                      int code,
+                                      const QString& message,
+                                      const QVariant& data)
+{
+    call->attempts[attempt].active = false;
+    if (call->finished)
+        return;
+
+    // An error response from the server is final, another request would
+    // get the same answer. Lost connections and timeouts only end this
+    // attempt, and the call is still open while a hedge is outstanding.
+    const bool definitive = code != JsonRpcError::EC_ConnectionLost &&
+        code != JsonRpcError::EC_RequestTimeout;
+
+    if (!definitive && call->hasActiveAttempts())
+        return;
+
+    if (code == JsonRpcError::EC_ConnectionLost) {
+        retryOrFail(call, code, message, data);
+        return;
+    }
+
+    call->finished = true;
+    cancelAttempts(*call);
+    if (call->on_error)
+        call->on_error(code, message, data);
+}
+
+void JsonRpcClientPool::retryOrFail(const HedgedCallPtr& call,
+                                    int code,
+                                    const QString& message,
+                                    const QVariant& data)
+{
+    if (call->retries >= m_retry_policy.max_retries) {
+        call->finished = true;
+        if (call->on_error)
+            call->on_error(code, message, data);
+        return;
+    }
+
+    const int delay = qMax(call->retry_delay, 1);
+    const double jitter = qBound(0.0, m_retry_policy.jitter, 1.0);
+    std::uniform_real_distribution<double> random(0.0, 1.0);
+    const int msecs = qMax(1, static_cast<int>(
+        delay * (1.0 - jitter + jitter * random(m_random))));
+
+    call->retry_delay = static_cast<int>(qMin<double>(
+        delay * m_retry_policy.multiplier, m_retry_policy.max_delay));
+    ++call->retries;
+
+    JCON_LOG_INFO(m_logger, QString("retrying %1 in %2 ms (retry %3 of %4)")
+                            .arg(call->method).arg(msecs)
+                            .arg(call->retries).arg(m_retry_policy.max_retries));
+
+    QTimer::singleShot(msecs, this, [this, call]() {
+        if (startAttempt(call)) {
+            scheduleHedge(call);
+        } else {
+            retryOrFail(call, JsonRpcError::EC_ConnectionLost,
+                        noConnectionMessage(), QVariant());
+        }
+    });
+}
+
+void JsonRpcClientPool::cancelAttempts(HedgedCall& call)
+{
+    // The server still answers the other requests, but the responses are
+    // dropped by the clients.
+    for (auto& attempt : call.attempts) {
+        if (attempt.active) {
+            attempt.client->cancelRequest(attempt.id);
+            attempt.active = false;
+        }
+    }
+}
+
+void JsonRpcClientPool::recordLatency(const QString& method, qint64 usecs)
+{
+    MethodLatencies& latencies = m_latencies[method];
+
+    if (latencies.samples.size() < LatencySamples)
+        latencies.samples.push_back(usecs);
+    else
+        latencies.samples[latencies.next] = usecs;
+
+    latencies.next = (latencies.next + 1) % LatencySamples;
+    ++latencies.new_samples;
+}
+
+int JsonRpcClientPool::hedgeDelay(const QString& method)
+{
+    auto latencies = m_latencies.find(method);
+
+    if (latencies == m_latencies.end() ||
+        latencies->samples.size() < MinLatencySamples)
+    {
+        return qMax(m_hedging_policy.initial_delay, m_hedging_policy.min_delay);
+    }
+
+    // Selecting the percentile is linear in the number of samples, so it
+    // is only redone every few samples.
+    if (latencies->hedge_delay < 0 ||
+        latencies->new_samples >= LatencyUpdateInterval)
+    {
+        std::vector<qint64> samples(latencies->samples);
+        const double fraction =
+            qBound(0.0, m_hedging_policy.percentile, 100.0) / 100.0;
+        const size_t rank = std::min(
+            samples.size() - 1,
+            static_cast<size_t>(fraction * samples.size()));
+        std::nth_element(samples.begin(), samples.begin() + rank,
+                         samples.end());
+
+        latencies->hedge_delay = static_cast<int>((samples[rank] + 999) / 1000);
+        latencies->new_samples = 0;
+    }
+
+    return qMax(latencies->hedge_delay, m_hedging_policy.min_delay);
+}
+
+QString JsonRpcClientPool::noConnectionMessage()
+{
+    return "no connection to any server";
+}
+
+JsonRpcResultPtr JsonRpcClientPool::noConnectionResult() const
+{
+    return std::make_shared<JsonRpcError>(JsonRpcError::EC_ConnectionLost,
+                                          noConnectionMessage());
+}
+
+JsonRpcRequestPtr JsonRpcClientPool::noConnectionRequest()
+{
+    // Fail the request once the caller had a chance to connect to it.
+    auto request = std::make_shared<JsonRpcRequest>(nullptr, 0);
+    QTimer::singleShot(0, this, [request]() {
+        emit request->error(JsonRpcError::EC_ConnectionLost,
+                            noConnectionMessage(), QVariant());
+    });
+    return request;
+}
+
+QFuture<QVariant> JsonRpcClientPool::noConnectionFuture() const
+{
+    QFutureInterface<QVariant> future;
+    future.reportStarted();
+    future.reportException(JsonRpcException(JsonRpcError::EC_ConnectionLost,
+                                            noConnectionMessage()));
+    future.reportFinished();
+    return future.future();
+}
+
+}
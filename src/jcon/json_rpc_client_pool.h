@@ -0,0 +1,274 @@
+#ifndef JSON_RPC_CLIENT_POOL_H
+#define JSON_RPC_CLIENT_POOL_H
+
+#include "jcon.h"
+#include "json_rpc_client.h"
+#include "json_rpc_logger.h"
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QString>
+
+#include <functional>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace jcon {
+
+/**
+ * Pool of client connections to one or more servers.
+ *
+ * Every call is routed to the connected client with the fewest outstanding
+ * requests, so a slow connection or server gets fewer new calls. Ties are
+ * broken round robin. The pool offers the calling API of JsonRpcClient.
+ *
+ * Calls made while no client is connected fail with
+ * JsonRpcError::EC_ConnectionLost. Asynchronous calls report that error from
+ * the event loop, never before the call returns.
+ *
+ * Asynchronous calls of methods marked idempotent can be hedged and retried,
+ * see setHedgingPolicy() and setRetryPolicy().
+ */
+class JCON_API JsonRpcClientPool : public QObject
+{
+    Q_OBJECT
+
+public:
+    /// Creates the clients of the pool. The default creates TCP clients.
+    typedef std::function<JsonRpcClient*(QObject* parent,
+                                         JsonRpcLoggerPtr logger)>
+        ClientFactory;
+
+    /**
+     * When to send a second request for a call that hasn't been answered
+     * yet. The hedge request goes to another server if there is one, and the
+     * first response wins.
+     */
+    struct HedgingPolicy {
+        bool enabled = false;
+
+        /// Percentile of the recent latencies of a method after which the
+        /// hedge request is sent.
+        double percentile = 95.0;
+
+        /// Delay used until enough latencies of a method have been seen, in
+        /// milliseconds.
+        int initial_delay = 50;
+
+        /// Lower bound of the delay, in milliseconds.
+        int min_delay = 1;
+    };
+
+    /// How often to retry a call that failed because of a connection error.
+    struct RetryPolicy {
+        int max_retries = 0;
+
+        /// Delay before the first retry, in milliseconds.
+        int initial_delay = 50;
+
+        /// Upper bound of the delay between retries, in milliseconds.
+        int max_delay = 2000;
+
+        /// Factor by which the delay grows after every retry.
+        double multiplier = 2.0;
+
+        /// Fraction of each delay that is random.
+        double jitter = 0.5;
+    };
+
+    explicit JsonRpcClientPool(QObject* parent = nullptr,
+                               JsonRpcLoggerPtr logger = nullptr,
+                               ClientFactory factory = ClientFactory());
+    virtual ~JsonRpcClientPool();
+
+    /**
+     * Add \p connections clients connecting to the server at \p host and
+     * \p port. The clients start connecting when connectToServers() is
+     * called, or right away if it has been called already.
+     */
+    void addServer(const QString& host, int port, int connections = 1);
+
+    /// Start connecting all clients.
+    void connectToServers();
+
+    void disconnectFromServers();
+
+    /// Number of clients in the pool.
+    int size() const { return static_cast<int>(m_connections.size()); }
+
+    /// Number of connected clients.
+    int connectedCount() const;
+
+    /// Client with the given index, for per-connection settings.
+    JsonRpcClient* client(int index) const;
+
+    /**
+     * The connected client with the fewest outstanding requests, or nullptr
+     * if no client is connected.
+     */
+    JsonRpcClient* selectClient();
+
+    /**
+     * Mark \p method as safe to call more than once with the same arguments.
+     * Only asynchronous calls of idempotent methods are hedged and retried.
+     */
+    void setMethodIdempotent(const QString& method, bool idempotent = true);
+    bool isMethodIdempotent(const QString& method) const {
+        return m_idempotent_methods.contains(method);
+    }
+
+    void setHedgingPolicy(const HedgingPolicy& policy) {
+        m_hedging_policy = policy;
+    }
+    HedgingPolicy hedgingPolicy() const { return m_hedging_policy; }
+
+    void setRetryPolicy(const RetryPolicy& policy) { m_retry_policy = policy; }
+    RetryPolicy retryPolicy() const { return m_retry_policy; }
+
+    template<typename... T>
+    JsonRpcResultPtr call(const QString& method, T&&... params);
+
+    template<typename... T>
+    JsonRpcRequestPtr callAsync(const QString& method, T&&... params);
+
+    template<typename... T>
+    QFuture<QVariant> callFuture(const QString& method, T&&... params);
+
+    JsonRpcResultPtr callExpandArgs(const QString& method,
+                                    const QVariantList& params,
+                                    int msecs = -1);
+
+    JsonRpcRequestPtr callAsyncExpandArgs(const QString& method,
+                                          const QVariantList& params,
+                                          int msecs = -1);
+
+    QFuture<QVariant> callFutureExpandArgs(const QString& method,
+                                           const QVariantList& params,
+                                           int msecs = -1);
+
+    void callAsyncWithHandlers(const QString& method,
+                               const QVariantList& params,
+                               JsonRpcClient::ResultHandler on_result,
+                               JsonRpcClient::ErrorHandler on_error =
+                                   JsonRpcClient::ErrorHandler(),
+                               int msecs = -1);
+
+signals:
+    void clientConnected(JsonRpcClient* client);
+    void clientDisconnected(JsonRpcClient* client);
+
+private:
+    struct Connection {
+        JsonRpcClient* client;
+        QString host;
+        int port;
+    };
+
+    /// State of a hedged or retried call, shared by its requests.
+    struct HedgedCall;
+    typedef std::shared_ptr<HedgedCall> HedgedCallPtr;
+
+    /// Recent latencies of a method, in microseconds.
+    struct MethodLatencies {
+        std::vector<qint64> samples;
+        size_t next = 0;
+        int new_samples = 0;
+        int hedge_delay = -1;
+    };
+
+    enum {
+        LatencySamples = 256,
+        MinLatencySamples = 20,
+        LatencyUpdateInterval = 16
+    };
+
+    /// Whether calls of \p method go through callHedged().
+    bool isHedged(const QString& method) const;
+
+    /**
+     * Like selectClient(), but never picks one of the clients in \p avoid,
+     * and prefers servers that none of them is connected to.
+     */
+    JsonRpcClient* selectClient(const std::vector<const JsonRpcClient*>& avoid);
+    bool isSameServer(const JsonRpcClient* a, const JsonRpcClient* b) const;
+
+    void callHedged(const QString& method,
+                    const QVariantList& params,
+                    JsonRpcClient::ResultHandler on_result,
+                    JsonRpcClient::ErrorHandler on_error,
+                    int msecs);
+    bool startAttempt(const HedgedCallPtr& call);
+    void scheduleHedge(const HedgedCallPtr& call);
+    void attemptSucceeded(const HedgedCallPtr& call, size_t attempt,
+                          const QVariant& result);
+    void attemptFailed(const HedgedCallPtr& call, size_t attempt,
+                       int code, const QString& message, const QVariant& data);
+    void retryOrFail(const HedgedCallPtr& call,
+                     int code, const QString& message, const QVariant& data);
+    void cancelAttempts(HedgedCall& call);
+
+    void recordLatency(const QString& method, qint64 usecs);
+    int hedgeDelay(const QString& method);
+
+    static QString noConnectionMessage();
+
+    JsonRpcResultPtr noConnectionResult() const;
+    JsonRpcRequestPtr noConnectionRequest();
+    QFuture<QVariant> noConnectionFuture() const;
+
+    JsonRpcLoggerPtr m_logger;
+    ClientFactory m_factory;
+    std::vector<Connection> m_connections;
+    size_t m_next_client;
+    bool m_connecting;
+
+    QSet<QString> m_idempotent_methods;
+    HedgingPolicy m_hedging_policy;
+    RetryPolicy m_retry_policy;
+    QHash<QString, MethodLatencies> m_latencies;
+    QElapsedTimer m_clock;
+    std::minstd_rand m_random;
+};
+
+template<typename... T>
+JsonRpcResultPtr JsonRpcClientPool::call(const QString& method, T&&... params)
+{
+    JsonRpcClient* client = selectClient();
+    if (!client)
+        return noConnectionResult();
+    return client->call(method, std::forward<T>(params)...);
+}
+
+template<typename... T>
+JsonRpcRequestPtr JsonRpcClientPool::callAsync(const QString& method,
+                                               T&&... params)
+{
+    if (isHedged(method))
+        return callAsyncExpandArgs(method, QVariantList { valueToJson(params)... });
+
+    JsonRpcClient* client = selectClient();
+    if (!client)
+        return noConnectionRequest();
+    return client->callAsync(method, std::forward<T>(params)...);
+}
+
+template<typename... T>
+QFuture<QVariant> JsonRpcClientPool::callFuture(const QString& method,
+                                                T&&... params)
+{
+    if (isHedged(method))
+        return callFutureExpandArgs(method, QVariantList { valueToJson(params)... });
+
+    JsonRpcClient* client = selectClient();
+    if (!client)
+        return noConnectionFuture();
+    return client->callFuture(method, std::forward<T>(params)...);
+}
+
+}
+
+#endif
@@ -2,9 +2,12 @@
 #include "json_rpc_socket.h"
 #include "jcon_assert.h"
 
+#include <QElapsedTimer>
+#include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QTcpSocket>
+#include <QTimer>
 
 namespace jcon {
 
@@ -17,6 +20,9 @@ JsonRpcEndpoint::JsonRpcEndpoint(JsonRpcSocketPtr socket,
     : QObject(parent)
     , m_logger(logger)
     , m_socket(socket)
+    , m_last_decode_nsecs(0)
+    , m_capture_connection(0)
+    , m_front_sequence(0)
 {
     connect(m_socket.get(), &JsonRpcSocket::socketConnected,
             this, &JsonRpcEndpoint::socketConnected);
@@ -29,6 +35,9 @@ JsonRpcEndpoint::JsonRpcEndpoint(JsonRpcSocketPtr socket,
 
     connect(m_socket.get(), &JsonRpcSocket::socketError,
             this, &JsonRpcEndpoint::socketError);
+
+    connect(m_socket.get(), &JsonRpcSocket::bytesWritten,
+            this, &JsonRpcEndpoint::flushOutboundQueue);
 }
 
 JsonRpcEndpoint::~JsonRpcEndpoint()
@@ -38,18 +47,19 @@ JsonRpcEndpoint::~JsonRpcEndpoint()
 
 bool JsonRpcEndpoint::connectToHost(const QString& host, int port, int msecs)
 {
-    m_logger->logInfo(QString("connecting to JSON RPC server at %1:%2")
-                      .arg(host).arg(port));
+    JCON_LOG_INFO(m_logger, QString("connecting to JSON RPC server at %1:%2")
+                            .arg(host).arg(port));
 
     m_socket->connectToHost(host, port);
 
     if (!m_socket->waitForConnected(msecs)) {
-        m_logger->logError("could not connect to JSON RPC server: " +
-                           m_socket->errorString());
+        JCON_LOG_ERROR(m_logger, "could not connect to JSON RPC server: " +
+                                 m_socket->errorString());
         return false;
     }
 
-    m_logger->logInfo(QString("connected to server %1:%2").arg(host).arg(port));
+    JCON_LOG_INFO(m_logger,
+                  QString("connected to server %1:%2").arg(host).arg(port));
     return true;
 }
 
@@ -91,23 +101,254 @@ int JsonRpcEndpoint::peerPort() const
 
 void JsonRpcEndpoint::send(const QJsonDocument& doc)
 {
-    QByteArray bytes = doc.toJson(QJsonDocument::Compact);
-    m_socket->send(bytes);
+    enqueue(doc.toJson(QJsonDocument::Compact), false, QString());
+}
+
+void JsonRpcEndpoint::send(const QByteArray& bytes)
+{
+    enqueue(bytes, false, QString());
+}
+
+void JsonRpcEndpoint::sendNotification(const QByteArray& bytes,
+                                       const QString& conflation_key)
+{
+    enqueue(bytes, true, conflation_key);
+}
+
+void JsonRpcEndpoint::setOutboundLimits(const OutboundLimits& limits)
+{
+    m_limits = limits;
+
+    if (m_limits.policy == OP_Unbounded) {
+        // Nothing is held back in unbounded mode, so hand over what's queued.
+        for (const auto& message : m_outbound_queue) {
+            if (!message.dropped)
+                m_socket->send(message.bytes);
+        }
+        clearOutboundQueue();
+        m_stats.congested = false;
+    }
+}
+
+JsonRpcEndpoint::Statistics JsonRpcEndpoint::statistics() const
+{
+    Statistics stats = m_stats;
+    stats.peer_address = m_socket->peerAddress();
+    stats.peer_port = m_socket->peerPort();
+    stats.bytes_to_write = m_socket->bytesToWrite();
+    return stats;
+}
+
+void JsonRpcEndpoint::enqueue(const QByteArray& bytes,
+                              bool notification,
+                              const QString& conflation_key)
+{
+    if (m_limits.policy == OP_Unbounded) {
+        m_socket->send(bytes);
+        return;
+    }
+
+    if (m_outbound_queue.empty() &&
+        m_socket->bytesToWrite() < m_limits.high_water_bytes)
+    {
+        m_socket->send(bytes);
+        return;
+    }
+
+    if (!m_stats.congested) {
+        m_stats.congested = true;
+        ++m_stats.high_water_events;
+        JCON_LOG_WARNING(m_logger,
+                         QString("peer %1:%2 is not reading fast enough, "
+                                 "queueing outbound messages")
+                         .arg(peerAddress().toString())
+                         .arg(peerPort()));
+    }
+
+    if (notification && m_limits.policy == OP_Conflate &&
+        conflate(bytes, conflation_key))
+    {
+        return;
+    }
+
+    if (m_stats.queued_messages >= m_limits.max_queued_messages &&
+        !applyOverflowPolicy(notification))
+    {
+        return;
+    }
+
+    const quint64 sequence = m_front_sequence + m_outbound_queue.size();
+    m_outbound_queue.push_back(
+        OutboundMessage { bytes, conflation_key, sequence, notification, false }
+    );
+    ++m_stats.queued_messages;
+    m_stats.queued_bytes += bytes.size();
+
+    if (notification && m_limits.policy == OP_Conflate &&
+        !conflation_key.isEmpty())
+    {
+        m_conflation_index.insert(conflation_key, sequence);
+    }
+}
+
+bool JsonRpcEndpoint::applyOverflowPolicy(bool notification)
+{
+    switch (m_limits.policy) {
+    case OP_Unbounded:
+        break;
+
+    case OP_DropOldest:
+        popDroppedMessages();
+        if (!m_outbound_queue.empty()) {
+            dropMessage(m_outbound_queue.front());
+            popDroppedMessages();
+        }
+        break;
+
+    case OP_DropNotifications:
+    case OP_Conflate:
+        if (notification) {
+            ++m_stats.dropped_messages;
+            return false;
+        }
+        // Responses are never dropped, even if that exceeds the limit.
+        dropOldestNotification();
+        break;
+
+    case OP_Disconnect:
+        JCON_LOG_ERROR(m_logger,
+                       QString("disconnecting peer %1:%2, outbound queue "
+                               "is full")
+                       .arg(peerAddress().toString())
+                       .arg(peerPort()));
+        m_stats.dropped_messages += m_stats.queued_messages + 1;
+        clearOutboundQueue();
+        // Disconnecting may destroy this endpoint, so don't do it while
+        // sending.
+        QTimer::singleShot(0, this, [this]() {
+            m_socket->disconnectFromHost();
+        });
+        return false;
+    }
+    return true;
+}
+
+bool JsonRpcEndpoint::conflate(const QByteArray& bytes,
+                               const QString& conflation_key)
+{
+    if (conflation_key.isEmpty())
+        return false;
+
+    auto it = m_conflation_index.find(conflation_key);
+    if (it == m_conflation_index.end())
+        return false;
+
+    OutboundMessage& message = m_outbound_queue[it.value() - m_front_sequence];
+    JCON_ASSERT(!message.dropped);
+    m_stats.queued_bytes += bytes.size() - message.bytes.size();
+    message.bytes = bytes;
+    ++m_stats.conflated_messages;
+    return true;
+}
+
+bool JsonRpcEndpoint::dropOldestNotification()
+{
+    for (auto& message : m_outbound_queue) {
+        if (!message.dropped && message.notification) {
+            dropMessage(message);
+            popDroppedMessages();
+            return true;
+        }
+    }
+    return false;
+}
+
+void JsonRpcEndpoint::dropMessage(OutboundMessage& message)
+{
+    if (message.dropped)
+        return;
+
+    unqueueMessage(message);
+    ++m_stats.dropped_messages;
+}
+
+void JsonRpcEndpoint::unqueueMessage(OutboundMessage& message)
+{
+    if (!message.conflation_key.isEmpty()) {
+        auto it = m_conflation_index.find(message.conflation_key);
+        if (it != m_conflation_index.end() && it.value() == message.sequence)
+            m_conflation_index.erase(it);
+    }
+
+    message.dropped = true;
+    --m_stats.queued_messages;
+    m_stats.queued_bytes -= message.bytes.size();
+    message.bytes = QByteArray();
+}
+
+void JsonRpcEndpoint::popFrontMessage()
+{
+    m_outbound_queue.pop_front();
+    ++m_front_sequence;
+}
+
+void JsonRpcEndpoint::popDroppedMessages()
+{
+    while (!m_outbound_queue.empty() && m_outbound_queue.front().dropped)
+        popFrontMessage();
+}
+
+void JsonRpcEndpoint::clearOutboundQueue()
+{
+    m_front_sequence += m_outbound_queue.size();
+    m_outbound_queue.clear();
+    m_conflation_index.clear();
+    m_stats.queued_messages = 0;
+    m_stats.queued_bytes = 0;
+}
+
+void JsonRpcEndpoint::flushOutboundQueue()
+{
+    while (!m_outbound_queue.empty() &&
+           m_socket->bytesToWrite() < m_limits.high_water_bytes)
+    {
+        OutboundMessage& message = m_outbound_queue.front();
+        if (!message.dropped) {
+            m_socket->send(message.bytes);
+            unqueueMessage(message);
+        }
+        popFrontMessage();
+    }
+
+    if (m_stats.congested && m_outbound_queue.empty() &&
+        m_socket->bytesToWrite() <= m_limits.high_water_bytes / 2)
+    {
+        m_stats.congested = false;
+        emit writable();
+    }
+}
+
+void JsonRpcEndpoint::setCapture(const JsonRpcCapturePtr& capture)
+{
+    m_capture = capture;
+    if (m_capture)
+        m_capture_connection = m_capture->addConnection();
 }
 
 void JsonRpcEndpoint::dataReceived(const QByteArray& bytes, QObject* socket)
 {
+    Q_UNUSED(socket)
+
     JCON_ASSERT(bytes.length() > 0);
     m_recv_buffer += bytes;
-    m_recv_buffer = processBuffer(m_recv_buffer.trimmed(), socket);
+    m_recv_buffer = processBuffer(m_recv_buffer.trimmed());
 }
 
-QByteArray JsonRpcEndpoint::processBuffer(const QByteArray& buffer,
-                                          QObject* socket)
+QByteArray JsonRpcEndpoint::processBuffer(const QByteArray& buffer)
 {
     QByteArray buf(buffer);
 
-    JCON_ASSERT(buf[0] == '{');
+    JCON_ASSERT(buf[0] == '{' || buf[0] == '[');
 
     bool in_string = false;
     int brace_nesting_level = 0;
@@ -120,19 +361,29 @@ QByteArray JsonRpcEndpoint::processBuffer(const QByteArray& buffer,
             in_string = !in_string;
 
         if (!in_string) {
-            if (curr_ch == '{')
+            // Batches are arrays of objects, so brackets and braces are
+            // counted together.
+            if (curr_ch == '{' || curr_ch == '[')
                 ++brace_nesting_level;
 
-            if (curr_ch == '}') {
+            if (curr_ch == '}' || curr_ch == ']') {
                 --brace_nesting_level;
                 JCON_ASSERT(brace_nesting_level >= 0);
 
                 if (brace_nesting_level == 0) {
+                    if (m_capture)
+                        m_capture->record(m_capture_connection, buf.left(i));
+
+                    QElapsedTimer decode_timer;
+                    decode_timer.start();
                     auto doc = QJsonDocument::fromJson(buf.left(i));
+                    m_last_decode_nsecs = decode_timer.nsecsElapsed();
+
                     JCON_ASSERT(!doc.isNull());
-                    JCON_ASSERT(doc.isObject());
                     if (doc.isObject())
-                        emit jsonObjectReceived(doc.object(), socket);
+                        emit jsonObjectReceived(doc.object(), this);
+                    else if (doc.isArray())
+                        emit jsonArrayReceived(doc.array(), this);
                     buf = chopLeft(buf, i);
                     i = 0;
                     continue;
@@ -2,13 +2,17 @@
 #define JSONRPCENDPOINT_H
 
 #include "jcon.h"
+#include "json_rpc_capture.h"
 #include "json_rpc_logger.h"
 #include "json_rpc_socket.h"
 
 #include <QByteArray>
+#include <QHash>
 
+#include <deque>
 #include <memory>
 
+class QJsonArray;
 class QJsonObject;
 class QTcpSocket;
 
@@ -18,11 +22,53 @@ namespace jcon {
  * Abstraction layer around JsonRpcSocket. Takes care of deserializing complete
  * JSON objects from byte stream.
  */
-class JCON_API JsonRpcEndpoint : public QObject
+class JCON_API JsonRpcEndpoint
+    : public QObject
+    , public std::enable_shared_from_this<JsonRpcEndpoint>
 {
     Q_OBJECT
 
 public:
+    /// What to do when the outbound queue of a slow peer is full.
+    enum OverflowPolicy {
+        /// Hand everything to the socket without limit (the default).
+        OP_Unbounded,
+        /// Drop the oldest queued message.
+        OP_DropOldest,
+        /// Drop notifications, but never responses.
+        OP_DropNotifications,
+        /// Replace a queued notification with a newer one with the same
+        /// conflation key, and drop notifications if there is none to
+        /// replace. See JsonRpcServer::setConflationKey() for the keys of
+        /// signal notifications.
+        OP_Conflate,
+        /// Disconnect the peer.
+        OP_Disconnect
+    };
+
+    struct OutboundLimits {
+        OverflowPolicy policy = OP_Unbounded;
+
+        /// Socket write buffer size above which messages are queued instead
+        /// of written.
+        qint64 high_water_bytes = 4 * 1024 * 1024;
+
+        /// Number of queued messages above which the policy is applied.
+        int max_queued_messages = 1024;
+    };
+
+    struct Statistics {
+        QHostAddress peer_address;
+        int peer_port = 0;
+        qint64 bytes_to_write = 0;
+        int queued_messages = 0;
+        qint64 queued_bytes = 0;
+        quint64 dropped_messages = 0;
+        quint64 conflated_messages = 0;
+        quint64 high_water_events = 0;
+        bool congested = false;
+    };
+
     JsonRpcEndpoint(JsonRpcSocketPtr socket,
                     JsonRpcLoggerPtr logger,
                     QObject* parent = nullptr);
@@ -40,6 +86,35 @@ public:
 
     void send(const QJsonDocument& doc);
 
+    /// Send an already serialized, compact JSON message.
+    void send(const QByteArray& bytes);
+
+    /**
+     * Send a serialized notification. Notifications may be dropped or
+     * conflated according to the overflow policy if the peer is slow.
+     *
+     * @param[in] bytes           The compact JSON notification.
+     * @param[in] conflation_key  Queued notifications with the same key are
+     *                            replaced by newer ones with OP_Conflate.
+     */
+    void sendNotification(const QByteArray& bytes,
+                          const QString& conflation_key);
+
+    void setOutboundLimits(const OutboundLimits& limits);
+    OutboundLimits outboundLimits() const { return m_limits; }
+
+    Statistics statistics() const;
+
+    /**
+     * Time spent parsing the message last received, in nanoseconds. Valid
+     * while jsonObjectReceived or jsonArrayReceived is being emitted.
+     */
+    qint64 lastDecodeTime() const { return m_last_decode_nsecs; }
+
+    /// Record every message received to \p capture, or stop recording if
+    /// it is null.
+    void setCapture(const JsonRpcCapturePtr& capture);
+
     using WeakPtr = std::weak_ptr<JsonRpcEndpoint>;
 
 signals:
@@ -47,9 +122,18 @@ signals:
      * Emitted for every JSON object received.
      *
      * @param[in] obj The JSON object received.
-     * @param[in] sender The socket identifier (e.g. a QTcpSocket*).
+     * @param[in] endpoint The endpoint that received the object.
      */
-    void jsonObjectReceived(const QJsonObject& obj, QObject* sender);
+    void jsonObjectReceived(const QJsonObject& obj, JsonRpcEndpoint* endpoint);
+
+    /**
+     * Emitted for every JSON array received, i.e. for every batch of
+     * requests or responses.
+     *
+     * @param[in] array The JSON array received.
+     * @param[in] endpoint The endpoint that received the array.
+     */
+    void jsonArrayReceived(const QJsonArray& array, JsonRpcEndpoint* endpoint);
 
     /// Emitted when the underlying socket is connected.
     void socketConnected(QObject* socket);
@@ -60,17 +144,65 @@ signals:
     /// Emitted when the underlying socket has an error.
     void socketError(QObject* socket, QAbstractSocket::SocketError error);
 
+    /**
+     * Emitted when the outbound queue has been drained after the high water
+     * mark was crossed, i.e. when the peer has caught up again.
+     */
+    void writable();
+
 private slots:
     void dataReceived(const QByteArray& bytes, QObject* socket);
+    void flushOutboundQueue();
 
 private:
-    /** Check buffer for complete JSON objects, and emit jsonObjectReceived for
-        each one. */
-    QByteArray processBuffer(const QByteArray& buf, QObject* socket);
+    /** Check buffer for complete JSON objects and arrays, and emit
+        jsonObjectReceived or jsonArrayReceived for each one. */
+    QByteArray processBuffer(const QByteArray& buf);
+
+    struct OutboundMessage {
+        QByteArray bytes;
+        QString conflation_key;
+        quint64 sequence;
+        bool notification;
+        bool dropped;
+    };
+
+    void enqueue(const QByteArray& bytes,
+                 bool notification,
+                 const QString& conflation_key);
+
+    /// Make room for a new message. Returns false if it should be dropped.
+    bool applyOverflowPolicy(bool notification);
+
+    bool conflate(const QByteArray& bytes, const QString& conflation_key);
+    bool dropOldestNotification();
+    void dropMessage(OutboundMessage& message);
+    void unqueueMessage(OutboundMessage& message);
+    void popFrontMessage();
+    void popDroppedMessages();
+    void clearOutboundQueue();
 
     JsonRpcLoggerPtr m_logger;
     JsonRpcSocketPtr m_socket;
     QByteArray m_recv_buffer;
+
+    OutboundLimits m_limits;
+    Statistics m_stats;
+    qint64 m_last_decode_nsecs;
+
+    JsonRpcCapturePtr m_capture;
+    quint32 m_capture_connection;
+
+    /// Messages held back while the socket write buffer is above the high
+    /// water mark. Dropped messages stay in place, marked as dropped, so that
+    /// positions in m_conflation_index remain valid.
+    std::deque<OutboundMessage> m_outbound_queue;
+
+    /// Sequence number of the message at the front of m_outbound_queue.
+    quint64 m_front_sequence;
+
+    /// Sequence numbers of queued notifications, by conflation key.
+    QHash<QString, quint64> m_conflation_index;
 };
 
 typedef std::shared_ptr<JsonRpcEndpoint> JsonRpcEndpointPtr;
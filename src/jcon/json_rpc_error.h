@@ -16,7 +16,11 @@ public:
         EC_InvalidRequest = -32600,
         EC_MethodNotFound = -32601,
         EC_InvalidParams = -32602,
-        EC_InternalError = -32603
+        EC_InternalError = -32603,
+
+        // Generated by the client, for requests that got no response
+        EC_RequestTimeout = -32001,
+        EC_ConnectionLost = -32002
     };
 
     JsonRpcError(int code = 0,
@@ -0,0 +1,40 @@
+#include "json_rpc_exception.h"
+
+namespace jcon {
+
+JsonRpcException::JsonRpcException(int code,
+                                   const QString& message,
+                                   const QVariant& data)
+    : m_code(code)
+    , m_message(message)
+    , m_data(data)
+    , m_what(QString("JSON RPC error: %1 (%2)")
+             .arg(message).arg(code).toUtf8())
+{
+}
+
+JsonRpcException::~JsonRpcException()
+{
+}
+
+void JsonRpcException::raise() const
+{
+    throw *this;
+}
+
+JsonRpcException* JsonRpcException::clone() const
+{
+    return new JsonRpcException(*this);
+}
+
+const char* JsonRpcException::what() const noexcept
+{
+    return m_what.constData();
+}
+
+JsonRpcError JsonRpcException::error() const
+{
+    return JsonRpcError(m_code, m_message, m_data);
+}
+
+}
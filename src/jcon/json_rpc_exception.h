@@ -0,0 +1,46 @@
+#ifndef JSON_RPC_EXCEPTION_H
+#define JSON_RPC_EXCEPTION_H
+
+#include "jcon.h"
+#include "json_rpc_error.h"
+
+#include <QByteArray>
+#include <QException>
+#include <QString>
+#include <QVariant>
+
+namespace jcon {
+
+/**
+ * Exception carrying a JSON RPC error. It is reported to the QFuture of a
+ * failed call made with JsonRpcClient::callFuture(), and thrown when the
+ * result of that future is requested.
+ */
+class JCON_API JsonRpcException : public QException
+{
+public:
+    JsonRpcException(int code,
+                     const QString& message,
+                     const QVariant& data = QVariant());
+    virtual ~JsonRpcException();
+
+    void raise() const override;
+    JsonRpcException* clone() const override;
+    const char* what() const noexcept override;
+
+    int code() const { return m_code; }
+    QString message() const { return m_message; }
+    QVariant data() const { return m_data; }
+
+    JsonRpcError error() const;
+
+private:
+    int m_code;
+    QString m_message;
+    QVariant m_data;
+    QByteArray m_what;
+};
+
+}
+
+#endif
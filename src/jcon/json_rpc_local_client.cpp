@@ -0,0 +1,28 @@
+#include "json_rpc_local_client.h"
+#include "json_rpc_local_socket.h"
+
+#include <memory>
+
+namespace jcon {
+
+JsonRpcLocalClient::JsonRpcLocalClient(QObject* parent,
+                                       JsonRpcLoggerPtr logger)
+    : JsonRpcClient(std::make_shared<JsonRpcLocalSocket>(), parent, logger)
+{
+}
+
+JsonRpcLocalClient::~JsonRpcLocalClient()
+{
+}
+
+bool JsonRpcLocalClient::connectToServer(const QString& name)
+{
+    return connectToServer(name, 0);
+}
+
+void JsonRpcLocalClient::connectToServerAsync(const QString& name)
+{
+    connectToServerAsync(name, 0);
+}
+
+}
@@ -0,0 +1,28 @@
+#ifndef JSON_RPC_LOCAL_CLIENT_H
+#define JSON_RPC_LOCAL_CLIENT_H
+
+#include "json_rpc_client.h"
+
+namespace jcon {
+
+/// Client for a JsonRpcLocalServer on the same machine.
+class JCON_API JsonRpcLocalClient : public JsonRpcClient
+{
+    Q_OBJECT
+
+public:
+    JsonRpcLocalClient(QObject* parent = nullptr,
+                       JsonRpcLoggerPtr logger = nullptr);
+    virtual ~JsonRpcLocalClient();
+
+    using JsonRpcClient::connectToServer;
+    using JsonRpcClient::connectToServerAsync;
+
+    /// Connect to the server \p name; see JsonRpcLocalSocket.
+    bool connectToServer(const QString& name);
+    void connectToServerAsync(const QString& name);
+};
+
+}
+
+#endif
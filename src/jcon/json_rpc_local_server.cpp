@@ -0,0 +1,123 @@
+#include "json_rpc_local_server.h"
+#include "json_rpc_local_socket.h"
+#include "local_socket_util.h"
+#include "jcon_assert.h"
+
+namespace jcon {
+
+JsonRpcLocalServer::JsonRpcLocalServer(QObject* parent,
+                                       JsonRpcLoggerPtr logger)
+    : JsonRpcServer(parent, logger)
+    , m_server(this)
+    , m_abstract_socket(-1)
+{
+    m_server.connect(&m_server, &QLocalServer::newConnection,
+                     this, &JsonRpcLocalServer::newConnection);
+}
+
+JsonRpcLocalServer::~JsonRpcLocalServer()
+{
+    m_server.disconnect(this);
+    close();
+}
+
+bool JsonRpcLocalServer::listen(const QString& name)
+{
+    logInfo("listening on " + name);
+
+    if (isAbstractSocketName(name)) {
+        QString error;
+        m_abstract_socket = listenUnixSocket(name, error);
+        if (m_abstract_socket < 0) {
+            logError(error);
+            return false;
+        }
+
+        m_abstract_notifier.reset(
+            new QSocketNotifier(m_abstract_socket, QSocketNotifier::Read));
+        connect(m_abstract_notifier.get(), &QSocketNotifier::activated,
+                this, &JsonRpcLocalServer::abstractConnection);
+        return true;
+    }
+
+    if (m_server.listen(name))
+        return true;
+
+    if (m_server.serverError() != QAbstractSocket::AddressInUseError) {
+        logError("could not listen: " + m_server.errorString());
+        return false;
+    }
+
+    // The name is taken. If nobody accepts connections on it, the socket
+    // file is a leftover that can be removed.
+    QLocalSocket probe;
+    probe.connectToServer(name);
+    if (probe.waitForConnected(1000)) {
+        logError("another server is listening on " + name);
+        return false;
+    }
+
+    QLocalServer::removeServer(name);
+    if (!m_server.listen(name)) {
+        logError("could not listen: " + m_server.errorString());
+        return false;
+    }
+    return true;
+}
+
+bool JsonRpcLocalServer::listen(int port)
+{
+    return listen(JsonRpcLocalSocket::serverName(port));
+}
+
+void JsonRpcLocalServer::close()
+{
+    m_server.close();
+
+    m_abstract_notifier.reset();
+    if (m_abstract_socket >= 0) {
+        closeUnixSocket(m_abstract_socket);
+        m_abstract_socket = -1;
+    }
+}
+
+void JsonRpcLocalServer::newConnection()
+{
+    JCON_ASSERT(m_server.hasPendingConnections());
+    if (m_server.hasPendingConnections()) {
+        QLocalSocket* local_socket = m_server.nextPendingConnection();
+
+        JCON_ASSERT(local_socket);
+        if (!local_socket) {
+            logError("pending socket was null");
+            return;
+        }
+
+        addLocalClient(local_socket);
+    }
+}
+
+void JsonRpcLocalServer::abstractConnection()
+{
+    int descriptor;
+    while ((descriptor = acceptUnixSocket(m_abstract_socket)) >= 0) {
+        auto local_socket = new QLocalSocket;
+        if (!local_socket->setSocketDescriptor(descriptor)) {
+            logError("could not use accepted socket: " +
+                     local_socket->errorString());
+            closeUnixSocket(descriptor);
+            delete local_socket;
+            continue;
+        }
+
+        addLocalClient(local_socket);
+    }
+}
+
+void JsonRpcLocalServer::addLocalClient(QLocalSocket* local_socket)
+{
+    logInfo("client connected");
+    addClient(std::make_shared<JsonRpcLocalSocket>(local_socket));
+}
+
+}
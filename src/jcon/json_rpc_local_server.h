@@ -0,0 +1,57 @@
+#ifndef JSONRPCLOCALSERVER_H
+#define JSONRPCLOCALSERVER_H
+
+#include "jcon.h"
+#include "json_rpc_server.h"
+#include "json_rpc_endpoint.h"
+#include "json_rpc_socket.h"
+
+#include <QLocalServer>
+#include <QSocketNotifier>
+
+#include <memory>
+
+namespace jcon {
+
+/**
+ * Server for clients on the same machine, see JsonRpcLocalSocket. On Linux,
+ * names starting with '@' are in the abstract namespace.
+ */
+class JCON_API JsonRpcLocalServer : public JsonRpcServer
+{
+    Q_OBJECT
+
+public:
+    JsonRpcLocalServer(QObject* parent = nullptr,
+                       JsonRpcLoggerPtr logger = nullptr);
+    virtual ~JsonRpcLocalServer();
+
+    /**
+     * Listen on the server \p name. A socket file left behind by a server
+     * that didn't shut down cleanly is removed, but the name of a running
+     * server isn't taken over.
+     */
+    bool listen(const QString& name);
+
+    /// Listen on JsonRpcLocalSocket::serverName(port).
+    bool listen(int port) override;
+    void close() override;
+
+private slots:
+    /// Called when the underlying QLocalServer gets a new client connection.
+    void newConnection() override;
+
+    /// Called when the abstract socket has a connection to accept.
+    void abstractConnection();
+
+private:
+    void addLocalClient(QLocalSocket* local_socket);
+
+    QLocalServer m_server;
+    int m_abstract_socket;
+    std::unique_ptr<QSocketNotifier> m_abstract_notifier;
+};
+
+}
+
+#endif
@@ -0,0 +1,143 @@
+#include "json_rpc_local_socket.h"
+#include "local_socket_util.h"
+#include "jcon_assert.h"
+
+namespace jcon {
+
+JsonRpcLocalSocket::JsonRpcLocalSocket()
+    : m_socket(new QLocalSocket)
+{
+    setupSocket();
+}
+
+JsonRpcLocalSocket::JsonRpcLocalSocket(QLocalSocket* socket)
+    : m_socket(socket)
+{
+    setupSocket();
+}
+
+JsonRpcLocalSocket::~JsonRpcLocalSocket()
+{
+    m_socket->disconnect(this);
+    m_socket->deleteLater();
+}
+
+QString JsonRpcLocalSocket::serverName(int port)
+{
+    return QString("jcon-%1").arg(port);
+}
+
+void JsonRpcLocalSocket::setupSocket()
+{
+    connect(m_socket, &QLocalSocket::connected, [this]() {
+        emit socketConnected(m_socket);
+    });
+
+    connect(m_socket, &QLocalSocket::disconnected, [this]() {
+        emit socketDisconnected(m_socket);
+    });
+
+    connect(m_socket, &QLocalSocket::readyRead,
+            this, &JsonRpcLocalSocket::dataReady);
+
+    connect(m_socket, &QLocalSocket::bytesWritten,
+            this, &JsonRpcLocalSocket::bytesWritten);
+
+    // The values of LocalSocketError are those of QAbstractSocket's.
+    void (QLocalSocket::*errorPtr)(QLocalSocket::LocalSocketError) =
+        &QLocalSocket::error;
+    connect(m_socket, errorPtr, this,
+            [this](QLocalSocket::LocalSocketError error) {
+                emit socketError(
+                    m_socket,
+                    static_cast<QAbstractSocket::SocketError>(error));
+            });
+}
+
+void JsonRpcLocalSocket::connectToHost(QString host, int port)
+{
+    const QString name = host.isEmpty() ? serverName(port) : host;
+    m_error.clear();
+
+    if (!isAbstractSocketName(name)) {
+        m_socket->connectToServer(name);
+        return;
+    }
+
+    const int descriptor = connectUnixSocket(name, m_error);
+    if (descriptor < 0) {
+        emit socketError(m_socket, QAbstractSocket::ConnectionRefusedError);
+        return;
+    }
+
+    if (!m_socket->setSocketDescriptor(descriptor)) {
+        closeUnixSocket(descriptor);
+        m_error = "could not use socket: " + m_socket->errorString();
+        emit socketError(m_socket, QAbstractSocket::UnknownSocketError);
+        return;
+    }
+
+    // The descriptor is connected already, so QLocalSocket doesn't emit
+    // connected().
+    emit socketConnected(m_socket);
+}
+
+bool JsonRpcLocalSocket::waitForConnected(int msecs)
+{
+    return m_socket->waitForConnected(msecs);
+}
+
+void JsonRpcLocalSocket::disconnectFromHost()
+{
+    m_socket->disconnectFromServer();
+    m_socket->close();
+}
+
+bool JsonRpcLocalSocket::isConnected() const
+{
+    return m_socket->state() == QLocalSocket::ConnectedState;
+}
+
+void JsonRpcLocalSocket::send(const QByteArray& data)
+{
+    m_socket->write(data);
+}
+
+qint64 JsonRpcLocalSocket::bytesToWrite() const
+{
+    return m_socket->bytesToWrite();
+}
+
+QString JsonRpcLocalSocket::errorString() const
+{
+    return m_error.isEmpty() ? m_socket->errorString() : m_error;
+}
+
+QHostAddress JsonRpcLocalSocket::localAddress() const
+{
+    return QHostAddress::LocalHost;
+}
+
+int JsonRpcLocalSocket::localPort() const
+{
+    return 0;
+}
+
+QHostAddress JsonRpcLocalSocket::peerAddress() const
+{
+    return QHostAddress::LocalHost;
+}
+
+int JsonRpcLocalSocket::peerPort() const
+{
+    return 0;
+}
+
+void JsonRpcLocalSocket::dataReady()
+{
+    JCON_ASSERT(m_socket->bytesAvailable() > 0);
+    QByteArray bytes = m_socket->read(m_socket->bytesAvailable());
+    emit dataReceived(bytes, m_socket);
+}
+
+}
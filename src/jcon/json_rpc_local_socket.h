@@ -0,0 +1,72 @@
+#ifndef JSONRPCLOCALSOCKET_H
+#define JSONRPCLOCALSOCKET_H
+
+#include "jcon.h"
+#include "json_rpc_socket.h"
+
+#include <QLocalSocket>
+
+namespace jcon {
+
+/**
+ * Socket for processes on the same machine, a Unix domain socket or, on
+ * Windows, a named pipe. It avoids the overhead of the TCP stack, and
+ * needs no port.
+ *
+ * connectToHost() takes the name of the server instead of a host, and
+ * ignores the port; with an empty name it connects to serverName(port). On
+ * Linux, names starting with '@' are in the abstract namespace.
+ */
+class JCON_API JsonRpcLocalSocket : public JsonRpcSocket
+{
+    Q_OBJECT
+
+public:
+    /**
+     * Default constructor. Create a new QLocalSocket.
+     */
+    JsonRpcLocalSocket();
+
+    /**
+     * Constructor taking a previously created socket. This is used by
+     * JsonRpcLocalServer, for the sockets of accepted connections.
+     *
+     * @param[in] socket The local socket to use.
+     */
+    JsonRpcLocalSocket(QLocalSocket* socket);
+
+    virtual ~JsonRpcLocalSocket();
+
+    /// Name of the server that JsonRpcLocalServer::listen(int) listens on.
+    static QString serverName(int port);
+
+    void connectToHost(QString host, int port) override;
+    bool waitForConnected(int msecs) override;
+    void disconnectFromHost() override;
+    bool isConnected() const override;
+    void send(const QByteArray& data) override;
+    qint64 bytesToWrite() const override;
+    QString errorString() const override;
+
+    /// Local sockets have no address; these return the local host and 0.
+    QHostAddress localAddress() const override;
+    int localPort() const override;
+    QHostAddress peerAddress() const override;
+    int peerPort() const override;
+
+private slots:
+    void dataReady();
+
+private:
+    void setupSocket();
+
+    QLocalSocket* m_socket;
+
+    /// Error of connecting to an abstract socket, which QLocalSocket knows
+    /// nothing about.
+    QString m_error;
+};
+
+}
+
+#endif
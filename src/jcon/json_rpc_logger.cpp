@@ -3,6 +3,7 @@
 namespace jcon {
 
 JsonRpcLogger::JsonRpcLogger()
+    : m_level(LL_Info)
 {
 }
 
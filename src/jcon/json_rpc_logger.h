@@ -3,6 +3,7 @@
 
 #include "jcon.h"
 
+#include <atomic>
 #include <memory>
 
 class QString;
@@ -12,16 +13,60 @@ namespace jcon {
 class JCON_API JsonRpcLogger
 {
 public:
+    /// Severity of a message. Messages below the logger's level are skipped.
+    enum Level {
+        LL_Info,
+        LL_Warning,
+        LL_Error,
+        LL_None
+    };
+
     JsonRpcLogger();
     virtual ~JsonRpcLogger();
 
     virtual void logInfo(const QString& message) = 0;
     virtual void logWarning(const QString& message) = 0;
     virtual void logError(const QString& message) = 0;
+
+    /// Set the lowest level that is logged, or LL_None to log nothing.
+    void setLevel(Level level) {
+        m_level.store(level, std::memory_order_relaxed);
+    }
+    Level level() const {
+        return static_cast<Level>(m_level.load(std::memory_order_relaxed));
+    }
+
+    /**
+     * Whether messages of \p level are logged. Callers check this before
+     * building a message; the JCON_LOG_* macros do so.
+     */
+    bool isEnabled(Level level) const {
+        return level >= m_level.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<int> m_level;
 };
 
 typedef std::shared_ptr<JsonRpcLogger> JsonRpcLoggerPtr;
 
 }
 
+/**
+ * Log \p message with \p logger if its level is enabled. \p message is only
+ * evaluated when it is logged, so formatting it costs nothing otherwise.
+ */
+#define JCON_LOG(logger, level, log_function, message)                     \
+    do {                                                                   \
+        if ((logger)->isEnabled(jcon::JsonRpcLogger::level))               \
+            (logger)->log_function(message);                               \
+    } while (false)
+
+#define JCON_LOG_INFO(logger, message) \
+    JCON_LOG(logger, LL_Info, logInfo, message)
+#define JCON_LOG_WARNING(logger, message) \
+    JCON_LOG(logger, LL_Warning, logWarning, message)
+#define JCON_LOG_ERROR(logger, message) \
+    JCON_LOG(logger, LL_Error, logError, message)
+
 #endif
@@ -0,0 +1,193 @@
+#include "json_rpc_metrics.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace jcon {
+
+namespace {
+
+int highestBit(quint64 value)
+{
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(value);
+#else
+    int bit = 0;
+    while (value >>= 1)
+        ++bit;
+    return bit;
+#endif
+}
+
+QVariantMap histogramToVariant(const JsonRpcHistogram::Snapshot& snapshot)
+{
+    const double nsecs_per_usec = 1000.0;
+    return QVariantMap {
+        { "count", snapshot.count },
+        { "mean", snapshot.count ? snapshot.sum / nsecs_per_usec / snapshot.count : 0.0 },
+        { "p50", snapshot.p50 / nsecs_per_usec },
+        { "p99", snapshot.p99 / nsecs_per_usec },
+        { "p999", snapshot.p999 / nsecs_per_usec },
+        { "max", snapshot.max / nsecs_per_usec }
+    };
+}
+
+}
+
+JsonRpcHistogram::JsonRpcHistogram()
+    : m_sum(0)
+    , m_max(0)
+{
+    for (auto& bucket : m_buckets)
+        bucket.store(0, std::memory_order_relaxed);
+}
+
+int JsonRpcHistogram::bucketIndex(quint64 value)
+{
+    const quint64 max_value = (Q_UINT64_C(1) << MaxValueBits) - 1;
+    if (value > max_value)
+        value = max_value;
+
+    if (value < SubBuckets)
+        return static_cast<int>(value);
+
+    // The top SubBucketBits + 1 bits select the bucket: the position of the
+    // highest bit the group, the bits below it the sub-bucket.
+    const int shift = highestBit(value) - SubBucketBits;
+    return (shift + 1) * SubBuckets +
+        static_cast<int>((value >> shift) & (SubBuckets - 1));
+}
+
+quint64 JsonRpcHistogram::bucketValue(int index)
+{
+    if (index < SubBuckets)
+        return static_cast<quint64>(index);
+
+    const int shift = index / SubBuckets - 1;
+    const quint64 sub_bucket = static_cast<quint64>(index % SubBuckets);
+    const quint64 lower = (SubBuckets + sub_bucket) << shift;
+    return lower + ((Q_UINT64_C(1) << shift) >> 1);
+}
+
+JsonRpcHistogram::Snapshot JsonRpcHistogram::snapshot() const
+{
+    // Samples may be recorded while the buckets are read, so the total is
+    // taken from the buckets themselves to keep the percentiles consistent.
+    std::vector<quint64> counts(BucketCount);
+    quint64 total = 0;
+    for (int i = 0; i < BucketCount; ++i) {
+        counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+
+    Snapshot snapshot;
+    snapshot.count = total;
+    snapshot.sum = m_sum.load(std::memory_order_relaxed);
+    snapshot.max = m_max.load(std::memory_order_relaxed);
+    if (total == 0)
+        return snapshot;
+
+    const double quantiles[] = { 0.5, 0.99, 0.999 };
+    quint64* const results[] = { &snapshot.p50, &snapshot.p99, &snapshot.p999 };
+
+    quint64 seen = 0;
+    int quantile = 0;
+    for (int i = 0; i < BucketCount && quantile < 3; ++i) {
+        seen += counts[i];
+        while (quantile < 3 &&
+               seen >= std::max<quint64>(1, static_cast<quint64>(
+                   std::ceil(quantiles[quantile] * total))))
+        {
+            *results[quantile] = std::min(bucketValue(i), snapshot.max);
+            ++quantile;
+        }
+    }
+    return snapshot;
+}
+
+JsonRpcMethodMetrics::JsonRpcMethodMetrics(bool phases)
+    : m_calls(0)
+    , m_errors(0)
+    , m_in_flight(0)
+{
+    if (phases)
+        m_phases.reset(new JsonRpcHistogram[PhaseCount]);
+}
+
+JsonRpcMetrics::JsonRpcMetrics(bool phases)
+    : m_phases(phases)
+{
+}
+
+JsonRpcMethodMetrics& JsonRpcMetrics::method(const QString& method)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_methods.find(method);
+    if (it == m_methods.end()) {
+        it = m_methods.emplace(
+            method, std::unique_ptr<JsonRpcMethodMetrics>(
+                new JsonRpcMethodMetrics(m_phases))).first;
+    }
+    return *it->second;
+}
+
+std::vector<JsonRpcMetrics::MethodSnapshot> JsonRpcMetrics::snapshot() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::vector<MethodSnapshot> snapshots;
+    snapshots.reserve(m_methods.size());
+
+    for (const auto& entry : m_methods) {
+        const JsonRpcMethodMetrics& metrics = *entry.second;
+
+        MethodSnapshot snapshot;
+        snapshot.method = entry.first;
+        snapshot.calls = metrics.calls();
+        snapshot.errors = metrics.errors();
+        snapshot.in_flight = metrics.inFlight();
+        snapshot.latency = metrics.latency().snapshot();
+
+        if (m_phases) {
+            for (int i = 0; i < JsonRpcMethodMetrics::PhaseCount; ++i) {
+                const auto phase = static_cast<JsonRpcMethodMetrics::Phase>(i);
+                snapshot.phases.push_back(metrics.phase(phase)->snapshot());
+            }
+        }
+        snapshots.push_back(std::move(snapshot));
+    }
+    return snapshots;
+}
+
+QVariantMap JsonRpcMetrics::toVariantMap() const
+{
+    static const char* const phase_names[] = {
+        "decode", "dispatch", "encode", "write"
+    };
+
+    QVariantMap result;
+    for (const auto& snapshot : snapshot()) {
+        QVariantMap method {
+            { "calls", snapshot.calls },
+            { "errors", snapshot.errors },
+            { "latency", histogramToVariant(snapshot.latency) }
+        };
+
+        // The server handles requests synchronously and records them once
+        // answered, so it never sees any in flight.
+        if (!m_phases)
+            method.insert("inFlight", snapshot.in_flight);
+
+        if (!snapshot.phases.empty()) {
+            QVariantMap phases;
+            for (size_t i = 0; i < snapshot.phases.size(); ++i)
+                phases.insert(phase_names[i], histogramToVariant(snapshot.phases[i]));
+            method.insert("phases", phases);
+        }
+        result.insert(snapshot.method, method);
+    }
+    return result;
+}
+
+}
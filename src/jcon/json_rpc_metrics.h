@@ -0,0 +1,181 @@
+#ifndef JSON_RPC_METRICS_H
+#define JSON_RPC_METRICS_H
+
+#include "jcon.h"
+
+#include <QString>
+#include <QVariantMap>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace jcon {
+
+/**
+ * Latency histogram with logarithmic buckets, in the style of HdrHistogram.
+ *
+ * Every power of two is split into 16 linear sub-buckets, so recorded values
+ * are kept with a relative error below 1/16, from single nanoseconds up to
+ * about three days. Recording is a few relaxed atomic increments, and may
+ * happen from any thread while snapshots are taken.
+ */
+class JCON_API JsonRpcHistogram
+{
+public:
+    struct Snapshot {
+        quint64 count = 0;
+        quint64 sum = 0;
+        quint64 max = 0;
+        quint64 p50 = 0;
+        quint64 p99 = 0;
+        quint64 p999 = 0;
+    };
+
+    JsonRpcHistogram();
+
+    void record(quint64 value)
+    {
+        m_buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(value, std::memory_order_relaxed);
+
+        quint64 max = m_max.load(std::memory_order_relaxed);
+        while (value > max &&
+               !m_max.compare_exchange_weak(max, value,
+                                            std::memory_order_relaxed))
+        {
+        }
+    }
+
+    Snapshot snapshot() const;
+
+private:
+    enum {
+        SubBucketBits = 4,
+        SubBuckets = 1 << SubBucketBits,
+        MaxValueBits = 48,
+        BucketCount = (MaxValueBits - SubBucketBits + 1) * SubBuckets
+    };
+
+    static int bucketIndex(quint64 value);
+
+    /// The value reported for samples in the bucket, its midpoint.
+    static quint64 bucketValue(int index);
+
+    std::atomic<quint64> m_buckets[BucketCount];
+    std::atomic<quint64> m_sum;
+    std::atomic<quint64> m_max;
+};
+
+/// Counters and latencies of a single method.
+class JCON_API JsonRpcMethodMetrics
+{
+public:
+    /// Phases of handling a request on the server.
+    enum Phase {
+        PH_Decode,
+        PH_Dispatch,
+        PH_Encode,
+        PH_Write,
+        PhaseCount
+    };
+
+    explicit JsonRpcMethodMetrics(bool phases);
+
+    void callStarted()
+    {
+        m_calls.fetch_add(1, std::memory_order_relaxed);
+        m_in_flight.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /// A call was answered after \p nsecs nanoseconds.
+    void callFinished(bool error, quint64 nsecs)
+    {
+        m_in_flight.fetch_sub(1, std::memory_order_relaxed);
+        if (error)
+            m_errors.fetch_add(1, std::memory_order_relaxed);
+        m_latency.record(nsecs);
+    }
+
+    /// A call ended without an answer, by timeout, cancellation etc.
+    void callAbandoned(bool error)
+    {
+        m_in_flight.fetch_sub(1, std::memory_order_relaxed);
+        if (error)
+            m_errors.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void recordPhase(Phase phase, quint64 nsecs)
+    {
+        if (m_phases)
+            m_phases[phase].record(nsecs);
+    }
+
+    quint64 calls() const { return m_calls.load(std::memory_order_relaxed); }
+    quint64 errors() const { return m_errors.load(std::memory_order_relaxed); }
+    qint64 inFlight() const {
+        return m_in_flight.load(std::memory_order_relaxed);
+    }
+
+    const JsonRpcHistogram& latency() const { return m_latency; }
+
+    /// Histogram of \p phase, or nullptr if phases are not recorded.
+    const JsonRpcHistogram* phase(Phase phase) const {
+        return m_phases ? &m_phases[phase] : nullptr;
+    }
+
+private:
+    std::atomic<quint64> m_calls;
+    std::atomic<quint64> m_errors;
+    std::atomic<qint64> m_in_flight;
+    JsonRpcHistogram m_latency;
+    std::unique_ptr<JsonRpcHistogram[]> m_phases;
+};
+
+/**
+ * Per-method call metrics of a server or client. Latencies are recorded in
+ * nanoseconds.
+ */
+class JCON_API JsonRpcMetrics
+{
+public:
+    struct MethodSnapshot {
+        QString method;
+        quint64 calls = 0;
+        quint64 errors = 0;
+        qint64 in_flight = 0;
+        JsonRpcHistogram::Snapshot latency;
+
+        /// Empty unless phases are recorded.
+        std::vector<JsonRpcHistogram::Snapshot> phases;
+    };
+
+    /// \p phases selects whether the server phases are recorded.
+    explicit JsonRpcMetrics(bool phases = false);
+
+    /**
+     * The metrics of \p method, created on first use. The returned object
+     * lives as long as this one, so it may be kept for later calls.
+     */
+    JsonRpcMethodMetrics& method(const QString& method);
+
+    std::vector<MethodSnapshot> snapshot() const;
+
+    /**
+     * The snapshot as a map from method name to its metrics, as returned by
+     * the reserved method "rpc.metrics". Times are in microseconds. Calls
+     * in flight are left out when the server phases are recorded.
+     */
+    QVariantMap toVariantMap() const;
+
+private:
+    const bool m_phases;
+    mutable std::mutex m_mutex;
+    std::map<QString, std::unique_ptr<JsonRpcMethodMetrics>> m_methods;
+};
+
+}
+
+#endif
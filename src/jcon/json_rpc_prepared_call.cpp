@@ -0,0 +1,74 @@
+#include "json_rpc_prepared_call.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+namespace jcon {
+
+JsonRpcPreparedCall::JsonRpcPreparedCall()
+    : m_client(nullptr)
+    , m_metrics(nullptr)
+{
+}
+
+JsonRpcPreparedCall::JsonRpcPreparedCall(JsonRpcClient* client,
+                                         const QString& method)
+    : m_client(client)
+    , m_method(method)
+    , m_metrics(&client->m_metrics.method(method))
+{
+    // Serialize the envelope with QJsonDocument, so the method name is
+    // escaped properly, and cut it open before the closing brace.
+    const QJsonObject envelope {
+        { "jsonrpc", "2.0" },
+        { "method", method }
+    };
+    m_prefix = QJsonDocument(envelope).toJson(QJsonDocument::Compact);
+    m_prefix.chop(1);
+    m_prefix.append(",\"params\":");
+}
+
+JsonRpcPreparedCall::RequestId
+JsonRpcPreparedCall::call(const QVariantList& params,
+                          ResultHandler on_result,
+                          ErrorHandler on_error,
+                          int msecs) const
+{
+    Q_ASSERT(isValid());
+    return m_client->callPrepared(*this, params, std::move(on_result),
+                                  std::move(on_error), msecs);
+}
+
+void JsonRpcPreparedCall::notify(const QVariantList& params) const
+{
+    Q_ASSERT(isValid());
+    m_client->notifyPrepared(*this, params);
+}
+
+QByteArray JsonRpcPreparedCall::serialize(const QVariantList& params,
+                                          RequestId id,
+                                          bool unsampled) const
+{
+    const QByteArray encoded_params =
+        QJsonDocument(QJsonArray::fromVariantList(params))
+        .toJson(QJsonDocument::Compact);
+
+    QByteArray message;
+    message.reserve(m_prefix.size() + encoded_params.size() + 32);
+    message.append(m_prefix);
+    message.append(encoded_params);
+    if (id != 0) {
+        message.append(",\"id\":");
+        message.append(QByteArray::number(id));
+    }
+    if (unsampled) {
+        // What JsonRpcTracer::Context::toJson() gives for calls that
+        // aren't sampled.
+        message.append(",\"trace\":{\"sampled\":false}");
+    }
+    message.append('}');
+    return message;
+}
+
+}
@@ -0,0 +1,71 @@
+#ifndef JSON_RPC_PREPARED_CALL_H
+#define JSON_RPC_PREPARED_CALL_H
+
+#include "jcon.h"
+#include "json_rpc_client.h"
+
+#include <QByteArray>
+#include <QString>
+#include <QVariant>
+
+namespace jcon {
+
+/**
+ * Handle for calling one method many times, created by
+ * JsonRpcClient::prepare().
+ *
+ * The request envelope up to the parameters ("jsonrpc", "method") is
+ * serialized once, when the call is prepared. Each invocation only encodes
+ * the parameters and the request ID, and appends them to the cached prefix.
+ *
+ * The handle refers to the client it was prepared by, and must not be used
+ * after the client is destroyed. It is cheap to copy.
+ */
+class JCON_API JsonRpcPreparedCall
+{
+public:
+    typedef JsonRpcClient::RequestId RequestId;
+    typedef JsonRpcClient::ResultHandler ResultHandler;
+    typedef JsonRpcClient::ErrorHandler ErrorHandler;
+
+    /// Create an invalid handle.
+    JsonRpcPreparedCall();
+
+    bool isValid() const { return m_client != nullptr; }
+    QString method() const { return m_method; }
+
+    /**
+     * Call the method; see JsonRpcClient::callAsyncWithHandlers().
+     *
+     * @returns The ID of the request.
+     */
+    RequestId call(const QVariantList& params,
+                   ResultHandler on_result,
+                   ErrorHandler on_error = ErrorHandler(),
+                   int msecs = -1) const;
+
+    /// Send the method as notification, without expecting a response.
+    void notify(const QVariantList& params) const;
+
+private:
+    friend class JsonRpcClient;
+
+    JsonRpcPreparedCall(JsonRpcClient* client, const QString& method);
+
+    /// Serialize a request with the given parameters and ID, or a
+    /// notification if \p id is 0. With \p unsampled, the request tells
+    /// the server that the call isn't traced.
+    QByteArray serialize(const QVariantList& params, RequestId id,
+                         bool unsampled = false) const;
+
+    JsonRpcClient* m_client;
+    QString m_method;
+    QByteArray m_prefix;
+
+    /// The metrics of the method, looked up once instead of for every call.
+    JsonRpcMethodMetrics* m_metrics;
+};
+
+}
+
+#endif
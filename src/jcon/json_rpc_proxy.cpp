@@ -0,0 +1,41 @@
+#include "json_rpc_proxy.h"
+
+#include <atomic>
+
+namespace jcon {
+
+JsonRpcProxyBase::JsonRpcProxyBase(JsonRpcClient* client,
+                                   const QString& domain)
+    : m_client(client)
+    , m_domain(domain)
+{
+}
+
+JsonRpcProxyBase::~JsonRpcProxyBase()
+{
+}
+
+int JsonRpcProxyBase::allocateMethodSlot()
+{
+    static std::atomic<int> next_slot(0);
+    return next_slot++;
+}
+
+const JsonRpcPreparedCall& JsonRpcProxyBase::preparedCall(int slot,
+                                                          const char* name)
+{
+    const size_t index = static_cast<size_t>(slot);
+    if (index >= m_prepared_calls.size())
+        m_prepared_calls.resize(index + 1);
+
+    JsonRpcPreparedCall& prepared = m_prepared_calls[index];
+    if (!prepared.isValid()) {
+        QString method = QString::fromUtf8(name);
+        if (!m_domain.isEmpty())
+            method.prepend(m_domain + "/");
+        prepared = m_client->prepare(method);
+    }
+    return prepared;
+}
+
+}
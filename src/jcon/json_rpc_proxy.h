@@ -0,0 +1,208 @@
+#ifndef JSON_RPC_PROXY_H
+#define JSON_RPC_PROXY_H
+
+#include "jcon.h"
+#include "json_rpc_client.h"
+#include "json_rpc_exception.h"
+#include "json_rpc_prepared_call.h"
+#include "json_rpc_serialization.h"
+
+#include <QFuture>
+#include <QFutureInterface>
+#include <QString>
+
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace jcon {
+
+/// Non-template part of JsonRpcProxy.
+class JCON_API JsonRpcProxyBase
+{
+public:
+    virtual ~JsonRpcProxyBase();
+
+    JsonRpcClient* client() const { return m_client; }
+    QString domain() const { return m_domain; }
+
+protected:
+    JsonRpcProxyBase(JsonRpcClient* client, const QString& domain);
+
+    /// Allocate an entry in the method name cache of all proxies. Called once
+    /// for every method declared with JCON_PROXY_METHOD.
+    static int allocateMethodSlot();
+
+    /**
+     * Prepared call of the method \p name. The call is prepared the first
+     * time the proxy calls the method, and cached in the entry \p slot.
+     */
+    const JsonRpcPreparedCall& preparedCall(int slot, const char* name);
+
+    JsonRpcClient* m_client;
+
+private:
+    QString m_domain;
+    std::vector<JsonRpcPreparedCall> m_prepared_calls;
+};
+
+namespace detail {
+
+template<typename R>
+struct ProxyCall
+{
+    static QFuture<R> call(const JsonRpcPreparedCall& prepared,
+                           const QVariantList& params)
+    {
+        QFutureInterface<R> future;
+        future.reportStarted();
+
+        prepared.call(
+            params,
+            [future](const QVariant& result) mutable {
+                R value;
+                if (valueFromJson(result, value)) {
+                    future.reportResult(value);
+                } else {
+                    future.reportException(
+                        JsonRpcException(JsonRpcError::EC_InternalError,
+                                         "cannot convert result", result));
+                }
+                future.reportFinished();
+            },
+            [future](int code, const QString& message,
+                     const QVariant& data) mutable
+            {
+                future.reportException(JsonRpcException(code, message, data));
+                future.reportFinished();
+            });
+
+        return future.future();
+    }
+};
+
+template<>
+struct ProxyCall<void>
+{
+    static QFuture<void> call(const JsonRpcPreparedCall& prepared,
+                              const QVariantList& params)
+    {
+        QFutureInterface<void> future;
+        future.reportStarted();
+
+        prepared.call(
+            params,
+            [future](const QVariant&) mutable {
+                future.reportFinished();
+            },
+            [future](int code, const QString& message,
+                     const QVariant& data) mutable
+            {
+                future.reportException(JsonRpcException(code, message, data));
+                future.reportFinished();
+            });
+
+        return future.future();
+    }
+};
+
+}
+
+/**
+ * Typed client-side proxy for a service class.
+ *
+ * The methods to be called through the proxy are declared with
+ * JCON_PROXY_METHOD in a subclass:
+ *
+ *     class ExampleServiceProxy : public jcon::JsonRpcProxy<ExampleService>
+ *     {
+ *     public:
+ *         using JsonRpcProxy::JsonRpcProxy;
+ *
+ *         JCON_PROXY_METHOD(getRandomInt)
+ *     };
+ *
+ *     auto proxy = rpc_client->proxy<ExampleServiceProxy>();
+ *     QFuture<int> result = proxy->getRandomInt(10);
+ *
+ * The parameter and result types of each call are taken from the
+ * declaration of the method in the service header at compile time. Arguments
+ * are converted to the parameter types before they are serialized, and the
+ * result is converted to the return type once it arrives. A result that
+ * cannot be converted, and any error of the call, are reported to the future
+ * as a JsonRpcException.
+ *
+ * Each method is prepared once per proxy (see JsonRpcPreparedCall), so a call
+ * only serializes its argument values and request ID.
+ *
+ * Only the service header is needed: the methods of the service class are
+ * neither called nor linked. Overloaded methods are not supported.
+ */
+template<typename Service>
+class JsonRpcProxy : public JsonRpcProxyBase
+{
+public:
+    typedef Service ServiceType;
+
+    /// Create a proxy for the service registered under \p domain.
+    explicit JsonRpcProxy(JsonRpcClient* client,
+                          const QString& domain = QString())
+        : JsonRpcProxyBase(client, domain)
+    {
+    }
+
+protected:
+    // The member function pointer is always null, and only selects the
+    // parameter and result types.
+    template<typename R, typename... Params, typename... Args>
+    QFuture<R> invoke(int slot,
+                      const char* name,
+                      R (Service::*)(Params...),
+                      Args&&... args)
+    {
+        return call<R, Params...>(slot, name, std::forward<Args>(args)...);
+    }
+
+    template<typename R, typename... Params, typename... Args>
+    QFuture<R> invoke(int slot,
+                      const char* name,
+                      R (Service::*)(Params...) const,
+                      Args&&... args)
+    {
+        return call<R, Params...>(slot, name, std::forward<Args>(args)...);
+    }
+
+private:
+    template<typename R, typename... Params, typename... Args>
+    QFuture<R> call(int slot, const char* name, Args&&... args)
+    {
+        static_assert(sizeof...(Params) == sizeof...(Args),
+                      "wrong number of arguments to proxy method");
+
+        const QVariantList params {
+            valueToJson(static_cast<typename std::decay<Params>::type>(
+                std::forward<Args>(args)))...
+        };
+        return detail::ProxyCall<typename std::decay<R>::type>::call(
+            preparedCall(slot, name), params);
+    }
+};
+
+}
+
+/**
+ * Declare a method of a JsonRpcProxy subclass, forwarding to the method
+ * \p name of the service class.
+ */
+#define JCON_PROXY_METHOD(name)                                              \
+    template<typename... Args>                                               \
+    auto name(Args&&... args)                                                \
+    {                                                                        \
+        static const int slot = allocateMethodSlot();                        \
+        return this->invoke(                                                 \
+            slot, #name,                                                     \
+            static_cast<decltype(&ServiceType::name)>(nullptr),              \
+            std::forward<Args>(args)...);                                    \
+    }
+
+#endif
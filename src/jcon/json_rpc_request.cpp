@@ -2,12 +2,9 @@
 
 namespace jcon {
 
-JsonRpcRequest::JsonRpcRequest(QObject* parent,
-                               QString id,
-                               QDateTime timestamp)
+JsonRpcRequest::JsonRpcRequest(QObject* parent, Id id)
     : QObject(parent)
     , m_id(id)
-    , m_timestamp(timestamp)
 {
 }
 
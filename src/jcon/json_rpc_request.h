@@ -3,7 +3,6 @@
 
 #include "jcon.h"
 
-#include <QDateTime>
 #include <QObject>
 
 namespace std {
@@ -18,18 +17,19 @@ class JCON_API JsonRpcRequest : public QObject
     Q_OBJECT
 
 public:
-    JsonRpcRequest(QObject* parent,
-                   QString id,
-                   QDateTime timestamp = QDateTime::currentDateTime());
+    typedef qint64 Id;
+
+    JsonRpcRequest(QObject* parent, Id id);
     virtual ~JsonRpcRequest();
 
+    Id id() const { return m_id; }
+
 signals:
     void result(const QVariant& result);
     void error(int code, const QString& message, const QVariant& data);
 
 private:
-    QString m_id;
-    QDateTime m_timestamp;
+    Id m_id;
 };
 
 typedef std::shared_ptr<JsonRpcRequest> JsonRpcRequestPtr;
@@ -27,6 +27,35 @@ namespace jcon {
   inline QVariant valueToJson<QVariant>(const QVariant& v) {
     return v;
   }
+
+  /// Convert a value decoded from JSON to \p T. Returns false if the value
+  /// cannot be converted.
+  template <typename T>
+  inline bool valueFromJson(const QVariant& value, T& x) {
+    const int type = qMetaTypeId<T>();
+    QVariant copy(value);
+
+    if (copy.userType() != type) {
+      if (copy.canConvert(type)) {
+        if (!copy.convert(type))
+          return false;
+      } else if (copy.canConvert(qMetaTypeId<TransientMap>())) {
+        if (!copy.convert(qMetaTypeId<TransientMap>()) || !copy.convert(type))
+          return false;
+      } else {
+        return false;
+      }
+    }
+
+    x = copy.value<T>();
+    return true;
+  }
+
+  template <>
+  inline bool valueFromJson<QVariant>(const QVariant& value, QVariant& x) {
+    x = value;
+    return true;
+  }
 }
 
 #endif // JSON_RPC_SERIALIZATION_H
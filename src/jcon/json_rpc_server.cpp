@@ -1,9 +1,11 @@
 #include "json_rpc_server.h"
+#include "json_rpc_async_logger.h"
 #include "json_rpc_endpoint.h"
 #include "json_rpc_error.h"
-#include "json_rpc_file_logger.h"
+#include "json_rpc_signal_filter.h"
 #include "jcon_assert.h"
 
+#include <QElapsedTimer>
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
@@ -13,14 +15,14 @@
 
 namespace jcon {
 
-const QString JsonRpcServer::InvalidRequestId = QStringLiteral("");
-
 JsonRpcServer::JsonRpcServer(QObject* parent, JsonRpcLoggerPtr logger)
     : QObject(parent)
     , m_logger(logger)
+    , m_metrics(true)
+    , m_trace_untraced_requests(false)
 {
     if (!m_logger) {
-        m_logger = std::make_shared<JsonRpcFileLogger>("server_log.txt");
+        m_logger = JsonRpcAsyncLogger::shared("server_log.txt");
     }
 }
 
@@ -58,14 +60,198 @@ void JsonRpcServer::registerService(QObject* service, const QString& domain)
   m_services.insert({domain, service});
 }
 
+void JsonRpcServer::setOutboundLimits(const JsonRpcEndpoint::OutboundLimits& limits)
+{
+    m_outbound_limits = limits;
+
+    for (const auto& endpoint : clientEndpoints())
+        endpoint->setOutboundLimits(limits);
+}
+
+QList<JsonRpcEndpoint::Statistics> JsonRpcServer::clientStatistics() const
+{
+    QList<JsonRpcEndpoint::Statistics> statistics;
+    for (const auto& endpoint : clientEndpoints())
+        statistics.append(endpoint->statistics());
+    return statistics;
+}
+
+JsonRpcEndpointPtr JsonRpcServer::addClient(const JsonRpcSocketPtr& socket)
+{
+    auto endpoint = std::make_shared<JsonRpcEndpoint>(socket, log(), this);
+    endpoint->setOutboundLimits(outboundLimits());
+    if (m_capture)
+        endpoint->setCapture(m_capture);
+
+    JsonRpcEndpoint* const raw_endpoint = endpoint.get();
+    connect(endpoint.get(), &JsonRpcEndpoint::socketDisconnected,
+            this, [this, raw_endpoint]() {
+                clientDisconnected(raw_endpoint);
+            });
+
+    connect(endpoint.get(), &JsonRpcEndpoint::socketError,
+            this, &JsonRpcServer::socketError);
+
+    connect(endpoint.get(), &JsonRpcEndpoint::jsonObjectReceived,
+            this, &JsonRpcServer::jsonRequestReceived);
+    connect(endpoint.get(), &JsonRpcEndpoint::jsonArrayReceived,
+            this, &JsonRpcServer::jsonBatchReceived);
+
+    m_client_endpoints.insert(raw_endpoint, endpoint);
+    return endpoint;
+}
+
+void JsonRpcServer::clientDisconnected(JsonRpcEndpoint* endpoint)
+{
+    auto it = m_client_endpoints.find(endpoint);
+    JCON_ASSERT(it != m_client_endpoints.end());
+    if (it == m_client_endpoints.end()) {
+        logError("unknown client disconnected");
+        return;
+    }
+
+    if (m_logger->isEnabled(JsonRpcLogger::LL_Info))
+        logInfo("client disconnected: " + endpoint->peerAddress().toString());
+
+    // Subscriptions are removed when the endpoint is destroyed, see
+    // handleDestroyedEndpoint.
+    m_client_endpoints.erase(it);
+}
+
+std::vector<JsonRpcEndpointPtr> JsonRpcServer::clientEndpoints() const
+{
+    std::vector<JsonRpcEndpointPtr> endpoints;
+    endpoints.reserve(m_client_endpoints.size());
+    for (const auto& endpoint : m_client_endpoints)
+        endpoints.push_back(endpoint);
+    return endpoints;
+}
+
 void JsonRpcServer::jsonRequestReceived(const QJsonObject& request,
-                                        QObject* socket)
+                                        JsonRpcEndpoint* client)
+{
+    // The endpoint emitting the request is owned by a shared pointer, which
+    // can be recovered without looking it up.
+    auto endpoint = client->shared_from_this();
+
+    RequestMetrics metrics;
+    metrics.phases[JsonRpcMethodMetrics::PH_Decode] = client->lastDecodeTime();
+
+    QJsonDocument response = processRequest(request, endpoint, metrics);
+    if (!response.isNull()) {
+        QElapsedTimer timer;
+        timer.start();
+        const QByteArray bytes = response.toJson(QJsonDocument::Compact);
+        metrics.phases[JsonRpcMethodMetrics::PH_Encode] += timer.nsecsElapsed();
+
+        timer.restart();
+        endpoint->send(bytes);
+        metrics.phases[JsonRpcMethodMetrics::PH_Write] = timer.nsecsElapsed();
+    }
+
+    recordRequest(metrics);
+}
+
+void JsonRpcServer::jsonBatchReceived(const QJsonArray& batch,
+                                      JsonRpcEndpoint* client)
+{
+    auto endpoint = client->shared_from_this();
+
+    if (batch.isEmpty()) {
+        logError("empty batch");
+        endpoint->send(createErrorResponse(QJsonValue::Null,
+                                           JsonRpcError::EC_InvalidRequest,
+                                           "empty batch"));
+        return;
+    }
+
+    // The responses are sent together, in one array. Notifications don't
+    // add a response, and a batch of notifications gets no reply at all.
+    std::vector<RequestMetrics> metrics(batch.size());
+    QJsonArray responses;
+    for (int i = 0; i < batch.size(); ++i) {
+        const QJsonValue request = batch.at(i);
+        QJsonDocument response;
+        if (request.isObject()) {
+            response = processRequest(request.toObject(), endpoint, metrics[i]);
+        } else {
+            logError("invalid request in batch");
+            response = createErrorResponse(QJsonValue::Null,
+                                           JsonRpcError::EC_InvalidRequest,
+                                           "request is not an object");
+        }
+
+        if (!response.isNull())
+            responses.append(response.object());
+    }
+
+    // Parsing, serializing and writing are done for the whole batch, so
+    // their cost is shared equally by its requests.
+    qint64 encode_nsecs = 0;
+    qint64 write_nsecs = 0;
+    if (!responses.isEmpty()) {
+        QElapsedTimer timer;
+        timer.start();
+        const QByteArray bytes = QJsonDocument(responses).toJson(
+            QJsonDocument::Compact);
+        encode_nsecs = timer.nsecsElapsed();
+
+        timer.restart();
+        endpoint->send(bytes);
+        write_nsecs = timer.nsecsElapsed();
+    }
+
+    const qint64 count = batch.size();
+    for (auto& request_metrics : metrics) {
+        request_metrics.phases[JsonRpcMethodMetrics::PH_Decode] =
+            client->lastDecodeTime() / count;
+        request_metrics.phases[JsonRpcMethodMetrics::PH_Encode] +=
+            encode_nsecs / count;
+        request_metrics.phases[JsonRpcMethodMetrics::PH_Write] =
+            write_nsecs / count;
+        recordRequest(request_metrics);
+    }
+}
+
+QJsonDocument JsonRpcServer::processRequest(const QJsonObject& request,
+                                            const JsonRpcEndpointPtr& endpoint,
+                                            RequestMetrics& metrics)
+{
+    if (m_request_interceptors.empty() && m_response_interceptors.empty())
+        return executeRequest(request, endpoint, metrics);
+
+    // The copy shares its data with the request until an interceptor
+    // modifies it.
+    QJsonObject intercepted(request);
+    QJsonDocument response;
+
+    bool dispatch = true;
+    for (const auto& interceptor : m_request_interceptors) {
+        if (!interceptor(intercepted, endpoint.get(), response)) {
+            dispatch = false;
+            break;
+        }
+    }
+
+    if (dispatch)
+        response = executeRequest(intercepted, endpoint, metrics);
+
+    if (!response.isNull()) {
+        for (const auto& interceptor : m_response_interceptors)
+            interceptor(intercepted, endpoint.get(), response);
+    }
+    return response;
+}
+
+QJsonDocument JsonRpcServer::executeRequest(const QJsonObject& request,
+                                            const JsonRpcEndpointPtr& endpoint,
+                                            RequestMetrics& metrics)
 {
     JCON_ASSERT(request.value("jsonrpc").toString() == "2.0");
 
     if (request.value("jsonrpc").toString() != "2.0") {
         logError("invalid protocol tag");
-        return;
+        return QJsonDocument();
     }
 
     QString method_name = request.value("method").toString();
@@ -75,63 +261,148 @@ void JsonRpcServer::jsonRequestReceived(const QJsonObject& request,
 
     QVariant params = request.value("params").toVariant();
 
-    QString request_id = request.value("id").toString(InvalidRequestId);
-
-    auto endpoint = findClient(socket);
-
-    if (!endpoint) {
-        logError("invalid client socket, cannot send response");
-        return;
+    // The ID is echoed back as it is. Requests without ID are notifications,
+    // which don't get a response.
+    const QJsonValue request_id = request.value("id");
+
+    // The request continues the trace of the client if it was sampled
+    // there. Only requests of clients that don't trace are sampled here.
+    JsonRpcTracer::Span span;
+    JsonRpcTracer::Span handler_span;
+    if (m_tracer) {
+        const QJsonValue trace = request.value("trace");
+        if (!trace.isUndefined()) {
+            const auto context = JsonRpcTracer::Context::fromJson(trace);
+            if (context.isValid())
+                span = m_tracer->startSpan(method_name, context);
+        } else if (m_trace_untraced_requests) {
+            span = m_tracer->startSpan(method_name);
+        }
+        if (span.isRecording())
+            handler_span = m_tracer->startSpan(method_name, span.context);
     }
 
+    QJsonDocument response;
+    QElapsedTimer timer;
+    timer.start();
+
     try {
 
       QVariant return_value;
-      if (!dispatch(endpoint, method_name, params, request_id, return_value)) {
+      const bool found = dispatch(endpoint, method_name, params, request_id,
+                                  return_value);
+
+      metrics.phases[JsonRpcMethodMetrics::PH_Dispatch] = timer.nsecsElapsed();
+      timer.restart();
+
+      if (handler_span.isRecording()) {
+          m_tracer->endSpan(handler_span, "handler",
+                            JsonRpcTracer::SK_Internal, !found);
+      }
+
+      // Requests of methods that don't exist are counted together, so that
+      // clients can't add metrics without bound.
+      metrics.method = &methodMetrics(
+          found ? method_name : QStringLiteral("(unknown)"));
+
+      if (!found) {
+          metrics.error = true;
+
           auto msg = QString("method '%1' not found, check name and "
                              "parameter types ").arg(method_name);
           logError(msg);
 
           // send error response if request had valid ID
-          if (request_id != InvalidRequestId) {
-              QJsonDocument error =
-                  createErrorResponse(request_id,
-                                      JsonRpcError::EC_MethodNotFound,
-                                      msg);
-              endpoint->send(error);
+          if (!request_id.isUndefined()) {
+              response = createErrorResponse(request_id,
+                                             JsonRpcError::EC_MethodNotFound,
+                                             msg);
           }
       } else {
           // send response if request had valid ID
-          if (request_id != InvalidRequestId) {
-              QJsonDocument response = createResponse(request_id,
-                                                      return_value,
-                                                      method_name);
-              endpoint->send(response);
+          if (!request_id.isUndefined()) {
+              response = createResponse(request_id, return_value, method_name);
           }
       }
     } catch (const std::exception& e) {
+      metrics.phases[JsonRpcMethodMetrics::PH_Dispatch] = timer.nsecsElapsed();
+      timer.restart();
+      metrics.method = &methodMetrics(method_name);
+      metrics.error = true;
+
+      if (handler_span.isRecording()) {
+          m_tracer->endSpan(handler_span, "handler",
+                            JsonRpcTracer::SK_Internal, true);
+      }
+
       auto msg = QString("An exception occured. Message was: '%1'").arg(e.what());
       logError(msg);
 
-      if (request_id != InvalidRequestId) {
-          QJsonDocument error =
-              createErrorResponse(request_id,
-                                  JsonRpcError::EC_InternalError,
-                                  msg);
-          endpoint->send(error);
+      if (!request_id.isUndefined()) {
+          response = createErrorResponse(request_id,
+                                         JsonRpcError::EC_InternalError,
+                                         msg);
       }
     }
+
+    metrics.phases[JsonRpcMethodMetrics::PH_Encode] = timer.nsecsElapsed();
+
+    if (span.isRecording()) {
+        m_tracer->endSpan(span, "dispatch", JsonRpcTracer::SK_Server,
+                          metrics.error);
+    }
+    return response;
+}
+
+void JsonRpcServer::addRequestInterceptor(RequestInterceptor interceptor)
+{
+    m_request_interceptors.push_back(std::move(interceptor));
+}
+
+void JsonRpcServer::addResponseInterceptor(ResponseInterceptor interceptor)
+{
+    m_response_interceptors.push_back(std::move(interceptor));
+}
+
+JsonRpcMethodMetrics& JsonRpcServer::methodMetrics(const QString& method)
+{
+    auto it = m_method_metrics.find(method);
+    if (it == m_method_metrics.end())
+        it = m_method_metrics.insert(method, &m_metrics.method(method));
+    return **it;
+}
+
+void JsonRpcServer::recordRequest(const RequestMetrics& metrics)
+{
+    if (!metrics.method)
+        return;
+
+    // Requests are handled synchronously, so they are only in flight while
+    // they are recorded; "rpc.metrics" doesn't report them.
+    qint64 total = 0;
+    metrics.method->callStarted();
+    for (int i = 0; i < JsonRpcMethodMetrics::PhaseCount; ++i) {
+        metrics.method->recordPhase(static_cast<JsonRpcMethodMetrics::Phase>(i),
+                                    static_cast<quint64>(metrics.phases[i]));
+        total += metrics.phases[i];
+    }
+    metrics.method->callFinished(metrics.error, static_cast<quint64>(total));
 }
 
 
 
 bool JsonRpcServer::dispatch(JsonRpcEndpointPtr endpoint, const QString& complete_method_name,
                              const QVariant& params,
-                             const QString& request_id,
+                             const QJsonValue& request_id,
                              QVariant& return_value) {
 
       Q_UNUSED(request_id)
 
+      if (complete_method_name == "rpc.metrics") {
+          return_value = m_metrics.toVariantMap();
+          return true;
+      }
+
       const auto parts = complete_method_name.split('/');
 
       if (parts.size() > 2)
@@ -153,6 +424,21 @@ bool JsonRpcServer::dispatch(JsonRpcEndpointPtr endpoint, const QString& complet
           return true;
       }
 
+      if (method_name == "registerSignalHandlers") {
+          return_value = registerSignals(endpoint, service, params);
+          return true;
+      }
+
+      if (method_name == "unregisterSignalHandler") {
+          return_value = unregisterSignal(endpoint, service, params);
+          return true;
+      }
+
+      if (method_name == "unregisterSignalHandlers") {
+          return_value = unregisterSignals(endpoint, service, params);
+          return true;
+      }
+
 
       const QMetaObject* meta_obj = service->metaObject();
       for (int i = 0; i < meta_obj->methodCount(); ++i) {
@@ -183,13 +469,8 @@ bool JsonRpcServer::dispatch(JsonRpcEndpointPtr endpoint, const QString& complet
 }
 
 QVariant JsonRpcServer::registerSignal(JsonRpcEndpointPtr endpoint, JsonRpcServer::UniversalPointer service, const QVariant& params) {
-  const auto& metaObject = service->metaObject();
-
   QString signalNameToLookFor;
-
-  QVariantMap result;
-  result.insert("resultCode", true);
-  result.insert("resultText", "Success!");
+  QVariantMap filterSpec;
 
   if (params.type() == QVariant::List || params.type() == QVariant::StringList) {
     const auto list = params.toList();
@@ -198,164 +479,339 @@ QVariant JsonRpcServer::registerSignal(JsonRpcEndpointPtr endpoint, JsonRpcServe
       return signalResultObject(false, "No signal name given.");
 
     signalNameToLookFor = list.first().toString();
+    if (list.size() > 1)
+      filterSpec = list.at(1).toMap();
   } else if (params.type() == QVariant::Map) {
     const auto map = params.toMap();
 
     if (map.isEmpty())
       return signalResultObject(false, "No signal name given.");
 
-    signalNameToLookFor = (*map.constBegin()).toString();
+    if (map.contains("signal")) {
+      signalNameToLookFor = map.value("signal").toString();
+      filterSpec = map.value("filter").toMap();
+    } else {
+      signalNameToLookFor = (*map.constBegin()).toString();
+    }
   }
 
   if (signalNameToLookFor.isEmpty())
     return signalResultObject(false, "The parameter list is empty. No signal name given.");
 
-  for (int currentMethodIndex = 0; currentMethodIndex < metaObject->methodCount(); currentMethodIndex++) {
-    const auto& currentMethod = metaObject->method(currentMethodIndex);
+  return subscribe(endpoint, service.get(), signalNameToLookFor, filterSpec);
+}
 
-    if (currentMethod.methodType() != QMetaMethod::Signal)
-      continue;
+QVariant JsonRpcServer::unregisterSignal(JsonRpcEndpointPtr endpoint, JsonRpcServer::UniversalPointer service, const QVariant& params) {
+  QString signature;
+  QVariantMap filterSpec;
 
-    if (currentMethod.methodSignature() != signalNameToLookFor)
-      continue;
+  const auto list = params.toList();
+  if (list.isEmpty() || !parseSignalEntry(list.first(), signature, filterSpec))
+    return signalResultObject(false, "No signal name given.");
 
-    qDebug() << QString("Found signal %1 in service %2. Registering now if not already done...")
-                .arg(signalNameToLookFor, service->objectName());
+  return unsubscribe(endpoint, service.get(), signature);
+}
 
-    bool signalSpyFound = false;
+QVariant JsonRpcServer::registerSignals(JsonRpcEndpointPtr endpoint, JsonRpcServer::UniversalPointer service, const QVariant& params) {
+  QVariantList results;
 
-    for (auto element : m_signalspies) {
-      int registeredMethodIndex;
-      std::shared_ptr<QSignalSpy>  registeredSignalSpy;
-      QObject* registeredService;
-      std::tie(registeredService, registeredMethodIndex, std::ignore, registeredSignalSpy) = element;
+  for (const auto& entry : params.toList()) {
+    QString signature;
+    QVariantMap filterSpec;
 
-      if (service.get() == registeredService && registeredMethodIndex == currentMethodIndex) {
-        signalSpyFound = true;
-        m_signalspies.push_back(std::make_tuple(service.get(), currentMethodIndex, JsonRpcEndpoint::WeakPtr(endpoint), registeredSignalSpy));
-        break;
-      }
-    }
+    QVariantMap result;
+    if (parseSignalEntry(entry, signature, filterSpec))
+      result = subscribe(endpoint, service.get(), signature, filterSpec);
+    else
+      result = signalResultObject(false, "No signal name given.").toMap();
+
+    result.insert("signal", signature);
+    results.append(result);
+  }
+
+  return results;
+}
+
+QVariant JsonRpcServer::unregisterSignals(JsonRpcEndpointPtr endpoint, JsonRpcServer::UniversalPointer service, const QVariant& params) {
+  QVariantList results;
+
+  for (const auto& entry : params.toList()) {
+    QString signature;
+    QVariantMap filterSpec;
+
+    QVariantMap result;
+    if (parseSignalEntry(entry, signature, filterSpec))
+      result = unsubscribe(endpoint, service.get(), signature);
+    else
+      result = signalResultObject(false, "No signal name given.").toMap();
+
+    result.insert("signal", signature);
+    results.append(result);
+  }
+
+  return results;
+}
 
-    if (!signalSpyFound) {
-      const auto signalName = QByteArray("2").append(currentMethod.methodSignature());
-      auto signalSpy = std::make_shared<QSignalSpy>(service.get(), signalName.constData());
-      signalSpy->setParent(this);
-      QObject::connect(service.get(), signalName, this, SLOT(serviceSignalEmitted()));
-      m_signalspies.push_back(std::make_tuple(service.get(), currentMethodIndex, JsonRpcEndpoint::WeakPtr(endpoint), signalSpy));
+bool JsonRpcServer::parseSignalEntry(const QVariant& entry, QString& signature, QVariantMap& filterSpec) {
+  if (entry.type() == QVariant::Map) {
+    const auto map = entry.toMap();
+    signature = map.value("signal").toString();
+    filterSpec = map.value("filter").toMap();
+  } else {
+    signature = entry.toString();
+    filterSpec.clear();
+  }
+  return !signature.isEmpty();
+}
+
+bool JsonRpcServer::setConflationKey(QObject* service, const QString& signature,
+                                     const QStringList& parameters) {
+  const int index = signalIndex(service->metaObject(), signature);
+  if (index == -1)
+    return false;
+
+  const auto names = service->metaObject()->method(index).parameterNames();
+  QVector<int> indices;
+  for (const auto& parameter : parameters) {
+    const int parameterIndex = names.indexOf(parameter.toUtf8());
+    if (parameterIndex == -1)
+      return false;
+    indices.append(parameterIndex);
+  }
+
+  m_conflation_parameters.insert(SignalKey(service, index), indices);
+  return true;
+}
+
+QString JsonRpcServer::conflationKey(const SignalKey& key, const QString& name,
+                                     const QList<QVariant>& parameters,
+                                     const QByteArray& notification) const {
+  auto indices = m_conflation_parameters.constFind(key);
+
+  // Identical notifications can always replace each other.
+  if (indices == m_conflation_parameters.constEnd())
+    return QString::fromUtf8(notification);
+
+  QJsonArray values;
+  for (int index : *indices)
+    values.append(QJsonValue::fromVariant(parameters.value(index)));
+  return name + QString::fromUtf8(QJsonDocument(values).toJson(QJsonDocument::Compact));
+}
+
+int JsonRpcServer::signalIndex(const QMetaObject* metaObject, const QString& signature) {
+  auto indices = m_signal_indices.find(metaObject);
+
+  if (indices == m_signal_indices.end()) {
+    QHash<QByteArray, int> signalIndices;
+    for (int i = 0; i < metaObject->methodCount(); ++i) {
+      const auto method = metaObject->method(i);
+      if (method.methodType() == QMetaMethod::Signal)
+        signalIndices.insert(method.methodSignature(), i);
     }
+    indices = m_signal_indices.insert(metaObject, signalIndices);
+  }
+
+  const QByteArray utf8Signature = signature.toUtf8();
+  auto it = indices->constFind(utf8Signature);
+
+  if (it == indices->constEnd())
+    it = indices->constFind(QMetaObject::normalizedSignature(utf8Signature.constData()));
+
+  return it != indices->constEnd() ? it.value() : -1;
+}
+
+QVariantMap JsonRpcServer::subscribe(const JsonRpcEndpointPtr& endpoint, QObject* service,
+                                     const QString& signature, const QVariantMap& filterSpec) {
+  const int index = signalIndex(service->metaObject(), signature);
+
+  if (index == -1)
+    return signalResultObject(false, "Signal not found.").toMap();
+
+  const auto currentMethod = service->metaObject()->method(index);
+
+  JsonRpcSignalFilter filter;
+  QString filterError;
+  if (!JsonRpcSignalFilter::compile(currentMethod, filterSpec, filter, filterError))
+    return signalResultObject(false, "Invalid signal filter: " + filterError).toMap();
 
-    QObject::connect(endpoint.get(), &QObject::destroyed, this, &JsonRpcServer::handleDestroyedEndpoint);
+  const SignalKey key(service, index);
+  auto spied = m_spied_signals.find(key);
 
-    return signalResultObject(true, "Signal found and registered.");
+  if (spied == m_spied_signals.end()) {
+    const auto signalName = QByteArray("2").append(currentMethod.methodSignature());
+    SpiedSignal spiedSignal;
+    spiedSignal.spy = std::make_shared<QSignalSpy>(service, signalName.constData());
+    QObject::connect(service, signalName, this, SLOT(serviceSignalEmitted()));
+    spied = m_spied_signals.insert(key, spiedSignal);
   }
 
-  return signalResultObject(false, "Signal not found.");
+  // A repeated registration only replaces the endpoint's filter.
+  if (!spied->subscribers.contains(endpoint.get())) {
+    auto& endpointSubscriptions = m_endpoint_subscriptions[endpoint.get()];
+    if (endpointSubscriptions.isEmpty())
+      QObject::connect(endpoint.get(), &QObject::destroyed, this, &JsonRpcServer::handleDestroyedEndpoint);
+    endpointSubscriptions.append(key);
+  }
+
+  spied->subscribers.insert(endpoint.get(), SignalSubscription { endpoint, filter });
+
+  return signalResultObject(true, "Signal found and registered.").toMap();
 }
 
-void JsonRpcServer::handleDestroyedEndpoint() {
+QVariantMap JsonRpcServer::unsubscribe(const JsonRpcEndpointPtr& endpoint, QObject* service,
+                                       const QString& signature) {
+  const int index = signalIndex(service->metaObject(), signature);
 
-  auto it = m_signalspies.begin();
-  while (it != m_signalspies.end()) {
-    const auto currentEndpoint = std::get<2>(*it);
+  if (index == -1)
+    return signalResultObject(false, "Signal not found.").toMap();
 
-    if (currentEndpoint.expired()) {
-      const auto currentSpy = std::get<3>(*it);      
-      if (currentSpy.use_count() == 2) {
-        // We have to check for use count == 2, since there a two shared pointers left,
-        // one in m_signalspies and one here in currentSpy.
-        auto sender = std::get<0>(*it);
-        const auto signalIndex = std::get<1>(*it);
-        const auto signature = "2" + sender->metaObject()->method(signalIndex).methodSignature();
-        QObject::disconnect(sender, signature, this, SLOT(serviceSignalEmitted()));
-      }
-      it = m_signalspies.erase(it);
-    } else {
-      ++it;
+  const SignalKey key(service, index);
+  auto spied = m_spied_signals.constFind(key);
+
+  if (spied == m_spied_signals.constEnd() || !spied->subscribers.contains(endpoint.get()))
+    return signalResultObject(false, "Signal not registered.").toMap();
+
+  removeSubscription(key, endpoint.get());
+
+  auto endpointSubscriptions = m_endpoint_subscriptions.find(endpoint.get());
+  if (endpointSubscriptions != m_endpoint_subscriptions.end()) {
+    endpointSubscriptions->removeOne(key);
+    if (endpointSubscriptions->isEmpty()) {
+      m_endpoint_subscriptions.erase(endpointSubscriptions);
+      QObject::disconnect(endpoint.get(), &QObject::destroyed, this, &JsonRpcServer::handleDestroyedEndpoint);
     }
   }
 
+  return signalResultObject(true, "Signal unregistered.").toMap();
+}
+
+void JsonRpcServer::removeSubscription(const SignalKey& key, JsonRpcEndpoint* endpoint) {
+  auto spied = m_spied_signals.find(key);
+  if (spied == m_spied_signals.end())
+    return;
+
+  spied->subscribers.remove(endpoint);
+
+  if (spied->subscribers.isEmpty()) {
+    QObject* sender = key.first;
+    const auto signature = "2" + sender->metaObject()->method(key.second).methodSignature();
+    QObject::disconnect(sender, signature, this, SLOT(serviceSignalEmitted()));
+    m_spied_signals.erase(spied);
+  }
+}
+
+void JsonRpcServer::handleDestroyedEndpoint(QObject* object) {
+  // The endpoint is already destroyed, the pointer is only used as a key.
+  auto endpoint = static_cast<JsonRpcEndpoint*>(object);
+
+  auto it = m_endpoint_subscriptions.find(endpoint);
+  if (it == m_endpoint_subscriptions.end())
+    return;
+
+  for (const auto& key : it.value())
+    removeSubscription(key, endpoint);
+
+  m_endpoint_subscriptions.erase(it);
 }
 
 void JsonRpcServer::serviceSignalEmitted() {
   if (sender() == nullptr)
     return;
 
-  const auto signal = sender()->metaObject()->method(senderSignalIndex());
-  QJsonDocument notificationDocument;
+  QObject* const emitter = sender();
+  const int signalIndex = senderSignalIndex();
+
+  auto spied = m_spied_signals.constFind(SignalKey(emitter, signalIndex));
+
+  if (spied == m_spied_signals.constEnd() || spied->spy->isEmpty()) {
+    qDebug() << "Slot triggered, but no signal spyed.";
+    return;
+  }
+
+  // The spy has to be drained for every emission, even if no subscriber's
+  // filter matches it.
+  const auto parameters = spied->spy->takeFirst();
+  QByteArray notification;
+  QString notificationName;
+  QString key;
 
-  for (auto element : m_signalspies) {
-    int currentSignalIndex;
-    QObject* currentSender;
-    std::shared_ptr<QSignalSpy> currentSignalSpy;
-    JsonRpcEndpoint::WeakPtr currentEndpoint;
-    std::tie(currentSender, currentSignalIndex, currentEndpoint, currentSignalSpy) = element;
+  for (const auto& subscription : spied->subscribers) {
+    JsonRpcEndpointPtr currentEndpointAccess = subscription.endpoint.lock();
 
-    if (currentEndpoint.expired()) {
+    if (!currentEndpointAccess) {
       qDebug() << "There is an non existing endpoint in signal spy list. Probably a programming error...";
       continue;
     }
 
-    JsonRpcEndpointPtr currentEndpointAccess(currentEndpoint);
-
-    if (sender() == currentSender && senderSignalIndex() == currentSignalIndex) {
-      if (notificationDocument.isNull()) {
-        const auto parameters = currentSignalSpy->takeFirst();
+    // Emissions not matching the subscriber's filter are never encoded.
+    if (!subscription.filter.matches(parameters))
+      continue;
 
-        QJsonArray paramArray;
-        for (int i = 0; i < parameters.count(); i++) {
-          const auto& parameter = parameters.at(i);
-          const auto parameterName = signal.parameterNames().at(i);
-          const auto parameterType = signal.parameterTypes().at(i);
+    if (notification.isNull()) {
+      // Encode once and share the bytes between all subscribers.
+      notification = createNotification(emitter, emitter->metaObject()->method(signalIndex), parameters,
+                                        notificationName);
 
-          try {
-            paramArray.append(convertValue(parameter));
+      if (notification.isNull())
+        return;
 
-          } catch (const std::invalid_argument&) {
-            qDebug() << QString("Could not encode parameter %1 of type %2 to a json representation. Cannot send signal...")
-                        .arg(QString::fromUtf8(parameterName), QString::fromUtf8(parameterType));
-            return;
-          }
-        }
+      // Notifications about different things, e.g. different devices, must
+      // not replace each other.
+      if (m_outbound_limits.policy == JsonRpcEndpoint::OP_Conflate)
+        key = conflationKey(SignalKey(emitter, signalIndex), notificationName, parameters, notification);
 
-        QString name;
+      qDebug() << "Sending RPC notification for signal" << spied->spy->signal();
+    }
 
-        for(auto pair : m_services) {
-          if (sender() == pair.second.get()) {
-            name = pair.first;
-            break;
-          }
-        }
+    currentEndpointAccess->sendNotification(notification, key);
+  }
+}
 
-        if (!name.isEmpty()) {
-          name.append("/");
-          name.append(signal.name().constData());
-        } else {
-          name = QString(signal.name().constData());
-        }
+QByteArray JsonRpcServer::createNotification(QObject* service, const QMetaMethod& signal, const QList<QVariant>& parameters,
+                                             QString& name) {
+  QJsonArray paramArray;
+  for (int i = 0; i < parameters.count(); i++) {
+    const auto& parameter = parameters.at(i);
+    const auto parameterName = signal.parameterNames().at(i);
+    const auto parameterType = signal.parameterTypes().at(i);
 
-        QJsonObject notificationObject {
-          { "jsonrpc", "2.0" },
-          { "method", std::move(name) },
-          { "params", std::move(paramArray) }
-        };
+    try {
+      paramArray.append(convertValue(parameter));
 
-        notificationDocument = QJsonDocument(notificationObject);
-        qDebug() << "Sending RPC notification for signal" << currentSignalSpy->signal();
-      }
+    } catch (const std::invalid_argument&) {
+      qDebug() << QString("Could not encode parameter %1 of type %2 to a json representation. Cannot send signal...")
+                  .arg(QString::fromUtf8(parameterName), QString::fromUtf8(parameterType));
+      return QByteArray();
+    }
+  }
 
+  name.clear();
 
-      currentEndpointAccess->send(notificationDocument);
+  for(auto pair : m_services) {
+    if (service == pair.second.get()) {
+      name = pair.first;
+      break;
     }
   }
 
-  if (notificationDocument.isNull()) {
-    qDebug() << "Slot triggered, but no signal spyed.";
+  if (!name.isEmpty()) {
+    name.append("/");
+    name.append(signal.name().constData());
+  } else {
+    name = QString(signal.name().constData());
   }
+
+  QJsonObject notificationObject {
+    { "jsonrpc", "2.0" },
+    { "method", name },
+    { "params", std::move(paramArray) }
+  };
+
+  return QJsonDocument(notificationObject).toJson(QJsonDocument::Compact);
 }
 
 
-QJsonDocument JsonRpcServer::createResponse(const QString& request_id,
+QJsonDocument JsonRpcServer::createResponse(const QJsonValue& request_id,
                                             const QVariant& return_value,
                                             const QString& method_name)
 {
@@ -382,7 +838,7 @@ QJsonDocument JsonRpcServer::createResponse(const QString& request_id,
     }
 }
 
-QJsonDocument JsonRpcServer::createErrorResponse(const QString& request_id,
+QJsonDocument JsonRpcServer::createErrorResponse(const QJsonValue& request_id,
                                                  int code,
                                                  const QString& message)
 {
@@ -401,12 +857,12 @@ QJsonDocument JsonRpcServer::createErrorResponse(const QString& request_id,
 
 void JsonRpcServer::logInfo(const QString& msg)
 {
-    m_logger->logInfo("JSON RPC server: " + msg);
+    JCON_LOG_INFO(m_logger, "JSON RPC server: " + msg);
 }
 
 void JsonRpcServer::logError(const QString& msg)
 {
-  m_logger->logError("JSON RPC server error: " + msg);
+  JCON_LOG_ERROR(m_logger, "JSON RPC server error: " + msg);
 }
 
 
@@ -3,14 +3,26 @@
 
 #include "jcon.h"
 #include "json_rpc_logger.h"
+#include "json_rpc_metrics.h"
+#include "json_rpc_tracer.h"
 
 #include <QAbstractSocket>
+#include <QHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QPair>
+#include <QStringList>
+#include <QVector>
 
+#include <functional>
 #include <memory>
+#include <vector>
 
 #include "json_rpc_endpoint.h"
 #include "json_rpc_common.h"
+#include "json_rpc_signal_filter.h"
 
+class QMetaMethod;
 class QSignalSpy;
 
 namespace jcon {
@@ -58,6 +70,22 @@ class JCON_API JsonRpcServer : public QObject, public JsonRpcCommon
   };
 
 public:
+    /**
+     * Called with every request before it is dispatched, e.g. to check
+     * credentials or to answer from a cache. The interceptor may modify the
+     * request. Returning false stops the request from being dispatched; it
+     * is then answered with \p response, or not at all if that is left null.
+     */
+    typedef std::function<bool(QJsonObject& request,
+                               JsonRpcEndpoint* endpoint,
+                               QJsonDocument& response)> RequestInterceptor;
+
+    /// Called with every response, and the request it answers, before it is
+    /// sent. The interceptor may modify the response.
+    typedef std::function<void(const QJsonObject& request,
+                               JsonRpcEndpoint* endpoint,
+                               QJsonDocument& response)> ResponseInterceptor;
+
     JsonRpcServer(QObject* parent = nullptr, JsonRpcLoggerPtr logger = nullptr);
     virtual ~JsonRpcServer();
 
@@ -67,50 +95,217 @@ public:
     virtual bool listen(int port) = 0;
     virtual void close() = 0;
 
-protected:
-    virtual JsonRpcEndpointPtr findClient(QObject* socket) = 0;
+    /**
+     * Set the limits for the outbound queue of client connections, which
+     * protect the server from clients that don't read fast enough.
+     */
+    void setOutboundLimits(const JsonRpcEndpoint::OutboundLimits& limits);
+    JsonRpcEndpoint::OutboundLimits outboundLimits() const {
+        return m_outbound_limits;
+    }
+
+    /// Outbound queue statistics of every client, to find slow consumers.
+    QList<JsonRpcEndpoint::Statistics> clientStatistics() const;
+
+    /**
+     * Calls, errors and latencies per method, with the time spent decoding,
+     * dispatching, encoding and writing. Clients can read them with the
+     * reserved method "rpc.metrics".
+     */
+    const JsonRpcMetrics& metrics() const { return m_metrics; }
+
+    /**
+     * Name the parameters of the signal \p signature of \p service that
+     * identify what its notifications are about, e.g. the ID of a device.
+     * With OP_Conflate, a queued notification is then replaced by a newer
+     * one with the same values of these parameters. Without a key, only
+     * notifications with identical parameters replace each other.
+     *
+     * @returns false if the signal or one of the parameters doesn't exist.
+     */
+    bool setConflationKey(QObject* service, const QString& signature,
+                          const QStringList& parameters);
+
+    /**
+     * Add an interceptor to the chain run for every request. Interceptors
+     * are called in the order they were added, and should be added before
+     * the server starts listening. A server without interceptors doesn't
+     * pay for them.
+     */
+    void addRequestInterceptor(RequestInterceptor interceptor);
+    void addResponseInterceptor(ResponseInterceptor interceptor);
+
+    /**
+     * Record dispatch and handler spans for requests that carry the trace
+     * context of a sampled client call. Calls the client didn't sample are
+     * not recorded.
+     */
+    void setTracer(const JsonRpcTracerPtr& tracer) { m_tracer = tracer; }
+    JsonRpcTracerPtr tracer() const { return m_tracer; }
+
+    /**
+     * Whether requests from clients that don't trace, i.e. requests without
+     * "trace" member, start traces of their own, as often as the tracer
+     * samples. Off by default.
+     */
+    void setTraceUntracedRequests(bool enabled)
+    {
+        m_trace_untraced_requests = enabled;
+    }
+
+    /**
+     * Record the messages of clients connecting from now on to \p capture,
+     * to replay them later with jcon_replay. A null capture stops recording
+     * for new clients.
+     */
+    void setCapture(const JsonRpcCapturePtr& capture) { m_capture = capture; }
 
 signals:
     /// Emitted when the RPC socket has an error.
     void socketError(QObject* socket, QAbstractSocket::SocketError error);
 
 public slots:
-    void jsonRequestReceived(const QJsonObject& request, QObject* socket);
+    void jsonRequestReceived(const QJsonObject& request,
+                             JsonRpcEndpoint* client);
+
+    /// Handle a batch of requests, and answer with an array of responses.
+    void jsonBatchReceived(const QJsonArray& batch,
+                           JsonRpcEndpoint* client);
 
 protected slots:
     virtual void newConnection() = 0;
-    virtual void clientDisconnected(QObject* client_socket) = 0;
     void serviceSignalEmitted();
-
+    void handleDestroyedEndpoint(QObject* endpoint);
 
 protected:
     void logInfo(const QString& msg);
     void logError(const QString& msg);
     JsonRpcLoggerPtr log() { return m_logger; }
 
+    /**
+     * Create an endpoint for a newly connected client socket. The server
+     * keeps the endpoint until the socket is disconnected.
+     */
+    JsonRpcEndpointPtr addClient(const JsonRpcSocketPtr& socket);
+    void clientDisconnected(JsonRpcEndpoint* endpoint);
+    std::vector<JsonRpcEndpointPtr> clientEndpoints() const;
+
     QVariant registerSignal(JsonRpcEndpointPtr endpoint, UniversalPointer service, const QVariant& params);
-    void handleDestroyedEndpoint();
+    QVariant unregisterSignal(JsonRpcEndpointPtr endpoint, UniversalPointer service, const QVariant& params);
+
+    /**
+     * Register or unregister several signals at once. The parameters are a
+     * list of signal signatures, or of {"signal": ..., "filter": ...} objects
+     * when registering. The result is a list with one result object per
+     * signal, in the same order.
+     */
+    QVariant registerSignals(JsonRpcEndpointPtr endpoint, UniversalPointer service, const QVariant& params);
+    QVariant unregisterSignals(JsonRpcEndpointPtr endpoint, UniversalPointer service, const QVariant& params);
+
     static inline QVariant signalResultObject(bool success, QString&& text) {
       return QVariantMap({{"resultCode", success}, {"resultText", text}}); }
 
 private:
-    static const QString InvalidRequestId;
+    struct SignalSubscription {
+        JsonRpcEndpoint::WeakPtr endpoint;
+        JsonRpcSignalFilter filter;
+    };
+
+    /// A spied service signal and the endpoints subscribed to it.
+    struct SpiedSignal {
+        std::shared_ptr<QSignalSpy> spy;
+        QHash<JsonRpcEndpoint*, SignalSubscription> subscribers;
+    };
+
+    /// Identifies a signal by service and signal index.
+    typedef QPair<QObject*, int> SignalKey;
+
+    QVariantMap subscribe(const JsonRpcEndpointPtr& endpoint, QObject* service,
+                          const QString& signature, const QVariantMap& filterSpec);
+    QVariantMap unsubscribe(const JsonRpcEndpointPtr& endpoint, QObject* service,
+                            const QString& signature);
+    void removeSubscription(const SignalKey& key, JsonRpcEndpoint* endpoint);
+
+    /// Key under which a notification of \p key replaces queued ones.
+    QString conflationKey(const SignalKey& key, const QString& name,
+                          const QList<QVariant>& parameters,
+                          const QByteArray& notification) const;
+
+    /// Index of the signal with the given signature, or -1 if there is none.
+    int signalIndex(const QMetaObject* metaObject, const QString& signature);
+
+    /// Read a signal signature and optional filter from a registration.
+    static bool parseSignalEntry(const QVariant& entry, QString& signature, QVariantMap& filterSpec);
+
+    /// Metrics of a request, recorded once it has been answered.
+    struct RequestMetrics {
+        JsonRpcMethodMetrics* method = nullptr;
+        bool error = false;
+
+        /// Time spent in each phase, in nanoseconds.
+        qint64 phases[JsonRpcMethodMetrics::PhaseCount] = {};
+    };
+
+    /// Handle a single request, passing it through the interceptors.
+    /// Returns a null document for notifications.
+    QJsonDocument processRequest(const QJsonObject& request,
+                                 const JsonRpcEndpointPtr& endpoint,
+                                 RequestMetrics& metrics);
+    QJsonDocument executeRequest(const QJsonObject& request,
+                                 const JsonRpcEndpointPtr& endpoint,
+                                 RequestMetrics& metrics);
+    void recordRequest(const RequestMetrics& metrics);
+
+    /// The metrics of \p method, from m_method_metrics if possible.
+    JsonRpcMethodMetrics& methodMetrics(const QString& method);
 
     bool dispatch(JsonRpcEndpointPtr endpoint, const QString& complete_method_name,
                   const QVariant& params,
-                  const QString& request_id,
+                  const QJsonValue& request_id,
                   QVariant& return_value);
 
-    QJsonDocument createResponse(const QString& request_id,
+    QJsonDocument createResponse(const QJsonValue& request_id,
                                  const QVariant& return_value,
                                  const QString& method_name);
-    QJsonDocument createErrorResponse(const QString& request_id,
+    QJsonDocument createErrorResponse(const QJsonValue& request_id,
                                       int code,
                                       const QString& message);
+    QByteArray createNotification(QObject* service,
+                                  const QMetaMethod& signal,
+                                  const QList<QVariant>& parameters,
+                                  QString& name);
 
     JsonRpcLoggerPtr m_logger;
+    JsonRpcEndpoint::OutboundLimits m_outbound_limits;
+    JsonRpcMetrics m_metrics;
+
+    /// Metrics already looked up, so that requests only take the lock of
+    /// m_metrics for the first request of a method. Only used on the
+    /// thread of the server.
+    QHash<QString, JsonRpcMethodMetrics*> m_method_metrics;
+
+    std::vector<RequestInterceptor> m_request_interceptors;
+    std::vector<ResponseInterceptor> m_response_interceptors;
+    JsonRpcTracerPtr m_tracer;
+    bool m_trace_untraced_requests;
+    JsonRpcCapturePtr m_capture;
     std::map<QString, UniversalPointer> m_services;
-    std::vector<std::tuple<QObject*,int, JsonRpcEndpoint::WeakPtr, std::shared_ptr<QSignalSpy>>> m_signalspies;
+
+    /// Clients are identified by their endpoint.
+    QHash<JsonRpcEndpoint*, JsonRpcEndpointPtr> m_client_endpoints;
+
+    QHash<SignalKey, SpiedSignal> m_spied_signals;
+
+    /// The signals each endpoint is subscribed to, so that cleaning up after
+    /// a client doesn't have to look at the subscriptions of other clients.
+    QHash<JsonRpcEndpoint*, QVector<SignalKey>> m_endpoint_subscriptions;
+
+    /// Indices of the parameters identifying the notifications of a signal,
+    /// see setConflationKey().
+    QHash<SignalKey, QVector<int>> m_conflation_parameters;
+
+    /// Signal indices by signature, built once per service class.
+    QHash<const QMetaObject*, QHash<QByteArray, int>> m_signal_indices;
 };
 
 }
@@ -0,0 +1,27 @@
+#include "json_rpc_shm_client.h"
+#include "json_rpc_shm_socket.h"
+
+#include <memory>
+
+namespace jcon {
+
+JsonRpcShmClient::JsonRpcShmClient(QObject* parent, JsonRpcLoggerPtr logger)
+    : JsonRpcClient(std::make_shared<JsonRpcShmSocket>(), parent, logger)
+{
+}
+
+JsonRpcShmClient::~JsonRpcShmClient()
+{
+}
+
+bool JsonRpcShmClient::connectToServer(const QString& name)
+{
+    return connectToServer(name, 0);
+}
+
+void JsonRpcShmClient::connectToServerAsync(const QString& name)
+{
+    connectToServerAsync(name, 0);
+}
+
+}
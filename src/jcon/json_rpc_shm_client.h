@@ -0,0 +1,28 @@
+#ifndef JSON_RPC_SHM_CLIENT_H
+#define JSON_RPC_SHM_CLIENT_H
+
+#include "json_rpc_client.h"
+
+namespace jcon {
+
+/// Client for a JsonRpcShmServer on the same machine. Linux only.
+class JCON_API JsonRpcShmClient : public JsonRpcClient
+{
+    Q_OBJECT
+
+public:
+    JsonRpcShmClient(QObject* parent = nullptr,
+                     JsonRpcLoggerPtr logger = nullptr);
+    virtual ~JsonRpcShmClient();
+
+    using JsonRpcClient::connectToServer;
+    using JsonRpcClient::connectToServerAsync;
+
+    /// Connect to the server \p name; see JsonRpcShmSocket.
+    bool connectToServer(const QString& name);
+    void connectToServerAsync(const QString& name);
+};
+
+}
+
+#endif
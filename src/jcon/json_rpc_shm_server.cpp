@@ -0,0 +1,125 @@
+#include "json_rpc_shm_server.h"
+#include "json_rpc_shm_socket.h"
+#include "local_socket_util.h"
+
+#include <QTimer>
+
+namespace jcon {
+
+JsonRpcShmServer::JsonRpcShmServer(QObject* parent, JsonRpcLoggerPtr logger)
+    : JsonRpcServer(parent, logger)
+    , m_socket(-1)
+{
+}
+
+JsonRpcShmServer::~JsonRpcShmServer()
+{
+    close();
+}
+
+bool JsonRpcShmServer::listen(const QString& name)
+{
+    logInfo("listening on " + name);
+
+    close();
+
+    QString error;
+    m_socket = listenUnixSocket(name, error);
+    if (m_socket < 0) {
+        logError(error);
+        return false;
+    }
+
+    m_name = name;
+    m_notifier.reset(new QSocketNotifier(m_socket, QSocketNotifier::Read));
+    connect(m_notifier.get(), &QSocketNotifier::activated,
+            this, &JsonRpcShmServer::newConnection);
+    return true;
+}
+
+bool JsonRpcShmServer::listen(int port)
+{
+    return listen(JsonRpcShmSocket::serverName(port));
+}
+
+void JsonRpcShmServer::close()
+{
+    for (auto it = m_handshakes.begin(); it != m_handshakes.end(); ++it) {
+        it.value()->deleteLater();
+        closeUnixSocket(it.key());
+    }
+    m_handshakes.clear();
+
+    m_notifier.reset();
+    if (m_socket >= 0) {
+        closeUnixSocket(m_socket);
+        removeUnixSocket(m_name);
+        m_socket = -1;
+    }
+}
+
+void JsonRpcShmServer::newConnection()
+{
+    int descriptor;
+    while ((descriptor = acceptUnixSocket(m_socket)) >= 0) {
+        // The client sends the handshake right after connecting, but it
+        // may not have arrived yet.
+        auto notifier = new QSocketNotifier(descriptor, QSocketNotifier::Read,
+                                            this);
+        connect(notifier, &QSocketNotifier::activated,
+                this, [this, descriptor]() { handshakeReceived(descriptor); });
+        m_handshakes.insert(descriptor, notifier);
+
+        // Don't let clients that never send it hold on to descriptors. The
+        // timer goes away with the notifier once the handshake arrived.
+        QTimer::singleShot(HandshakeTimeout, notifier,
+                           [this, descriptor, notifier]() {
+                               handshakeTimedOut(descriptor, notifier);
+                           });
+    }
+}
+
+void JsonRpcShmServer::handshakeReceived(int descriptor)
+{
+    // The socket watches the descriptor with a notifier of its own, and
+    // two enabled notifiers for one descriptor upset the event dispatcher.
+    QSocketNotifier* notifier = m_handshakes.value(descriptor);
+    notifier->setEnabled(false);
+
+    QString error;
+    auto socket = JsonRpcShmSocket::accept(descriptor, error);
+    if (!socket && error.isEmpty()) {
+        // The handshake hasn't arrived completely yet.
+        notifier->setEnabled(true);
+        return;
+    }
+
+    // The descriptor now belongs to the socket, or has been closed.
+    m_handshakes.remove(descriptor);
+    notifier->deleteLater();
+
+    if (!socket) {
+        logError("rejected shared memory client: " + error);
+        return;
+    }
+
+    logInfo("client connected");
+    addClient(socket);
+}
+
+void JsonRpcShmServer::handshakeTimedOut(int descriptor,
+                                         QSocketNotifier* notifier)
+{
+    // The notifier may only be waiting for deletion, and the descriptor
+    // may have been reused by a newer connection.
+    if (m_handshakes.value(descriptor) != notifier)
+        return;
+
+    m_handshakes.remove(descriptor);
+    notifier->setEnabled(false);
+    notifier->deleteLater();
+    closeUnixSocket(descriptor);
+    logError("rejected shared memory client: no handshake received");
+}
+
+}
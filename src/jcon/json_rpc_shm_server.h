@@ -0,0 +1,60 @@
+#ifndef JSONRPCSHMSERVER_H
+#define JSONRPCSHMSERVER_H
+
+#include "jcon.h"
+#include "json_rpc_server.h"
+#include "json_rpc_endpoint.h"
+#include "json_rpc_socket.h"
+
+#include <QHash>
+#include <QSocketNotifier>
+
+#include <memory>
+
+namespace jcon {
+
+/**
+ * Server for clients on the same machine that exchange data through shared
+ * memory, see JsonRpcShmSocket. Linux only.
+ */
+class JCON_API JsonRpcShmServer : public JsonRpcServer
+{
+    Q_OBJECT
+
+public:
+    JsonRpcShmServer(QObject* parent = nullptr,
+                     JsonRpcLoggerPtr logger = nullptr);
+    virtual ~JsonRpcShmServer();
+
+    /// Listen on the Unix socket \p name; '@' names are abstract.
+    bool listen(const QString& name);
+
+    /// Listen on JsonRpcShmSocket::serverName(port).
+    bool listen(int port) override;
+    void close() override;
+
+private slots:
+    /// Called when the listening socket has a connection to accept.
+    void newConnection() override;
+
+private:
+    /// Called when an accepted connection sent its handshake.
+    void handshakeReceived(int descriptor);
+
+    /// Called when an accepted connection sent no handshake in time.
+    void handshakeTimedOut(int descriptor, QSocketNotifier* notifier);
+
+    /// Milliseconds a client has to send its handshake after connecting.
+    static const int HandshakeTimeout = 5000;
+
+    QString m_name;
+    int m_socket;
+    std::unique_ptr<QSocketNotifier> m_notifier;
+
+    /// Accepted connections that haven't sent their handshake yet.
+    QHash<int, QSocketNotifier*> m_handshakes;
+};
+
+}
+
+#endif
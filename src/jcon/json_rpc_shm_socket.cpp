@@ -0,0 +1,499 @@
+#include "json_rpc_shm_socket.h"
+#include "local_socket_util.h"
+
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace jcon {
+
+namespace {
+
+/// Sent by the client along with the descriptors.
+struct Handshake {
+    char magic[4];
+    quint32 version;
+    quint64 capacity;
+};
+
+const char Magic[] = { 'J', 'S', 'H', 'M' };
+const quint32 Version = 1;
+const size_t MinCapacity = 4096;
+const size_t MaxCapacity = size_t(1) << 30;
+
+/// Seals that keep the size of the shared memory fixed for good.
+const int Seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+
+size_t roundUpToPowerOfTwo(size_t n)
+{
+    size_t result = MinCapacity;
+    while (result < n && result < MaxCapacity)
+        result <<= 1;
+    return result;
+}
+
+QString systemError(const QString& what)
+{
+    return what + ": " + QString::fromLocal8Bit(strerror(errno));
+}
+
+void closeDescriptor(int& descriptor)
+{
+    if (descriptor >= 0) {
+        ::close(descriptor);
+        descriptor = -1;
+    }
+}
+
+}
+
+JsonRpcShmSocket::JsonRpcShmSocket(size_t capacity)
+    : m_capacity(roundUpToPowerOfTwo(capacity))
+    , m_control(-1)
+    , m_memory(-1)
+    , m_event(-1)
+    , m_peer_event(-1)
+    , m_mapping(nullptr)
+    , m_mapping_size(0)
+    , m_pending_offset(0)
+    , m_pending_bytes(0)
+{
+}
+
+JsonRpcShmSocket::JsonRpcShmSocket(int control, int memory, int event,
+                                   int peer_event, size_t capacity)
+    : m_capacity(capacity)
+    , m_control(-1)
+    , m_memory(-1)
+    , m_event(-1)
+    , m_peer_event(-1)
+    , m_mapping(nullptr)
+    , m_mapping_size(0)
+    , m_pending_offset(0)
+    , m_pending_bytes(0)
+{
+    attach(control, memory, event, peer_event, capacity, false);
+}
+
+JsonRpcShmSocket::~JsonRpcShmSocket()
+{
+    release();
+}
+
+std::shared_ptr<JsonRpcShmSocket> JsonRpcShmSocket::accept(int control,
+                                                           QString& error)
+{
+    error.clear();
+
+    QByteArray data;
+    int descriptors[3];
+    int count;
+    const int received = receiveDescriptors(control, data, sizeof(Handshake),
+                                            descriptors, 3, count);
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return nullptr;
+
+    auto reject = [&](const QString& message) {
+        for (int i = 0; i < count; ++i)
+            ::close(descriptors[i]);
+        closeUnixSocket(control);
+        error = message;
+        return nullptr;
+    };
+
+    if (received <= 0)
+        return reject("connection closed during handshake");
+    if (received != sizeof(Handshake) || count != 3)
+        return reject("incomplete handshake");
+
+    Handshake handshake;
+    memcpy(&handshake, data.constData(), sizeof(handshake));
+    if (memcmp(handshake.magic, Magic, sizeof(Magic)) != 0 ||
+        handshake.version != Version)
+    {
+        return reject("unknown handshake");
+    }
+
+    const size_t capacity = static_cast<size_t>(handshake.capacity);
+    if (capacity < MinCapacity || capacity > MaxCapacity ||
+        (capacity & (capacity - 1)) != 0)
+    {
+        return reject("invalid ring capacity");
+    }
+
+    // Without the seals the client could still shrink the memory after
+    // the size is checked below.
+    const int seals = ::fcntl(descriptors[0], F_GET_SEALS);
+    if (seals < 0 || (seals & Seals) != Seals)
+        return reject("shared memory not sealed");
+
+    // Don't trust the client with the size of the memory, mapping more
+    // than there is would fault on access.
+    struct stat memory_stat;
+    if (::fstat(descriptors[0], &memory_stat) < 0 ||
+        static_cast<size_t>(memory_stat.st_size) <
+            2 * SpscByteRing::regionSize(capacity))
+    {
+        return reject("shared memory too small");
+    }
+
+    // The client sends its memory, the server's event and its own event.
+    std::shared_ptr<JsonRpcShmSocket> socket(new JsonRpcShmSocket(
+        control, descriptors[0], descriptors[1], descriptors[2], capacity));
+    if (!socket->isConnected()) {
+        error = socket->m_error;
+        return nullptr;
+    }
+    return socket;
+}
+
+QString JsonRpcShmSocket::serverName(int port)
+{
+    return QString("jcon-shm-%1").arg(port);
+}
+
+void JsonRpcShmSocket::connectToHost(QString host, int port)
+{
+    release();
+    m_error.clear();
+
+    const QString name = host.isEmpty() ? serverName(port) : host;
+    int control = connectUnixSocket(name, m_error);
+    if (control < 0) {
+        emit socketError(this, QAbstractSocket::ConnectionRefusedError);
+        return;
+    }
+
+    int memory =
+        ::memfd_create("jcon-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    int event = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    int peer_event = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (memory < 0 || event < 0 || peer_event < 0 ||
+        ::ftruncate(memory, static_cast<off_t>(
+                        2 * SpscByteRing::regionSize(m_capacity))) < 0 ||
+        ::fcntl(memory, F_ADD_SEALS, Seals) < 0)
+    {
+        const QString message = systemError("could not create shared memory");
+        closeDescriptor(control);
+        closeDescriptor(memory);
+        closeDescriptor(event);
+        closeDescriptor(peer_event);
+        fail(QAbstractSocket::SocketResourceError, message);
+        return;
+    }
+
+    if (!attach(control, memory, event, peer_event, m_capacity, true)) {
+        emit socketError(this, QAbstractSocket::SocketResourceError);
+        return;
+    }
+
+    Handshake handshake;
+    memcpy(handshake.magic, Magic, sizeof(Magic));
+    handshake.version = Version;
+    handshake.capacity = m_capacity;
+
+    const int descriptors[] = { m_memory, m_peer_event, m_event };
+    QString error;
+    if (!sendDescriptors(m_control,
+                         QByteArray(reinterpret_cast<const char*>(&handshake),
+                                    sizeof(handshake)),
+                         descriptors, 3, error))
+    {
+        fail(QAbstractSocket::ConnectionRefusedError, error);
+        return;
+    }
+
+    emit socketConnected(this);
+}
+
+bool JsonRpcShmSocket::waitForConnected(int msecs)
+{
+    // Connecting completes within connectToHost().
+    Q_UNUSED(msecs)
+    return isConnected();
+}
+
+void JsonRpcShmSocket::disconnectFromHost()
+{
+    if (!isConnected())
+        return;
+
+    release();
+    emit socketDisconnected(this);
+}
+
+bool JsonRpcShmSocket::isConnected() const
+{
+    return m_mapping != nullptr;
+}
+
+void JsonRpcShmSocket::send(const QByteArray& data)
+{
+    if (!isConnected() || data.isEmpty())
+        return;
+
+    qint64 written = 0;
+    if (m_pending.empty()) {
+        written = m_outbound->write(data.constData(),
+                                    static_cast<size_t>(data.size()));
+        if (written < 0) {
+            corrupted();
+            return;
+        }
+        if (written > 0)
+            afterWrite();
+        if (written == data.size())
+            return;
+    }
+
+    m_pending.push_back(written > 0 ?
+                        data.mid(static_cast<int>(written)) : data);
+    m_pending_bytes += data.size() - written;
+    flushPending();
+}
+
+qint64 JsonRpcShmSocket::bytesToWrite() const
+{
+    return m_pending_bytes;
+}
+
+QString JsonRpcShmSocket::errorString() const
+{
+    return m_error;
+}
+
+QHostAddress JsonRpcShmSocket::localAddress() const
+{
+    return QHostAddress::LocalHost;
+}
+
+int JsonRpcShmSocket::localPort() const
+{
+    return 0;
+}
+
+QHostAddress JsonRpcShmSocket::peerAddress() const
+{
+    return QHostAddress::LocalHost;
+}
+
+int JsonRpcShmSocket::peerPort() const
+{
+    return 0;
+}
+
+void JsonRpcShmSocket::eventSignalled()
+{
+    quint64 count;
+    const ssize_t result = ::read(m_event, &count, sizeof(count));
+    Q_UNUSED(result)
+
+    readAvailable();
+    if (!isConnected())
+        return;
+
+    const qint64 written = flushPending();
+    if (written > 0)
+        emit bytesWritten(written);
+}
+
+void JsonRpcShmSocket::controlReadable()
+{
+    char byte;
+    const ssize_t received = ::recv(m_control, &byte, 1, 0);
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+
+    // Nothing is sent on the Unix socket after the handshake, so it only
+    // becomes readable when the peer goes away. Deliver what the peer left
+    // in the ring first.
+    readAvailable();
+    if (!isConnected())
+        return;
+
+    release();
+    emit socketDisconnected(this);
+}
+
+bool JsonRpcShmSocket::attach(int control, int memory, int event,
+                              int peer_event, size_t capacity, bool client)
+{
+    m_control = control;
+    m_memory = memory;
+    m_event = event;
+    m_peer_event = peer_event;
+    m_capacity = capacity;
+
+    const size_t region = SpscByteRing::regionSize(capacity);
+    void* mapping = ::mmap(nullptr, 2 * region, PROT_READ | PROT_WRITE,
+                           MAP_SHARED, memory, 0);
+    if (mapping == MAP_FAILED) {
+        m_error = systemError("could not map shared memory");
+        release();
+        return false;
+    }
+
+    m_mapping = mapping;
+    m_mapping_size = 2 * region;
+
+    // The first ring carries data from the client to the server, the
+    // second one back.
+    char* const base = static_cast<char*>(mapping);
+    SpscByteRing* to_server = new SpscByteRing(base, capacity);
+    SpscByteRing* to_client = new SpscByteRing(base + region, capacity);
+    if (client) {
+        to_server->initialize();
+        to_client->initialize();
+        m_outbound.reset(to_server);
+        m_inbound.reset(to_client);
+    } else {
+        m_outbound.reset(to_client);
+        m_inbound.reset(to_server);
+    }
+
+    m_event_notifier.reset(new QSocketNotifier(m_event,
+                                               QSocketNotifier::Read));
+    connect(m_event_notifier.get(), &QSocketNotifier::activated,
+            this, &JsonRpcShmSocket::eventSignalled);
+
+    m_control_notifier.reset(new QSocketNotifier(m_control,
+                                                 QSocketNotifier::Read));
+    connect(m_control_notifier.get(), &QSocketNotifier::activated,
+            this, &JsonRpcShmSocket::controlReadable);
+
+    return true;
+}
+
+void JsonRpcShmSocket::release()
+{
+    // This may run in a slot called by one of the notifiers, which must
+    // not be deleted right away then.
+    for (auto notifier : { &m_event_notifier, &m_control_notifier }) {
+        if (*notifier) {
+            (*notifier)->setEnabled(false);
+            (*notifier)->disconnect(this);
+            notifier->release()->deleteLater();
+        }
+    }
+
+    m_outbound.reset();
+    m_inbound.reset();
+
+    if (m_mapping) {
+        ::munmap(m_mapping, m_mapping_size);
+        m_mapping = nullptr;
+        m_mapping_size = 0;
+    }
+
+    closeDescriptor(m_control);
+    closeDescriptor(m_memory);
+    closeDescriptor(m_event);
+    closeDescriptor(m_peer_event);
+
+    m_pending.clear();
+    m_pending_offset = 0;
+    m_pending_bytes = 0;
+}
+
+void JsonRpcShmSocket::fail(QAbstractSocket::SocketError error,
+                            const QString& message)
+{
+    m_error = message;
+    release();
+    emit socketError(this, error);
+}
+
+void JsonRpcShmSocket::corrupted()
+{
+    fail(QAbstractSocket::UnknownSocketError,
+         "shared memory ring corrupted by peer");
+}
+
+void JsonRpcShmSocket::readAvailable()
+{
+    for (;;) {
+        const qint64 available = m_inbound->readable();
+        if (available < 0) {
+            corrupted();
+            return;
+        }
+        if (available == 0) {
+            if (m_inbound->prepareConsumerSleep())
+                return;
+            continue;
+        }
+
+        QByteArray bytes(static_cast<int>(available), Qt::Uninitialized);
+        if (m_inbound->read(bytes.data(),
+                            static_cast<size_t>(available)) != available)
+        {
+            corrupted();
+            return;
+        }
+        if (m_inbound->wakeProducer())
+            signalPeer();
+
+        emit dataReceived(bytes, this);
+
+        // The receiver may have disconnected.
+        if (!isConnected())
+            return;
+    }
+}
+
+qint64 JsonRpcShmSocket::flushPending()
+{
+    qint64 written = 0;
+    for (;;) {
+        while (!m_pending.empty()) {
+            const QByteArray& front = m_pending.front();
+            const qint64 count = m_outbound->write(
+                front.constData() + m_pending_offset,
+                static_cast<size_t>(front.size() - m_pending_offset));
+            if (count < 0) {
+                corrupted();
+                return 0;
+            }
+            if (count == 0)
+                break;
+
+            written += count;
+            m_pending_offset += static_cast<int>(count);
+            if (m_pending_offset == front.size()) {
+                m_pending.pop_front();
+                m_pending_offset = 0;
+            }
+        }
+
+        if (written > 0)
+            afterWrite();
+
+        // Have the peer wake us when it makes space, unless it just did.
+        if (m_pending.empty() || m_outbound->prepareProducerSleep())
+            break;
+    }
+
+    m_pending_bytes -= written;
+    return written;
+}
+
+void JsonRpcShmSocket::afterWrite()
+{
+    if (m_outbound->wakeConsumer())
+        signalPeer();
+}
+
+void JsonRpcShmSocket::signalPeer()
+{
+    const quint64 one = 1;
+    const ssize_t result = ::write(m_peer_event, &one, sizeof(one));
+    Q_UNUSED(result)
+}
+
+}
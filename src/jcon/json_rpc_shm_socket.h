@@ -0,0 +1,126 @@
+#ifndef JSONRPCSHMSOCKET_H
+#define JSONRPCSHMSOCKET_H
+
+#include "jcon.h"
+#include "json_rpc_socket.h"
+#include "spsc_byte_ring.h"
+
+#include <QByteArray>
+#include <QSocketNotifier>
+
+#include <deque>
+#include <memory>
+
+namespace jcon {
+
+/**
+ * Socket for high message rates between processes on the same machine,
+ * Linux only. Data goes through a pair of single producer, single consumer
+ * rings in shared memory, one per direction, so that sending a message
+ * copies it into the ring and receiving copies it out, without a system
+ * call in between while both sides are busy. An eventfd per side wakes it
+ * up when it waits for data or space, through a QSocketNotifier.
+ *
+ * The client connects to the server over a Unix socket and passes it the
+ * memfd holding the rings and both eventfds. The Unix socket stays open to
+ * notice when the peer goes away.
+ *
+ * connectToHost() takes the name of the server instead of a host, and
+ * ignores the port; with an empty name it connects to serverName(port).
+ * Names starting with '@' are in the abstract namespace.
+ */
+class JCON_API JsonRpcShmSocket : public JsonRpcSocket
+{
+    Q_OBJECT
+
+public:
+    enum { DefaultCapacity = 1 << 20 };
+
+    /**
+     * Constructor for the client side.
+     *
+     * @param[in] capacity Size of each ring in bytes, a power of two.
+     */
+    explicit JsonRpcShmSocket(size_t capacity = DefaultCapacity);
+    virtual ~JsonRpcShmSocket();
+
+    /**
+     * Take the connection set up by a client on the accepted Unix socket
+     * \p control, used by JsonRpcShmServer. Returns null with an empty
+     * \p error if the client hasn't sent everything yet, and null with a
+     * description in \p error if the connection is unusable; \p control is
+     * closed then.
+     */
+    static std::shared_ptr<JsonRpcShmSocket> accept(int control,
+                                                    QString& error);
+
+    /// Name of the server that JsonRpcShmServer::listen(int) listens on.
+    static QString serverName(int port);
+
+    void connectToHost(QString host, int port) override;
+    bool waitForConnected(int msecs) override;
+    void disconnectFromHost() override;
+    bool isConnected() const override;
+    void send(const QByteArray& data) override;
+
+    /**
+     * Bytes waiting for space in the ring. Bytes in the ring count as
+     * written even if the peer hasn't read them yet, like bytes in the
+     * kernel's buffer of a TCP socket.
+     */
+    qint64 bytesToWrite() const override;
+    QString errorString() const override;
+
+    /// Shared memory has no address; these return the local host and 0.
+    QHostAddress localAddress() const override;
+    int localPort() const override;
+    QHostAddress peerAddress() const override;
+    int peerPort() const override;
+
+private slots:
+    /// Called when the peer wrote data or made space.
+    void eventSignalled();
+
+    /// Called when the Unix socket becomes readable, i.e. when it closes.
+    void controlReadable();
+
+private:
+    JsonRpcShmSocket(int control, int memory, int event, int peer_event,
+                     size_t capacity);
+
+    bool attach(int control, int memory, int event, int peer_event,
+                size_t capacity, bool client);
+    void release();
+    void fail(QAbstractSocket::SocketError error, const QString& message);
+    /// Fail because the peer left the ring in an impossible state.
+    void corrupted();
+
+    void readAvailable();
+    qint64 flushPending();
+    void afterWrite();
+    void signalPeer();
+
+    size_t m_capacity;
+    int m_control;
+    int m_memory;
+    int m_event;
+    int m_peer_event;
+    void* m_mapping;
+    size_t m_mapping_size;
+
+    std::unique_ptr<SpscByteRing> m_outbound;
+    std::unique_ptr<SpscByteRing> m_inbound;
+    std::unique_ptr<QSocketNotifier> m_event_notifier;
+    std::unique_ptr<QSocketNotifier> m_control_notifier;
+
+    /// Data that didn't fit into the ring, the first of it partly written.
+    std::deque<QByteArray> m_pending;
+    int m_pending_offset;
+    qint64 m_pending_bytes;
+
+    QString m_error;
+};
+
+}
+
+#endif
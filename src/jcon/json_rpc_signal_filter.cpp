@@ -0,0 +1,168 @@
+#include "json_rpc_signal_filter.h"
+
+#include <QMetaMethod>
+
+namespace jcon {
+
+static bool isNumericType(int type)
+{
+    switch (type) {
+    case QMetaType::Char:
+    case QMetaType::SChar:
+    case QMetaType::UChar:
+    case QMetaType::Short:
+    case QMetaType::UShort:
+    case QMetaType::Int:
+    case QMetaType::UInt:
+    case QMetaType::Long:
+    case QMetaType::ULong:
+    case QMetaType::LongLong:
+    case QMetaType::ULongLong:
+    case QMetaType::Float:
+    case QMetaType::Double:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/// Convert \p value to the type of the signal parameter it is compared with.
+static bool convertToParameterType(const QVariant& value,
+                                   int param_type,
+                                   QVariant& converted)
+{
+    converted = value;
+    if (param_type == QMetaType::QVariant ||
+        converted.userType() == param_type) {
+        return true;
+    }
+    return converted.canConvert(param_type) && converted.convert(param_type);
+}
+
+JsonRpcSignalFilter::JsonRpcSignalFilter()
+{
+}
+
+bool JsonRpcSignalFilter::compile(const QMetaMethod& signal,
+                                  const QVariantMap& spec,
+                                  JsonRpcSignalFilter& filter,
+                                  QString& error)
+{
+    filter.m_conditions.clear();
+
+    const auto param_names = signal.parameterNames();
+
+    for (auto it = spec.constBegin(); it != spec.constEnd(); ++it) {
+        int index = param_names.indexOf(it.key().toUtf8());
+        if (index == -1) {
+            // Allow addressing parameters by position, for signals declared
+            // without parameter names.
+            bool ok = false;
+            index = it.key().toInt(&ok);
+            if (!ok || index < 0 || index >= signal.parameterCount()) {
+                error = QString("signal %1 has no parameter '%2'")
+                    .arg(QString::fromUtf8(signal.methodSignature()))
+                    .arg(it.key());
+                return false;
+            }
+        }
+
+        const int param_type = signal.parameterType(index);
+
+        Condition condition;
+        condition.index = index;
+        condition.operation = Operation::Equal;
+        condition.numeric = isNumericType(param_type);
+        condition.min = 0;
+        condition.max = 0;
+        condition.has_min = false;
+        condition.has_max = false;
+
+        QVariantMap ops;
+        if (it.value().type() == QVariant::Map) {
+            ops = it.value().toMap();
+        } else {
+            ops.insert("eq", it.value());
+        }
+
+        if (ops.contains("eq")) {
+            if (!convertToParameterType(ops.value("eq"), param_type,
+                                        condition.value))
+            {
+                error = QString("cannot compare parameter '%1' with %2")
+                    .arg(it.key()).arg(ops.value("eq").toString());
+                return false;
+            }
+        } else if (ops.contains("in")) {
+            condition.operation = Operation::In;
+            for (const auto& element : ops.value("in").toList()) {
+                QVariant converted;
+                if (!convertToParameterType(element, param_type, converted)) {
+                    error = QString("cannot compare parameter '%1' with %2")
+                        .arg(it.key()).arg(element.toString());
+                    return false;
+                }
+                condition.set.push_back(converted);
+            }
+        } else if (ops.contains("min") || ops.contains("max")) {
+            condition.operation = Operation::Range;
+            if (!condition.numeric && param_type != QMetaType::QString) {
+                error = QString("range filter on parameter '%1' requires a "
+                                "numeric or string parameter").arg(it.key());
+                return false;
+            }
+            condition.has_min = ops.contains("min");
+            condition.has_max = ops.contains("max");
+            condition.min = ops.value("min").toDouble();
+            condition.max = ops.value("max").toDouble();
+            condition.min_string = ops.value("min").toString();
+            condition.max_string = ops.value("max").toString();
+        } else {
+            error = QString("unknown filter condition for parameter '%1'")
+                .arg(it.key());
+            return false;
+        }
+
+        filter.m_conditions.push_back(condition);
+    }
+
+    return true;
+}
+
+bool JsonRpcSignalFilter::matches(const QList<QVariant>& arguments) const
+{
+    for (const auto& condition : m_conditions) {
+        if (condition.index >= arguments.size())
+            return false;
+
+        if (!matches(condition, arguments.at(condition.index)))
+            return false;
+    }
+    return true;
+}
+
+bool JsonRpcSignalFilter::matches(const Condition& condition,
+                                  const QVariant& argument)
+{
+    switch (condition.operation) {
+    case Operation::Equal:
+        return argument == condition.value;
+
+    case Operation::In:
+        return condition.set.contains(argument);
+
+    case Operation::Range:
+        if (condition.numeric) {
+            const double value = argument.toDouble();
+            return (!condition.has_min || value >= condition.min) &&
+                (!condition.has_max || value <= condition.max);
+        } else {
+            const QString value = argument.toString();
+            return (!condition.has_min || value >= condition.min_string) &&
+                (!condition.has_max || value <= condition.max_string);
+        }
+    }
+    return false;
+}
+
+}
@@ -0,0 +1,85 @@
+#ifndef JSON_RPC_SIGNAL_FILTER_H
+#define JSON_RPC_SIGNAL_FILTER_H
+
+#include "jcon.h"
+
+#include <QString>
+#include <QVariant>
+
+#include <vector>
+
+class QMetaMethod;
+
+namespace jcon {
+
+/**
+ * Predicate on the parameters of a signal, evaluated by the server before a
+ * signal emission is encoded and sent to a subscriber.
+ *
+ * A filter is described by a map from signal parameter name to a condition:
+ *
+ *     { "deviceId": 42 }                          // equality
+ *     { "deviceId": { "eq": 42 } }                // equality
+ *     { "temperature": { "min": 0, "max": 50 } }  // inclusive range
+ *     { "deviceId": { "in": [1, 2, 3] } }         // set membership
+ *
+ * All conditions must hold for an emission to match. An empty filter matches
+ * every emission. The description is compiled once against the signal's
+ * QMetaMethod, so evaluating it does no name lookups or type conversions of
+ * the filter values.
+ */
+class JCON_API JsonRpcSignalFilter
+{
+public:
+    /// Create an empty filter, which matches every emission.
+    JsonRpcSignalFilter();
+
+    /**
+     * Compile a filter description against a signal.
+     *
+     * @param[in]  signal The signal the filter will be evaluated for.
+     * @param[in]  spec   The filter description (see class documentation).
+     * @param[out] filter The compiled filter.
+     * @param[out] error  Description of the problem if compilation failed.
+     *
+     * @returns true if the description was valid for the signal.
+     */
+    static bool compile(const QMetaMethod& signal,
+                        const QVariantMap& spec,
+                        JsonRpcSignalFilter& filter,
+                        QString& error);
+
+    bool isEmpty() const { return m_conditions.empty(); }
+
+    /// Check whether the signal arguments of an emission satisfy the filter.
+    bool matches(const QList<QVariant>& arguments) const;
+
+private:
+    enum class Operation {
+        Equal,
+        Range,
+        In
+    };
+
+    struct Condition {
+        int index;
+        Operation operation;
+        bool numeric;
+        QVariant value;
+        double min;
+        double max;
+        QString min_string;
+        QString max_string;
+        bool has_min;
+        bool has_max;
+        QVariantList set;
+    };
+
+    static bool matches(const Condition& condition, const QVariant& argument);
+
+    std::vector<Condition> m_conditions;
+};
+
+}
+
+#endif
@@ -23,6 +23,8 @@ public:
     virtual void disconnectFromHost() = 0;
     virtual bool isConnected() const = 0;
     virtual void send(const QByteArray& data) = 0;
+    /// Number of bytes handed to send() that are not yet written.
+    virtual qint64 bytesToWrite() const = 0;
     virtual QString errorString() const = 0;
     virtual QHostAddress localAddress() const = 0;
     virtual int localPort() const = 0;
@@ -31,6 +33,7 @@ public:
 
 signals:
     void dataReceived(const QByteArray& bytes, QObject* socket);
+    void bytesWritten(qint64 bytes);
     void socketConnected(QObject* socket);
     void socketDisconnected(QObject* socket);
     void socketError(QObject* socket, QAbstractSocket::SocketError error);
@@ -29,13 +29,6 @@ void JsonRpcTcpServer::close()
     m_server.close();
 }
 
-JsonRpcEndpointPtr JsonRpcTcpServer::findClient(QObject* socket)
-{
-    QTcpSocket* tcp_socket = qobject_cast<QTcpSocket*>(socket);
-    auto it = m_client_endpoints.find(tcp_socket);
-    return (it != m_client_endpoints.end()) ? it->second : JsonRpcEndpointPtr();
-}
-
 void JsonRpcTcpServer::newConnection()
 {
     JCON_ASSERT(m_server.hasPendingConnections());
@@ -48,46 +41,11 @@ void JsonRpcTcpServer::newConnection()
             return;
         }
 
-        logInfo("client connected: " + tcp_socket->peerAddress().toString());
-
-        // TODO: maybe move this to base class?
-        // {
-        auto rpc_socket = std::make_shared<JsonRpcTcpSocket>(tcp_socket);
-
-        auto endpoint =
-            std::make_shared<JsonRpcEndpoint>(rpc_socket, log(), this);
-
-        connect(endpoint.get(), &JsonRpcEndpoint::socketDisconnected,
-                this, &JsonRpcTcpServer::clientDisconnected);
-
-        connect(endpoint.get(), &JsonRpcEndpoint::socketError,
-                this, &JsonRpcServer::socketError);
-
-        connect(endpoint.get(), &JsonRpcEndpoint::jsonObjectReceived,
-                this, &JsonRpcServer::jsonRequestReceived);
-
-        m_client_endpoints[tcp_socket] = endpoint;
-        // }
-    }
-}
-
-void JsonRpcTcpServer::clientDisconnected(QObject* client_socket)
-{
-    QTcpSocket* tcp_socket = qobject_cast<QTcpSocket*>(client_socket);
-    JCON_ASSERT(tcp_socket);
-    if (!tcp_socket) {
-        logError("client disconnected, but socket is null");
-        return;
-    }
+        if (log()->isEnabled(JsonRpcLogger::LL_Info))
+            logInfo("client connected: " + tcp_socket->peerAddress().toString());
 
-    logInfo("client disconnected: " + tcp_socket->peerAddress().toString());
-    auto it = m_client_endpoints.find(tcp_socket);
-    JCON_ASSERT(it != m_client_endpoints.end());
-    if (it == m_client_endpoints.end()) {
-        logError("unknown client disconnected");
-        return;
+        addClient(std::make_shared<JsonRpcTcpSocket>(tcp_socket));
     }
-    m_client_endpoints.erase(it);
 }
 
 }
@@ -8,8 +8,6 @@
 
 #include <QTcpServer>
 
-#include <map>
-
 namespace jcon {
 
 class JCON_API JsonRpcTcpServer : public JsonRpcServer
@@ -24,21 +22,12 @@ public:
     bool listen(int port) override;
     void close() override;
 
-protected:
-    JsonRpcEndpointPtr findClient(QObject* socket) override;
-
 private slots:
     /// Called when the underlying QTcpServer gets a new client connection.
     void newConnection() override;
 
-    /// Called when the underlying QTcpServer loses a client connection.
-    void clientDisconnected(QObject* client_socket) override;
-
 private:
     QTcpServer m_server;
-
-    /// Clients are uniquely identified by their QTcpSocket*.
-    std::map<QTcpSocket*, JsonRpcEndpointPtr> m_client_endpoints;
 };
 
 }
@@ -37,6 +37,9 @@ void JsonRpcTcpSocket::setupSocket()
     connect(m_socket, &QTcpSocket::readyRead,
             this, &JsonRpcTcpSocket::dataReady);
 
+    connect(m_socket, &QTcpSocket::bytesWritten,
+            this, &JsonRpcTcpSocket::bytesWritten);
+
     void (QAbstractSocket::*errorPtr)(QAbstractSocket::SocketError) =
         &QAbstractSocket::error;
     connect(m_socket, errorPtr, this,
@@ -71,6 +74,11 @@ void JsonRpcTcpSocket::send(const QByteArray& data)
     m_socket->write(data);
 }
 
+qint64 JsonRpcTcpSocket::bytesToWrite() const
+{
+    return m_socket->bytesToWrite();
+}
+
 QString JsonRpcTcpSocket::errorString() const
 {
     return m_socket->errorString();
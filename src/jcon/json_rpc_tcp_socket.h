@@ -34,6 +34,7 @@ public:
     void disconnectFromHost() override;
     bool isConnected() const override;
     void send(const QByteArray& data) override;
+    qint64 bytesToWrite() const override;
     QString errorString() const override;
     QHostAddress localAddress() const override;
     int localPort() const override;
@@ -0,0 +1,110 @@
+#include "json_rpc_timer_wheel.h"
+
+namespace jcon {
+
+JsonRpcTimerWheel::JsonRpcTimerWheel()
+    : m_free_nodes(Nil)
+    , m_current_tick(0)
+    , m_count(0)
+{
+    for (auto& slot : m_slots)
+        slot = Nil;
+}
+
+JsonRpcTimerWheel::TimerId JsonRpcTimerWheel::schedule(Key key, Tick ticks)
+{
+    const Tick max_ticks = (Tick(1) << (LevelBits * Levels)) - 1;
+
+    quint32 node;
+    if (m_free_nodes != Nil) {
+        node = m_free_nodes;
+        m_free_nodes = m_nodes[node].next;
+    } else {
+        node = static_cast<quint32>(m_nodes.size());
+        m_nodes.push_back(Node());
+    }
+
+    m_nodes[node].key = key;
+    m_nodes[node].deadline = m_current_tick + qBound(Tick(1), ticks, max_ticks);
+    insert(node);
+    ++m_count;
+    return node;
+}
+
+void JsonRpcTimerWheel::cancel(TimerId timer)
+{
+    Q_ASSERT(timer < m_nodes.size());
+    unlink(timer);
+    release(timer);
+}
+
+void JsonRpcTimerWheel::insert(quint32 node)
+{
+    const Tick deadline = m_nodes[node].deadline;
+    const Tick delta = deadline > m_current_tick ? deadline - m_current_tick : 0;
+
+    if (delta == 0) {
+        // Cascaded into the slot of the current tick, which advanceTo()
+        // processes right after the cascade.
+        link(node, m_current_tick & (SlotsPerLevel - 1));
+        return;
+    }
+
+    int level = 0;
+    while (level < Levels - 1 && delta >> (LevelBits * (level + 1)) != 0)
+        ++level;
+
+    const quint32 index = (deadline >> (LevelBits * level)) & (SlotsPerLevel - 1);
+    link(node, level * SlotsPerLevel + index);
+}
+
+void JsonRpcTimerWheel::link(quint32 node, quint32 slot)
+{
+    Node& n = m_nodes[node];
+    n.slot = slot;
+    n.prev = Nil;
+    n.next = m_slots[slot];
+    if (n.next != Nil)
+        m_nodes[n.next].prev = node;
+    m_slots[slot] = node;
+}
+
+void JsonRpcTimerWheel::unlink(quint32 node)
+{
+    Node& n = m_nodes[node];
+    if (n.prev != Nil)
+        m_nodes[n.prev].next = n.next;
+    else
+        m_slots[n.slot] = n.next;
+    if (n.next != Nil)
+        m_nodes[n.next].prev = n.prev;
+}
+
+void JsonRpcTimerWheel::release(quint32 node)
+{
+    m_nodes[node].next = m_free_nodes;
+    m_free_nodes = node;
+    --m_count;
+}
+
+quint32 JsonRpcTimerWheel::detach(quint32 slot)
+{
+    const quint32 head = m_slots[slot];
+    m_slots[slot] = Nil;
+    return head;
+}
+
+void JsonRpcTimerWheel::cascade(int level)
+{
+    const quint32 index =
+        (m_current_tick >> (LevelBits * level)) & (SlotsPerLevel - 1);
+
+    quint32 node = detach(level * SlotsPerLevel + index);
+    while (node != Nil) {
+        const quint32 next = m_nodes[node].next;
+        insert(node);
+        node = next;
+    }
+}
+
+}
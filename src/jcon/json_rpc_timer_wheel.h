@@ -0,0 +1,134 @@
+#ifndef JSON_RPC_TIMER_WHEEL_H
+#define JSON_RPC_TIMER_WHEEL_H
+
+#include "jcon.h"
+
+#include <QtGlobal>
+
+#include <cstddef>
+#include <vector>
+
+namespace jcon {
+
+/**
+ * Hierarchical timer wheel, used to expire outstanding requests without a
+ * QTimer per request.
+ *
+ * Time is measured in ticks. The wheel has four levels of 64 slots each; a
+ * timer is placed in the lowest level whose range covers it, and moved down
+ * a level each time the level below it wraps around. Scheduling and
+ * cancelling a timer are O(1), and advancing by one tick only touches the
+ * timers expiring in that tick, plus the occasional cascade.
+ *
+ * Timers are nodes of intrusive lists in a pooled node array, so scheduling
+ * doesn't allocate once the pool has grown to the number of live timers.
+ */
+class JCON_API JsonRpcTimerWheel
+{
+public:
+    typedef quint64 Key;
+    typedef quint64 Tick;
+    typedef quint32 TimerId;
+
+    enum : quint32 { InvalidTimer = 0xffffffffu };
+
+    JsonRpcTimerWheel();
+
+    /**
+     * Schedule \p key to expire \p ticks ticks after the current tick. Delays
+     * shorter than one tick are rounded up to one tick, and delays longer than
+     * the range of the wheel (64^4 ticks) are capped.
+     *
+     * @returns The ID of the timer, to be passed to cancel().
+     */
+    TimerId schedule(Key key, Tick ticks);
+
+    /// Cancel a timer that has not expired yet.
+    void cancel(TimerId timer);
+
+    /**
+     * Advance the wheel to \p tick, calling \p expired with the key of each
+     * timer that expires on the way. Expired timers are removed before \p
+     * expired is called, and \p expired must not modify the wheel.
+     */
+    template<typename F>
+    void advanceTo(Tick tick, F expired);
+
+    Tick currentTick() const { return m_current_tick; }
+    bool isEmpty() const { return m_count == 0; }
+    size_t size() const { return m_count; }
+
+private:
+    enum {
+        LevelBits = 6,
+        SlotsPerLevel = 1 << LevelBits,
+        Levels = 4
+    };
+
+    enum : quint32 { Nil = 0xffffffffu };
+
+    struct Node {
+        Key key;
+        Tick deadline;
+        quint32 prev;
+        quint32 next;
+        quint32 slot;
+    };
+
+    void insert(quint32 node);
+    void link(quint32 node, quint32 slot);
+    void unlink(quint32 node);
+    void release(quint32 node);
+    quint32 detach(quint32 slot);
+    void cascade(int level);
+
+    std::vector<Node> m_nodes;
+    quint32 m_free_nodes;
+    quint32 m_slots[Levels * SlotsPerLevel];
+    Tick m_current_tick;
+    size_t m_count;
+};
+
+template<typename F>
+void JsonRpcTimerWheel::advanceTo(Tick tick, F expired)
+{
+    if (m_count == 0) {
+        m_current_tick = qMax(m_current_tick, tick);
+        return;
+    }
+
+    while (m_current_tick < tick) {
+        ++m_current_tick;
+
+        // Move the timers of the next slot of each level that wrapped around
+        // down one level.
+        for (int level = 1; level < Levels; ++level) {
+            const Tick mask = (Tick(1) << (LevelBits * level)) - 1;
+            if ((m_current_tick & mask) != 0)
+                break;
+            cascade(level);
+        }
+
+        quint32 node = detach(m_current_tick & (SlotsPerLevel - 1));
+        while (node != Nil) {
+            const quint32 next = m_nodes[node].next;
+            if (m_nodes[node].deadline <= m_current_tick) {
+                const Key key = m_nodes[node].key;
+                release(node);
+                expired(key);
+            } else {
+                insert(node);
+            }
+            node = next;
+        }
+
+        if (m_count == 0) {
+            m_current_tick = tick;
+            return;
+        }
+    }
+}
+
+}
+
+#endif
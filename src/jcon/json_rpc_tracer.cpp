@@ -0,0 +1,214 @@
+#include "json_rpc_tracer.h"
+
+#include <QCoreApplication>
+#include <QJsonDocument>
+#include <QJsonValue>
+
+#include <atomic>
+#include <chrono>
+#include <random>
+
+namespace jcon {
+
+namespace {
+
+QString idToString(quint64 id)
+{
+    return QString("%1").arg(id, 16, 16, QChar('0'));
+}
+
+quint64 idFromString(const QString& id)
+{
+    bool ok = false;
+    const quint64 value = id.toULongLong(&ok, 16);
+    return ok ? value : 0;
+}
+
+/// Small, stable number of the calling thread.
+int threadNumber()
+{
+    static std::atomic<int> next_number(1);
+    thread_local int number = next_number.fetch_add(1);
+    return number;
+}
+
+}
+
+QJsonObject JsonRpcTracer::Context::toJson() const
+{
+    if (!isValid())
+        return QJsonObject { { "sampled", false } };
+
+    return QJsonObject {
+        { "traceId", idToString(trace_id) },
+        { "spanId", idToString(span_id) }
+    };
+}
+
+JsonRpcTracer::Context JsonRpcTracer::Context::fromJson(const QJsonValue& value)
+{
+    Context context;
+    if (!value.isObject())
+        return context;
+
+    const QJsonObject object = value.toObject();
+    context.trace_id = idFromString(object.value("traceId").toString());
+    context.span_id = idFromString(object.value("spanId").toString());
+    if (context.span_id == 0)
+        context.trace_id = 0;
+    return context;
+}
+
+JsonRpcTracer::JsonRpcTracer(const QString& filename, double sample_rate)
+    : m_file(filename)
+    , m_pid(QCoreApplication::applicationPid())
+{
+    if (sample_rate >= 1.0) {
+        m_sample_threshold = ~Q_UINT64_C(0);
+    } else if (sample_rate <= 0.0) {
+        m_sample_threshold = 0;
+    } else {
+        m_sample_threshold =
+            static_cast<quint64>(sample_rate * 18446744073709551616.0);
+    }
+
+    m_file.open(QIODevice::WriteOnly);
+
+    // The metadata event names the process in the trace viewer, and every
+    // later event can be appended with a leading comma.
+    const QJsonObject process_name {
+        { "name", "process_name" },
+        { "ph", "M" },
+        { "pid", m_pid },
+        { "args", QJsonObject {
+                { "name", QCoreApplication::applicationName() } } }
+    };
+    m_buffer = "[\n" + QJsonDocument(process_name).toJson(
+        QJsonDocument::Compact);
+}
+
+JsonRpcTracer::~JsonRpcTracer()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_buffer += "\n]\n";
+    writeBuffer();
+    m_file.close();
+}
+
+JsonRpcTracer::Span JsonRpcTracer::startSpan(const QString& name,
+                                             const Context& parent)
+{
+    Span span;
+    if (parent.isValid()) {
+        span.context.trace_id = parent.trace_id;
+        span.parent_id = parent.span_id;
+    } else if (sample()) {
+        span.context.trace_id = randomId();
+    } else {
+        return span;
+    }
+
+    span.context.span_id = randomId();
+    span.name = name;
+    span.start = now();
+    return span;
+}
+
+void JsonRpcTracer::endSpan(const Span& span, const char* phase,
+                            SpanKind kind, bool error)
+{
+    if (!span.isRecording())
+        return;
+
+    const qint64 end = now();
+    const int tid = threadNumber();
+
+    QJsonObject args {
+        { "traceId", idToString(span.context.trace_id) },
+        { "spanId", idToString(span.context.span_id) }
+    };
+    if (span.parent_id != 0)
+        args.insert("parentId", idToString(span.parent_id));
+    if (error)
+        args.insert("error", true);
+
+    QByteArray events = ",\n" + QJsonDocument(QJsonObject {
+            { "name", span.name },
+            { "cat", phase },
+            { "ph", "X" },
+            { "ts", span.start },
+            { "dur", end - span.start },
+            { "pid", m_pid },
+            { "tid", tid },
+            { "args", args }
+        }).toJson(QJsonDocument::Compact);
+
+    // A flow arrow from the client span to the server span of a call, which
+    // are recorded by different processes, identified by the client span.
+    if (kind == SK_Client || (kind == SK_Server && span.parent_id != 0)) {
+        const bool client = kind == SK_Client;
+        QJsonObject flow {
+            { "name", "rpc" },
+            { "cat", "rpc" },
+            { "ph", client ? "s" : "f" },
+            { "id", idToString(client ? span.context.span_id
+                                      : span.parent_id) },
+            { "ts", span.start },
+            { "pid", m_pid },
+            { "tid", tid }
+        };
+        if (!client)
+            flow.insert("bp", "e");
+        events += ",\n" + QJsonDocument(flow).toJson(QJsonDocument::Compact);
+    }
+
+    append(events);
+}
+
+void JsonRpcTracer::flush()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    writeBuffer();
+}
+
+qint64 JsonRpcTracer::now()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(
+        system_clock::now().time_since_epoch()).count();
+}
+
+quint64 JsonRpcTracer::randomId()
+{
+    thread_local std::mt19937_64 random(std::random_device{}());
+
+    quint64 id;
+    do {
+        id = random();
+    } while (id == 0);
+    return id;
+}
+
+bool JsonRpcTracer::sample() const
+{
+    if (m_sample_threshold == 0)
+        return false;
+    return randomId() <= m_sample_threshold;
+}
+
+void JsonRpcTracer::append(const QByteArray& event)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_buffer += event;
+    if (m_buffer.size() >= FlushSize)
+        writeBuffer();
+}
+
+void JsonRpcTracer::writeBuffer()
+{
+    m_file.write(m_buffer);
+    m_file.flush();
+    m_buffer.clear();
+}
+
+}
@@ -0,0 +1,117 @@
+#ifndef JSON_RPC_TRACER_H
+#define JSON_RPC_TRACER_H
+
+#include "jcon.h"
+
+#include <QByteArray>
+#include <QFile>
+#include <QJsonObject>
+#include <QString>
+
+#include <memory>
+#include <mutex>
+
+class QJsonValue;
+
+namespace jcon {
+
+/**
+ * Records spans of RPC calls to a file in the Chrome trace event format,
+ * which can be opened in Perfetto or chrome://tracing.
+ *
+ * Clients pass the trace context of a call to the server in the "trace"
+ * member of the request, and the server records its spans as children of
+ * the client's. Sampling is decided once, at the head of a trace: a client
+ * that traces sends {"sampled": false} for calls it doesn't sample, and
+ * nothing is recorded for them on either side.
+ *
+ * Timestamps are taken from the system clock, so that the files written by
+ * several processes on one machine line up.
+ */
+class JCON_API JsonRpcTracer
+{
+public:
+    /**
+     * Trace context of a span, as carried in the "trace" member. An invalid
+     * context stands for a call that isn't sampled.
+     */
+    struct Context {
+        quint64 trace_id = 0;
+        quint64 span_id = 0;
+
+        bool isValid() const { return trace_id != 0; }
+
+        QJsonObject toJson() const;
+        static Context fromJson(const QJsonValue& value);
+    };
+
+    /// Which side of a call a span was recorded on.
+    enum SpanKind {
+        SK_Client,
+        SK_Server,
+        SK_Internal
+    };
+
+    /// A span being recorded. Spans that aren't sampled are empty.
+    struct Span {
+        Context context;
+        quint64 parent_id = 0;
+        QString name;
+
+        /// Start time in microseconds since the epoch.
+        qint64 start = 0;
+
+        bool isRecording() const { return context.isValid(); }
+    };
+
+    /**
+     * Write the spans to \p filename. \p sample_rate is the fraction of
+     * traces recorded, between 0 and 1.
+     */
+    explicit JsonRpcTracer(const QString& filename, double sample_rate = 1.0);
+    ~JsonRpcTracer();
+
+    JsonRpcTracer(const JsonRpcTracer&) = delete;
+    JsonRpcTracer& operator=(const JsonRpcTracer&) = delete;
+
+    /**
+     * Start a span named \p name. With a valid \p parent, the span is part
+     * of its trace. Otherwise it starts a new trace, if the sampler selects
+     * one, or is empty.
+     */
+    Span startSpan(const QString& name, const Context& parent = Context());
+
+    /**
+     * Record \p span, if it is sampled. \p phase is the category it is shown
+     * under. Client spans are linked to the server spans of the same call by
+     * flow arrows.
+     */
+    void endSpan(const Span& span, const char* phase, SpanKind kind,
+                 bool error = false);
+
+    /// Write the recorded spans to the file.
+    void flush();
+
+private:
+    enum { FlushSize = 64 * 1024 };
+
+    static qint64 now();
+    static quint64 randomId();
+    bool sample() const;
+
+    void append(const QByteArray& event);
+    void writeBuffer();
+
+    QFile m_file;
+    quint64 m_sample_threshold;
+    qint64 m_pid;
+
+    std::mutex m_mutex;
+    QByteArray m_buffer;
+};
+
+typedef std::shared_ptr<JsonRpcTracer> JsonRpcTracerPtr;
+
+}
+
+#endif
@@ -1,20 +1,22 @@
 #include "json_rpc_websocket.h"
 #include "jcon_assert.h"
 
-#include <QSignalSpy>
-#include <QTime>
+#include <QEventLoop>
+#include <QTimer>
 #include <QWebSocket>
 
 namespace jcon {
 
 JsonRpcWebSocket::JsonRpcWebSocket()
     : m_socket(new QWebSocket)
+    , m_bytes_to_write(0)
 {
     setupSocket();
 }
 
 JsonRpcWebSocket::JsonRpcWebSocket(QWebSocket* socket)
     : m_socket(socket)
+    , m_bytes_to_write(0)
 {
     setupSocket();
 }
@@ -38,6 +40,12 @@ void JsonRpcWebSocket::setupSocket()
     connect(m_socket, &QWebSocket::textMessageReceived,
             this, &JsonRpcWebSocket::dataReady);
 
+    connect(m_socket, &QWebSocket::bytesWritten, this, [this](qint64 bytes) {
+        // Written byte counts include frame headers, so don't go below zero.
+        m_bytes_to_write = qMax<qint64>(0, m_bytes_to_write - bytes);
+        emit bytesWritten(bytes);
+    });
+
     void (QWebSocket::*errorPtr)(QAbstractSocket::SocketError) =
         &QWebSocket::error;
     connect(m_socket, errorPtr, this,
@@ -57,17 +65,27 @@ void JsonRpcWebSocket::connectToHost(QString host, int port)
 
 bool JsonRpcWebSocket::waitForConnected(int msecs)
 {
-    QTime timer(0, 0, 0, msecs);
-    QSignalSpy spy(m_socket, &QWebSocket::connected);
-    timer.start();
-    while (spy.isEmpty() && timer.elapsed() < msecs) {
-        QCoreApplication::processEvents();
+    if (isConnected()) {
+        return true;
     }
-    return !spy.isEmpty();
+
+    QEventLoop loop;
+    QTimer timer;
+    timer.setSingleShot(true);
+
+    connect(&timer, &QTimer::timeout, &loop, &QEventLoop::quit);
+    connect(m_socket, &QWebSocket::connected, &loop, &QEventLoop::quit);
+    connect(m_socket, &QWebSocket::disconnected, &loop, &QEventLoop::quit);
+
+    timer.start(msecs);
+    loop.exec(QEventLoop::ExcludeUserInputEvents);
+
+    return isConnected();
 }
 
 void JsonRpcWebSocket::disconnectFromHost()
 {
+    m_bytes_to_write = 0;
     m_socket->close();
 }
 
@@ -78,7 +96,12 @@ bool JsonRpcWebSocket::isConnected() const
 
 void JsonRpcWebSocket::send(const QByteArray& data)
 {
-    m_socket->sendTextMessage(data);
+    m_bytes_to_write += m_socket->sendTextMessage(data);
+}
+
+qint64 JsonRpcWebSocket::bytesToWrite() const
+{
+    return m_bytes_to_write;
 }
 
 QString JsonRpcWebSocket::errorString() const
@@ -34,6 +34,7 @@ public:
     void disconnectFromHost() override;
     bool isConnected() const override;
     void send(const QByteArray& data) override;
+    qint64 bytesToWrite() const override;
     QString errorString() const override;
     QHostAddress localAddress() const override;
     int localPort() const override;
@@ -47,6 +48,9 @@ private:
     void setupSocket();
 
     QWebSocket* m_socket;
+
+    /// QWebSocket does not expose its write buffer size, so track it here.
+    qint64 m_bytes_to_write;
 };
 
 }
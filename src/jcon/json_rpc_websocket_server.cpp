@@ -37,13 +37,6 @@ void JsonRpcWebSocketServer::close()
     m_server->close();
 }
 
-JsonRpcEndpointPtr JsonRpcWebSocketServer::findClient(QObject* socket)
-{
-    QWebSocket* web_socket = qobject_cast<QWebSocket*>(socket);
-    auto it = m_client_endpoints.find(web_socket);
-    return (it != m_client_endpoints.end()) ? it->second : JsonRpcEndpointPtr();
-}
-
 void JsonRpcWebSocketServer::newConnection()
 {
     JCON_ASSERT(m_server->hasPendingConnections());
@@ -56,43 +49,11 @@ void JsonRpcWebSocketServer::newConnection()
             return;
         }
 
-        logInfo("client connected: " + web_socket->peerAddress().toString());
-
-        // TODO: maybe move this to base class?
-        // {
-        auto rpc_socket = std::make_shared<JsonRpcWebSocket>(web_socket);
-
-        auto endpoint =
-            std::make_shared<JsonRpcEndpoint>(rpc_socket, log(), this);
-
-        connect(endpoint.get(), &JsonRpcEndpoint::socketDisconnected,
-                this, &JsonRpcWebSocketServer::clientDisconnected);
+        if (log()->isEnabled(JsonRpcLogger::LL_Info))
+            logInfo("client connected: " + web_socket->peerAddress().toString());
 
-        connect(endpoint.get(), &JsonRpcEndpoint::jsonObjectReceived,
-                this, &JsonRpcServer::jsonRequestReceived);
-
-        m_client_endpoints[web_socket] = endpoint;
-        // }
-    }
-}
-
-void JsonRpcWebSocketServer::clientDisconnected(QObject* client_socket)
-{
-    QWebSocket* socket = qobject_cast<QWebSocket*>(client_socket);
-    JCON_ASSERT(socket);
-    if (!socket) {
-        logError("client disconnected, but socket is null");
-        return;
+        addClient(std::make_shared<JsonRpcWebSocket>(web_socket));
     }
-
-    logInfo("client disconnected: " + socket->peerAddress().toString());
-    auto it = m_client_endpoints.find(socket);
-    JCON_ASSERT(it != m_client_endpoints.end());
-    if (it == m_client_endpoints.end()) {
-        logError("unknown client disconnected");
-        return;
-    }    
-    m_client_endpoints.erase(it);
 }
 
 }
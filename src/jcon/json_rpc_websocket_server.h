@@ -6,8 +6,6 @@
 #include "json_rpc_endpoint.h"
 #include "json_rpc_socket.h"
 
-#include <map>
-
 class QWebSocket;
 class QWebSocketServer;
 
@@ -25,22 +23,13 @@ public:
     bool listen(int port) override;
     void close() override;
 
-protected:
-    JsonRpcEndpointPtr findClient(QObject* socket) override;
-
 private slots:
     /// Called when the underlying QWebSocketServer gets a new client
     /// connection.
     void newConnection() override;
 
-    /// Called when the underlying QWebSocketServer loses a client connection.
-    void clientDisconnected(QObject* client_socket) override;
-
 private:
     QWebSocketServer* m_server;
-
-    /// Clients are uniquely identified by their QWebSocket*.
-    std::map<QWebSocket*, JsonRpcEndpointPtr> m_client_endpoints;
 };
 
 }
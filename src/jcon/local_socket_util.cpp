@@ -0,0 +1,295 @@
+#include "local_socket_util.h"
+
+#include <QDir>
+#include <QFile>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#endif
+
+namespace jcon {
+
+#ifdef Q_OS_LINUX
+
+namespace {
+
+const int MaxDescriptors = 8;
+
+/// Fill in the address of the socket \p name. Abstract names are the name
+/// without the '@', preceded by a null byte instead.
+bool unixAddress(const QString& name,
+                 sockaddr_un& address,
+                 socklen_t& length,
+                 QString& error)
+{
+    const bool abstract = isAbstractSocketName(name);
+    QByteArray path;
+    if (abstract) {
+        path = QByteArray(1, '\0') + name.mid(1).toUtf8();
+    } else if (QDir::isAbsolutePath(name)) {
+        path = QFile::encodeName(name);
+    } else {
+        path = QFile::encodeName(QDir::tempPath() + '/' + name);
+    }
+
+    // Paths in the file system need a terminating null byte.
+    if (static_cast<size_t>(path.size()) + (abstract ? 0 : 1) >
+        sizeof(address.sun_path))
+    {
+        error = "socket name too long: " + name;
+        return false;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.constData(), path.size());
+    length = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) +
+                                    path.size() + (abstract ? 0 : 1));
+    return true;
+}
+
+QString systemError(const QString& what)
+{
+    return what + ": " + QString::fromLocal8Bit(strerror(errno));
+}
+
+}
+
+bool isAbstractSocketName(const QString& name)
+{
+    return name.startsWith('@');
+}
+
+int connectUnixSocket(const QString& name, QString& error)
+{
+    sockaddr_un address;
+    socklen_t length;
+    if (!unixAddress(name, address, length, error))
+        return -1;
+
+    const int descriptor = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (descriptor < 0) {
+        error = systemError("could not create socket");
+        return -1;
+    }
+
+    // Connecting to a Unix socket doesn't block for long, so connect before
+    // making the socket non blocking rather than waiting for completion.
+    if (::connect(descriptor, reinterpret_cast<sockaddr*>(&address),
+                  length) < 0)
+    {
+        error = systemError("could not connect to " + name);
+        ::close(descriptor);
+        return -1;
+    }
+
+    ::fcntl(descriptor, F_SETFL, ::fcntl(descriptor, F_GETFL) | O_NONBLOCK);
+    return descriptor;
+}
+
+int listenUnixSocket(const QString& name, QString& error)
+{
+    sockaddr_un address;
+    socklen_t length;
+    if (!unixAddress(name, address, length, error))
+        return -1;
+
+    const int descriptor =
+        ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (descriptor < 0) {
+        error = systemError("could not create socket");
+        return -1;
+    }
+
+    int result = ::bind(descriptor, reinterpret_cast<sockaddr*>(&address),
+                        length);
+    if (result < 0 && errno == EADDRINUSE && !isAbstractSocketName(name)) {
+        // A socket file nobody accepts connections on is left over from a
+        // server that didn't shut down cleanly, and can be removed.
+        const int probe = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (probe >= 0 &&
+            ::connect(probe, reinterpret_cast<sockaddr*>(&address),
+                      length) < 0 &&
+            errno == ECONNREFUSED)
+        {
+            ::unlink(address.sun_path);
+            result = ::bind(descriptor,
+                            reinterpret_cast<sockaddr*>(&address), length);
+        } else {
+            errno = EADDRINUSE;
+        }
+        if (probe >= 0)
+            ::close(probe);
+    }
+
+    if (result < 0 || ::listen(descriptor, SOMAXCONN) < 0) {
+        error = systemError("could not listen on " + name);
+        ::close(descriptor);
+        return -1;
+    }
+
+    return descriptor;
+}
+
+int acceptUnixSocket(int descriptor)
+{
+    return ::accept4(descriptor, nullptr, nullptr,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+}
+
+void closeUnixSocket(int descriptor)
+{
+    ::close(descriptor);
+}
+
+void removeUnixSocket(const QString& name)
+{
+    sockaddr_un address;
+    socklen_t length;
+    QString error;
+    if (!isAbstractSocketName(name) &&
+        unixAddress(name, address, length, error))
+    {
+        ::unlink(address.sun_path);
+    }
+}
+
+bool sendDescriptors(int socket, const QByteArray& data,
+                     const int* descriptors, int count, QString& error)
+{
+    if (count > MaxDescriptors) {
+        error = "too many descriptors";
+        return false;
+    }
+
+    iovec io;
+    io.iov_base = const_cast<char*>(data.constData());
+    io.iov_len = static_cast<size_t>(data.size());
+
+    char control[CMSG_SPACE(sizeof(int) * MaxDescriptors)] = {};
+    msghdr message = {};
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+    cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(header), descriptors, sizeof(int) * count);
+
+    if (::sendmsg(socket, &message, MSG_NOSIGNAL) != data.size()) {
+        error = systemError("could not send descriptors");
+        return false;
+    }
+    return true;
+}
+
+int receiveDescriptors(int socket, QByteArray& data, int size,
+                       int* descriptors, int max_count, int& count)
+{
+    count = 0;
+    data.resize(size);
+
+    iovec io;
+    io.iov_base = data.data();
+    io.iov_len = static_cast<size_t>(size);
+
+    char control[CMSG_SPACE(sizeof(int) * MaxDescriptors)] = {};
+    msghdr message = {};
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    const ssize_t received = ::recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+    if (received < 0) {
+        // Keep errno for the caller to tell EAGAIN from errors.
+        const int error = errno;
+        data.clear();
+        errno = error;
+        return -1;
+    }
+    data.resize(static_cast<int>(received));
+
+    for (cmsghdr* header = CMSG_FIRSTHDR(&message); header;
+         header = CMSG_NXTHDR(&message, header))
+    {
+        if (header->cmsg_level != SOL_SOCKET ||
+            header->cmsg_type != SCM_RIGHTS)
+        {
+            continue;
+        }
+
+        const int received_count = static_cast<int>(
+            (header->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        const int* received_descriptors =
+            reinterpret_cast<const int*>(CMSG_DATA(header));
+        for (int i = 0; i < received_count; ++i) {
+            // Close what doesn't fit, rather than leaking it.
+            if (count < max_count)
+                descriptors[count++] = received_descriptors[i];
+            else
+                ::close(received_descriptors[i]);
+        }
+    }
+
+    return static_cast<int>(received);
+}
+
+#else
+
+bool isAbstractSocketName(const QString&)
+{
+    return false;
+}
+
+int connectUnixSocket(const QString&, QString& error)
+{
+    error = "Unix sockets are only supported on Linux";
+    return -1;
+}
+
+int listenUnixSocket(const QString&, QString& error)
+{
+    error = "Unix sockets are only supported on Linux";
+    return -1;
+}
+
+int acceptUnixSocket(int)
+{
+    return -1;
+}
+
+void closeUnixSocket(int)
+{
+}
+
+void removeUnixSocket(const QString&)
+{
+}
+
+bool sendDescriptors(int, const QByteArray&, const int*, int, QString& error)
+{
+    error = "passing descriptors is only supported on Linux";
+    return false;
+}
+
+int receiveDescriptors(int, QByteArray& data, int, int*, int, int& count)
+{
+    data.clear();
+    count = 0;
+    return -1;
+}
+
+#endif
+
+}
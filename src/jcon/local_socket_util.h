@@ -0,0 +1,60 @@
+#ifndef LOCAL_SOCKET_UTIL_H
+#define LOCAL_SOCKET_UTIL_H
+
+#include "jcon.h"
+
+#include <QByteArray>
+#include <QString>
+
+namespace jcon {
+
+/**
+ * Whether \p name denotes a socket in the Linux abstract namespace, i.e.
+ * starts with '@'. Abstract sockets have no file in the file system, so
+ * they need no cleanup and no writable directory. On other platforms the
+ * '@' is part of an ordinary name and this always returns false.
+ */
+bool isAbstractSocketName(const QString& name);
+
+/**
+ * Connect to the Unix socket \p name: an abstract name, an absolute path,
+ * or a name in the temporary directory, like QLocalSocket. Returns the
+ * connected, non blocking descriptor, or -1 with a description in \p error.
+ */
+int connectUnixSocket(const QString& name, QString& error);
+
+/**
+ * Create a non blocking socket listening on the Unix socket \p name, see
+ * connectUnixSocket(). A socket file left behind by a server that didn't
+ * shut down cleanly is replaced. Returns the descriptor, or -1 with a
+ * description in \p error.
+ */
+int listenUnixSocket(const QString& name, QString& error);
+
+/// Accept a pending connection, returning -1 if there is none.
+int acceptUnixSocket(int descriptor);
+
+void closeUnixSocket(int descriptor);
+
+/// Remove the file of the Unix socket \p name, unless it is abstract.
+void removeUnixSocket(const QString& name);
+
+/**
+ * Send \p data with the \p count descriptors in \p descriptors, which the
+ * receiving process gets duplicates of.
+ */
+bool sendDescriptors(int socket, const QByteArray& data,
+                     const int* descriptors, int count, QString& error);
+
+/**
+ * Receive up to \p size bytes to \p data and up to \p max_count descriptors
+ * sent with sendDescriptors(). Returns the number of bytes received, 0 if
+ * the peer closed the connection, or -1 with errno set if nothing is
+ * available or on errors.
+ */
+int receiveDescriptors(int socket, QByteArray& data, int size,
+                       int* descriptors, int max_count, int& count);
+
+}
+
+#endif
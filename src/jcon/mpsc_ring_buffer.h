@@ -0,0 +1,115 @@
+#ifndef MPSC_RING_BUFFER_H
+#define MPSC_RING_BUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace jcon {
+
+/**
+ * Bounded lock-free queue for many producers and a single consumer.
+ *
+ * Every cell carries a sequence number telling whose turn it is: a producer
+ * claims the cell at the head position by advancing the head with a CAS,
+ * stores the value and then publishes it by bumping the sequence; the
+ * consumer takes values in order and hands the cell back to producers for
+ * the next round. Neither side ever blocks, and tryPush() fails instead of
+ * waiting when the queue is full.
+ */
+template<typename T>
+class MpscRingBuffer
+{
+public:
+    /// The capacity is rounded up to a power of two.
+    explicit MpscRingBuffer(size_t capacity)
+        : m_mask(roundUpToPowerOfTwo(capacity) - 1)
+        , m_cells(new Cell[m_mask + 1])
+        , m_head(0)
+        , m_tail(0)
+    {
+        for (size_t i = 0; i <= m_mask; ++i)
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    MpscRingBuffer(const MpscRingBuffer&) = delete;
+    MpscRingBuffer& operator=(const MpscRingBuffer&) = delete;
+
+    size_t capacity() const { return m_mask + 1; }
+
+    /// Add \p value. May be called from any thread.
+    bool tryPush(T&& value)
+    {
+        size_t pos = m_head.load(std::memory_order_relaxed);
+        Cell* cell;
+
+        for (;;) {
+            cell = &m_cells[pos & m_mask];
+            const size_t sequence =
+                cell->sequence.load(std::memory_order_acquire);
+            const ptrdiff_t diff = static_cast<ptrdiff_t>(sequence) -
+                static_cast<ptrdiff_t>(pos);
+
+            if (diff == 0) {
+                if (m_head.compare_exchange_weak(pos, pos + 1,
+                                                 std::memory_order_relaxed))
+                {
+                    break;
+                }
+            } else if (diff < 0) {
+                // The consumer hasn't taken the value of the previous round.
+                return false;
+            } else {
+                pos = m_head.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->value = std::move(value);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Take the oldest value. Must only be called from the consumer thread.
+    bool tryPop(T& value)
+    {
+        Cell& cell = m_cells[m_tail & m_mask];
+        const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+
+        if (sequence != m_tail + 1)
+            return false;
+
+        value = std::move(cell.value);
+        cell.sequence.store(m_tail + m_mask + 1, std::memory_order_release);
+        ++m_tail;
+        return true;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    static size_t roundUpToPowerOfTwo(size_t n)
+    {
+        size_t result = 2;
+        while (result < n)
+            result <<= 1;
+        return result;
+    }
+
+    const size_t m_mask;
+    std::unique_ptr<Cell[]> m_cells;
+
+    // The producers' and the consumer's positions live on separate cache
+    // lines, so that they don't invalidate each other.
+    char m_padding0[64];
+    std::atomic<size_t> m_head;
+    char m_padding1[64];
+    size_t m_tail;
+};
+
+}
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef REQUEST_TABLE_H
+#define REQUEST_TABLE_H
+
+#include <QtGlobal>
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace jcon {
+
+/**
+ * Flat open-addressing hash map from request ID to \p T, used for the
+ * outstanding requests of a client.
+ *
+ * Request IDs are handed out sequentially starting from 1, so the ID itself is
+ * used as hash: requests in flight occupy consecutive slots and lookups
+ * practically never probe. Collisions are resolved by linear probing, and
+ * removal shifts the following entries back instead of leaving tombstones.
+ * ID 0 marks an empty slot and must not be used as a key.
+ */
+template<typename T>
+class RequestTable
+{
+public:
+    typedef quint64 Key;
+
+    RequestTable() : m_size(0), m_mask(0) {}
+
+    bool isEmpty() const { return m_size == 0; }
+    size_t size() const { return m_size; }
+
+    /// Find the value for \p key, or nullptr if there is none.
+    T* find(Key key)
+    {
+        if (m_size == 0)
+            return nullptr;
+
+        for (size_t i = home(key); ; i = (i + 1) & m_mask) {
+            if (m_slots[i].key == key)
+                return &m_slots[i].value;
+            if (m_slots[i].key == 0)
+                return nullptr;
+        }
+    }
+
+    /// Insert or replace the value for \p key.
+    void insert(Key key, T value)
+    {
+        Q_ASSERT(key != 0);
+
+        if ((m_size + 1) * 4 > m_slots.size() * 3)
+            grow();
+
+        size_t i = home(key);
+        while (m_slots[i].key != 0 && m_slots[i].key != key)
+            i = (i + 1) & m_mask;
+
+        if (m_slots[i].key == 0)
+            ++m_size;
+        m_slots[i].key = key;
+        m_slots[i].value = std::move(value);
+    }
+
+    /// Remove the value for \p key, moving it to \p value. Returns false if
+    /// there is no value for \p key.
+    bool take(Key key, T& value)
+    {
+        if (m_size == 0)
+            return false;
+
+        for (size_t i = home(key); ; i = (i + 1) & m_mask) {
+            if (m_slots[i].key == key) {
+                value = std::move(m_slots[i].value);
+                erase(i);
+                return true;
+            }
+            if (m_slots[i].key == 0)
+                return false;
+        }
+    }
+
+    bool remove(Key key)
+    {
+        T value;
+        return take(key, value);
+    }
+
+    /// Call \p f with the key and value of every entry.
+    template<typename F>
+    void forEach(F f)
+    {
+        for (auto& slot : m_slots) {
+            if (slot.key != 0)
+                f(slot.key, slot.value);
+        }
+    }
+
+    /// Remove all entries, returning them in \p values.
+    void takeAll(std::vector<std::pair<Key, T>>& values)
+    {
+        values.reserve(values.size() + m_size);
+        for (auto& slot : m_slots) {
+            if (slot.key != 0) {
+                values.emplace_back(slot.key, std::move(slot.value));
+                slot.key = 0;
+                slot.value = T();
+            }
+        }
+        m_size = 0;
+    }
+
+private:
+    struct Slot {
+        Key key = 0;
+        T value;
+    };
+
+    enum { InitialCapacity = 64 };
+
+    size_t home(Key key) const { return static_cast<size_t>(key) & m_mask; }
+
+    void grow()
+    {
+        std::vector<Slot> old_slots;
+        old_slots.swap(m_slots);
+
+        const size_t capacity =
+            old_slots.empty() ? size_t(InitialCapacity) : old_slots.size() * 2;
+        m_slots.resize(capacity);
+        m_mask = capacity - 1;
+        m_size = 0;
+
+        for (auto& slot : old_slots) {
+            if (slot.key != 0)
+                insert(slot.key, std::move(slot.value));
+        }
+    }
+
+    /// Empty slot \p i, shifting back entries that probed past it.
+    void erase(size_t i)
+    {
+        size_t j = i;
+        for (;;) {
+            j = (j + 1) & m_mask;
+            if (m_slots[j].key == 0)
+                break;
+
+            // Keep the entry in slot j if its home slot lies cyclically in
+            // (i, j], since it would not be found anymore if moved to i.
+            const size_t k = home(m_slots[j].key);
+            const bool stays = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+            if (stays)
+                continue;
+
+            m_slots[i].key = m_slots[j].key;
+            m_slots[i].value = std::move(m_slots[j].value);
+            i = j;
+        }
+        m_slots[i].key = 0;
+        m_slots[i].value = T();
+        --m_size;
+    }
+
+    std::vector<Slot> m_slots;
+    size_t m_size;
+    size_t m_mask;
+};
+
+}
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef SPSC_BYTE_RING_H
+#define SPSC_BYTE_RING_H
+
+#include <QtGlobal>
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <new>
+
+namespace jcon {
+
+/**
+ * Lock-free ring of bytes for a single producer and a single consumer,
+ * placed in memory that may be shared between processes.
+ *
+ * The header holds the producer's and the consumer's running positions on
+ * cache lines of their own, followed by the data. Positions only grow, the
+ * data index is the position modulo the capacity, which is a power of two.
+ *
+ * Neither side ever blocks. To let a side sleep until the other one makes
+ * progress, it announces that with prepareConsumerSleep() or
+ * prepareProducerSleep(), and the other side asks wakeConsumer() or
+ * wakeProducer() whether it has to be woken, e.g. through an eventfd. The
+ * fences make sure that no wakeup is lost between the two.
+ *
+ * The peer is not trusted: positions that are further apart than the
+ * capacity are reported as -1 instead of being used.
+ */
+class SpscByteRing
+{
+public:
+    struct Header {
+        alignas(64) std::atomic<quint64> head;
+        alignas(64) std::atomic<quint64> tail;
+        alignas(64) std::atomic<quint32> consumer_waiting;
+        std::atomic<quint32> producer_waiting;
+    };
+
+    static_assert(sizeof(std::atomic<quint64>) == sizeof(quint64),
+                  "atomics must be usable in shared memory");
+
+    /// Bytes of memory a ring of \p capacity bytes takes.
+    static size_t regionSize(size_t capacity)
+    {
+        return sizeof(Header) + capacity;
+    }
+
+    /// Attach to the ring in \p memory of regionSize(capacity) bytes.
+    SpscByteRing(void* memory, size_t capacity)
+        : m_header(static_cast<Header*>(memory))
+        , m_data(static_cast<char*>(memory) + sizeof(Header))
+        , m_mask(capacity - 1)
+    {
+        Q_ASSERT(capacity > 0 && (capacity & m_mask) == 0);
+    }
+
+    SpscByteRing(const SpscByteRing&) = delete;
+    SpscByteRing& operator=(const SpscByteRing&) = delete;
+
+    /// Set up an empty ring; must be called once, by whoever creates it.
+    void initialize()
+    {
+        new (m_header) Header;
+        m_header->head.store(0, std::memory_order_relaxed);
+        m_header->tail.store(0, std::memory_order_relaxed);
+
+        // The consumer is asleep until it has looked at the ring.
+        m_header->consumer_waiting.store(1, std::memory_order_relaxed);
+        m_header->producer_waiting.store(0, std::memory_order_relaxed);
+    }
+
+    size_t capacity() const { return m_mask + 1; }
+
+    /**
+     * Bytes written and not yet read, or -1 if the positions are
+     * inconsistent, which only a misbehaving peer can cause.
+     */
+    qint64 readable() const
+    {
+        return used(m_header->head.load(std::memory_order_acquire),
+                    m_header->tail.load(std::memory_order_acquire));
+    }
+
+    /**
+     * Write up to \p size bytes; returns how many fit, or -1 if the
+     * positions are inconsistent. Producer only.
+     */
+    qint64 write(const char* data, size_t size)
+    {
+        const quint64 head = m_header->head.load(std::memory_order_relaxed);
+        const quint64 tail = m_header->tail.load(std::memory_order_acquire);
+        const qint64 filled = used(head, tail);
+        if (filled < 0)
+            return -1;
+
+        const size_t count =
+            qMin(size, capacity() - static_cast<size_t>(filled));
+        if (count == 0)
+            return 0;
+
+        const size_t index = static_cast<size_t>(head) & m_mask;
+        const size_t first = qMin(count, capacity() - index);
+        memcpy(m_data + index, data, first);
+        memcpy(m_data, data + first, count - first);
+
+        m_header->head.store(head + count, std::memory_order_release);
+        return static_cast<qint64>(count);
+    }
+
+    /**
+     * Read up to \p size bytes; returns how many were read, or -1 if the
+     * positions are inconsistent. Consumer only.
+     */
+    qint64 read(char* data, size_t size)
+    {
+        const quint64 tail = m_header->tail.load(std::memory_order_relaxed);
+        const quint64 head = m_header->head.load(std::memory_order_acquire);
+        const qint64 filled = used(head, tail);
+        if (filled < 0)
+            return -1;
+
+        const size_t count = qMin(size, static_cast<size_t>(filled));
+        if (count == 0)
+            return 0;
+
+        const size_t index = static_cast<size_t>(tail) & m_mask;
+        const size_t first = qMin(count, capacity() - index);
+        memcpy(data, m_data + index, first);
+        memcpy(data + first, m_data, count - first);
+
+        m_header->tail.store(tail + count, std::memory_order_release);
+        return static_cast<qint64>(count);
+    }
+
+    /**
+     * Announce that the consumer is going to sleep. Returns false if data
+     * arrived in the meantime, in which case it must read on instead.
+     */
+    bool prepareConsumerSleep()
+    {
+        m_header->consumer_waiting.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (readable() == 0)
+            return true;
+
+        m_header->consumer_waiting.store(0, std::memory_order_relaxed);
+        return false;
+    }
+
+    /**
+     * Announce that the producer waits for space. Returns false if space
+     * became free in the meantime, in which case it must write on instead.
+     */
+    bool prepareProducerSleep()
+    {
+        m_header->producer_waiting.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (readable() == static_cast<qint64>(capacity()))
+            return true;
+
+        m_header->producer_waiting.store(0, std::memory_order_relaxed);
+        return false;
+    }
+
+    /// Whether the producer has to wake the consumer after writing.
+    bool wakeConsumer()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return m_header->consumer_waiting.exchange(
+            0, std::memory_order_relaxed) != 0;
+    }
+
+    /// Whether the consumer has to wake the producer after reading.
+    bool wakeProducer()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return m_header->producer_waiting.exchange(
+            0, std::memory_order_relaxed) != 0;
+    }
+
+private:
+    /**
+     * Bytes between \p tail and \p head. Both positions live in memory the
+     * peer can write, so they are checked before they are used to copy: a
+     * tail beyond the head wraps around to a huge difference as well.
+     */
+    qint64 used(quint64 head, quint64 tail) const
+    {
+        const quint64 difference = head - tail;
+        if (difference > capacity())
+            return -1;
+        return static_cast<qint64>(difference);
+    }
+
+    Header* const m_header;
+    char* const m_data;
+    const size_t m_mask;
+};
+
+}
+
+#endif
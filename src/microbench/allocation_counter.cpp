@@ -0,0 +1,97 @@
+#include "allocation_counter.h"
+
+#include <QTest>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+std::atomic<quint64> allocations(0);
+
+void countAllocation()
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+}
+
+#if defined(__GLIBC__)
+
+// Interpose the C allocator, forwarding to glibc's implementation. operator
+// new allocates through malloc(), so it is counted as well.
+extern "C" {
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+
+void* malloc(size_t size)
+{
+    countAllocation();
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    countAllocation();
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size)
+{
+    countAllocation();
+    return __libc_realloc(pointer, size);
+}
+
+}
+
+#else
+
+void* operator new(size_t size)
+{
+    countAllocation();
+    if (void* pointer = std::malloc(size ? size : 1))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+#endif
+
+quint64 allocationCount()
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+AllocationReport::AllocationReport()
+    : m_start(allocationCount())
+    , m_operations(0)
+{
+}
+
+AllocationReport::~AllocationReport()
+{
+    const quint64 count = allocationCount() - m_start;
+    const QByteArray name = QByteArray(QTest::currentTestFunction()) +
+        (QTest::currentDataTag() ?
+         QByteArray(":") + QTest::currentDataTag() : QByteArray());
+
+    qDebug("%s: %.2f allocations per operation", name.constData(),
+           m_operations ? double(count) / m_operations : 0.0);
+}
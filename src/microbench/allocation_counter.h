@@ -0,0 +1,40 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+#include <QtGlobal>
+
+/**
+ * Number of heap allocations made by the process so far.
+ *
+ * With glibc, malloc(), calloc() and realloc() are counted, which includes
+ * the allocations of Qt containers; elsewhere only operator new is.
+ */
+quint64 allocationCount();
+
+/**
+ * Reports the allocations per operation of a QBENCHMARK block:
+ *
+ *     AllocationReport allocations;
+ *     QBENCHMARK {
+ *         allocations.operation();
+ *         ...
+ *     }
+ *
+ * The result is printed when the report goes out of scope.
+ */
+class AllocationReport
+{
+public:
+    AllocationReport();
+    ~AllocationReport();
+
+    /// Count one operation; call it once per iteration, or once per item of
+    /// an iteration that handles several.
+    void operation(int count = 1) { m_operations += count; }
+
+private:
+    quint64 m_start;
+    quint64 m_operations;
+};
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef BENCH_SERVICES_H
+#define BENCH_SERVICES_H
+
+#include <QObject>
+#include <QString>
+#include <QVariantList>
+
+/// Service with a method taking the common parameter types.
+class MixedService : public QObject
+{
+    Q_OBJECT
+
+public:
+    Q_INVOKABLE QString mixed(int count, double ratio, const QString& name,
+                              const QVariantList& items)
+    {
+        Q_UNUSED(ratio)
+        Q_UNUSED(items)
+        return name.left(count);
+    }
+};
+
+/// Service with many methods, for the cost of looking a method up.
+class WideService : public QObject
+{
+    Q_OBJECT
+
+public:
+    Q_INVOKABLE int method00(int value) { return value + 0; }
+    Q_INVOKABLE int method01(int value) { return value + 1; }
+    Q_INVOKABLE int method02(int value) { return value + 2; }
+    Q_INVOKABLE int method03(int value) { return value + 3; }
+    Q_INVOKABLE int method04(int value) { return value + 4; }
+    Q_INVOKABLE int method05(int value) { return value + 5; }
+    Q_INVOKABLE int method06(int value) { return value + 6; }
+    Q_INVOKABLE int method07(int value) { return value + 7; }
+    Q_INVOKABLE int method08(int value) { return value + 8; }
+    Q_INVOKABLE int method09(int value) { return value + 9; }
+    Q_INVOKABLE int method10(int value) { return value + 10; }
+    Q_INVOKABLE int method11(int value) { return value + 11; }
+    Q_INVOKABLE int method12(int value) { return value + 12; }
+    Q_INVOKABLE int method13(int value) { return value + 13; }
+    Q_INVOKABLE int method14(int value) { return value + 14; }
+    Q_INVOKABLE int method15(int value) { return value + 15; }
+    Q_INVOKABLE int method16(int value) { return value + 16; }
+    Q_INVOKABLE int method17(int value) { return value + 17; }
+    Q_INVOKABLE int method18(int value) { return value + 18; }
+    Q_INVOKABLE int method19(int value) { return value + 19; }
+    Q_INVOKABLE int method20(int value) { return value + 20; }
+    Q_INVOKABLE int method21(int value) { return value + 21; }
+    Q_INVOKABLE int method22(int value) { return value + 22; }
+    Q_INVOKABLE int method23(int value) { return value + 23; }
+    Q_INVOKABLE int method24(int value) { return value + 24; }
+    Q_INVOKABLE int method25(int value) { return value + 25; }
+    Q_INVOKABLE int method26(int value) { return value + 26; }
+    Q_INVOKABLE int method27(int value) { return value + 27; }
+    Q_INVOKABLE int method28(int value) { return value + 28; }
+    Q_INVOKABLE int method29(int value) { return value + 29; }
+    Q_INVOKABLE int method30(int value) { return value + 30; }
+    Q_INVOKABLE int method31(int value) { return value + 31; }
+    Q_INVOKABLE int method32(int value) { return value + 32; }
+    Q_INVOKABLE int method33(int value) { return value + 33; }
+    Q_INVOKABLE int method34(int value) { return value + 34; }
+    Q_INVOKABLE int method35(int value) { return value + 35; }
+    Q_INVOKABLE int method36(int value) { return value + 36; }
+    Q_INVOKABLE int method37(int value) { return value + 37; }
+    Q_INVOKABLE int method38(int value) { return value + 38; }
+    Q_INVOKABLE int method39(int value) { return value + 39; }
+    Q_INVOKABLE int method40(int value) { return value + 40; }
+    Q_INVOKABLE int method41(int value) { return value + 41; }
+    Q_INVOKABLE int method42(int value) { return value + 42; }
+    Q_INVOKABLE int method43(int value) { return value + 43; }
+    Q_INVOKABLE int method44(int value) { return value + 44; }
+    Q_INVOKABLE int method45(int value) { return value + 45; }
+    Q_INVOKABLE int method46(int value) { return value + 46; }
+    Q_INVOKABLE int method47(int value) { return value + 47; }
+    Q_INVOKABLE int method48(int value) { return value + 48; }
+    Q_INVOKABLE int method49(int value) { return value + 49; }
+    Q_INVOKABLE int method50(int value) { return value + 50; }
+    Q_INVOKABLE int method51(int value) { return value + 51; }
+    Q_INVOKABLE int method52(int value) { return value + 52; }
+    Q_INVOKABLE int method53(int value) { return value + 53; }
+    Q_INVOKABLE int method54(int value) { return value + 54; }
+    Q_INVOKABLE int method55(int value) { return value + 55; }
+    Q_INVOKABLE int method56(int value) { return value + 56; }
+    Q_INVOKABLE int method57(int value) { return value + 57; }
+    Q_INVOKABLE int method58(int value) { return value + 58; }
+    Q_INVOKABLE int method59(int value) { return value + 59; }
+    Q_INVOKABLE int method60(int value) { return value + 60; }
+    Q_INVOKABLE int method61(int value) { return value + 61; }
+    Q_INVOKABLE int method62(int value) { return value + 62; }
+    Q_INVOKABLE int method63(int value) { return value + 63; }
+};
+
+#endif
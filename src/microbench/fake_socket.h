@@ -0,0 +1,31 @@
+#ifndef FAKE_SOCKET_H
+#define FAKE_SOCKET_H
+
+#include <jcon/json_rpc_socket.h>
+
+/**
+ * Socket that is always connected, discards everything sent, and hands the
+ * bytes passed to receive() to its endpoint, so that the endpoint and the
+ * server can be measured without the network.
+ */
+class FakeSocket : public jcon::JsonRpcSocket
+{
+    Q_OBJECT
+
+public:
+    void receive(const QByteArray& bytes) { emit dataReceived(bytes, this); }
+
+    void connectToHost(QString, int) override {}
+    bool waitForConnected(int) override { return true; }
+    void disconnectFromHost() override {}
+    bool isConnected() const override { return true; }
+    void send(const QByteArray&) override {}
+    qint64 bytesToWrite() const override { return 0; }
+    QString errorString() const override { return QString(); }
+    QHostAddress localAddress() const override { return QHostAddress::LocalHost; }
+    int localPort() const override { return 0; }
+    QHostAddress peerAddress() const override { return QHostAddress::LocalHost; }
+    int peerPort() const override { return 0; }
+};
+
+#endif
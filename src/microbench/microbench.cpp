@@ -0,0 +1,325 @@
+#include "allocation_counter.h"
+#include "bench_services.h"
+#include "fake_socket.h"
+
+#include <jcon/json_rpc_common.h>
+#include <jcon/json_rpc_endpoint.h>
+#include <jcon/json_rpc_logger.h>
+#include <jcon/json_rpc_serialization.h>
+#include <jcon/json_rpc_server.h>
+
+#include <QDateTime>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMetaMethod>
+#include <QTest>
+
+#include <memory>
+
+namespace {
+
+class NullLogger : public jcon::JsonRpcLogger
+{
+public:
+    NullLogger() { setLevel(LL_None); }
+
+    void logInfo(const QString&) override {}
+    void logWarning(const QString&) override {}
+    void logError(const QString&) override {}
+};
+
+/// Makes the conversion helpers of JsonRpcCommon accessible.
+class CommonAccess : public JsonRpcCommon
+{
+public:
+    using JsonRpcCommon::convertArgs;
+    using JsonRpcCommon::convertValue;
+    using JsonRpcCommon::doCall;
+};
+
+/// Server without a transport, fed requests directly.
+class DirectServer : public jcon::JsonRpcServer
+{
+public:
+    DirectServer() : JsonRpcServer(nullptr, std::make_shared<NullLogger>()) {}
+
+    bool listen(int) override { return true; }
+    void close() override {}
+
+protected:
+    void newConnection() override {}
+};
+
+QMetaMethod findMethod(const QObject& object, const char* signature)
+{
+    const QMetaObject* meta_object = object.metaObject();
+    return meta_object->method(meta_object->indexOfMethod(signature));
+}
+
+QByteArray request(const QString& method, const QJsonValue& params, int id)
+{
+    return QJsonDocument(QJsonObject {
+            { "jsonrpc", "2.0" },
+            { "method", method },
+            { "params", params },
+            { "id", id }
+        }).toJson(QJsonDocument::Compact);
+}
+
+const char* const MixedSignature = "mixed(int,double,QString,QVariantList)";
+
+template<typename T>
+void benchmarkValueToJson(const T& value)
+{
+    AllocationReport allocations;
+    QBENCHMARK {
+        allocations.operation();
+        const QVariant json = jcon::valueToJson(value);
+        Q_UNUSED(json)
+    }
+}
+
+}
+
+/**
+ * Microbenchmarks of the framing, conversion and dispatch code that every
+ * call goes through. Besides the time, each benchmark prints the heap
+ * allocations per operation.
+ */
+class MicroBench : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void processBuffer_data();
+    void processBuffer();
+
+    void convertArgs_data();
+    void convertArgs();
+
+    void doCall();
+
+    void convertValue_data();
+    void convertValue();
+
+    void valueToJson_data();
+    void valueToJson();
+
+    void dispatch_data();
+    void dispatch();
+};
+
+void MicroBench::processBuffer_data()
+{
+    QTest::addColumn<QByteArray>("input");
+    QTest::addColumn<int>("chunk_size");
+    QTest::addColumn<int>("messages");
+
+    const QByteArray small = request("echo", QJsonArray { "hello" }, 1);
+    const QByteArray large =
+        request("echo", QJsonArray { QString(4096, QChar('x')) }, 1);
+
+    QByteArray pipelined;
+    for (int i = 0; i < 100; ++i)
+        pipelined += request("echo", QJsonArray { i }, i + 1);
+
+    QTest::newRow("single") << small << small.size() << 1;
+    QTest::newRow("large") << large << large.size() << 1;
+    QTest::newRow("split") << large << 64 << 1;
+    QTest::newRow("pipelined") << pipelined << pipelined.size() << 100;
+}
+
+void MicroBench::processBuffer()
+{
+    QFETCH(QByteArray, input);
+    QFETCH(int, chunk_size);
+    QFETCH(int, messages);
+
+    auto socket = std::make_shared<FakeSocket>();
+    jcon::JsonRpcEndpoint endpoint(socket, std::make_shared<NullLogger>(),
+                                   nullptr);
+
+    // Split the input up front, so that the benchmark measures the framing
+    // only.
+    QList<QByteArray> chunks;
+    for (int i = 0; i < input.size(); i += chunk_size)
+        chunks.append(input.mid(i, chunk_size));
+
+    AllocationReport allocations;
+    QBENCHMARK {
+        allocations.operation(messages);
+        for (const auto& chunk : chunks)
+            socket->receive(chunk);
+    }
+}
+
+void MicroBench::convertArgs_data()
+{
+    QTest::addColumn<bool>("named");
+
+    QTest::newRow("positional") << false;
+    QTest::newRow("named") << true;
+}
+
+void MicroBench::convertArgs()
+{
+    QFETCH(bool, named);
+
+    MixedService service;
+    const QMetaMethod method = findMethod(service, MixedSignature);
+    const QVariantList items { 1, 2, 3 };
+
+    CommonAccess common;
+    AllocationReport allocations;
+
+    if (named) {
+        const QVariantMap args {
+            { "count", 5 },
+            { "ratio", 0.5 },
+            { "name", "benchmark" },
+            { "items", items }
+        };
+        QBENCHMARK {
+            allocations.operation();
+            QVariantList converted;
+            common.convertArgs(method, args, converted);
+        }
+    } else {
+        const QVariantList args { 5, 0.5, "benchmark", QVariant(items) };
+        QBENCHMARK {
+            allocations.operation();
+            QVariantList converted;
+            common.convertArgs(method, args, converted);
+        }
+    }
+}
+
+void MicroBench::doCall()
+{
+    MixedService service;
+    const QMetaMethod method = findMethod(service, MixedSignature);
+
+    CommonAccess common;
+    QVariantList converted;
+    QVERIFY(common.convertArgs(
+                method,
+                QVariantList { 5, 0.5, "benchmark", QVariantList { 1, 2, 3 } },
+                converted));
+
+    AllocationReport allocations;
+    QBENCHMARK {
+        allocations.operation();
+        QVariantList args(converted);
+        QVariant return_value;
+        common.doCall(&service, method, args, return_value);
+    }
+}
+
+void MicroBench::convertValue_data()
+{
+    QTest::addColumn<QVariant>("value");
+
+    QVariantList list;
+    QVariantMap map;
+    for (int i = 0; i < 10; ++i) {
+        list.append(i);
+        map.insert(QString("key%1").arg(i), i);
+    }
+
+    QTest::newRow("bool") << QVariant(true);
+    QTest::newRow("int") << QVariant(42);
+    QTest::newRow("qlonglong") << QVariant(Q_INT64_C(1) << 40);
+    QTest::newRow("double") << QVariant(3.25);
+    QTest::newRow("QString") << QVariant(QString("benchmark"));
+    QTest::newRow("QStringList") << QVariant(QStringList { "a", "b", "c" });
+    QTest::newRow("QVariantList") << QVariant(list);
+    QTest::newRow("QVariantMap") << QVariant(map);
+    QTest::newRow("QByteArray") << QVariant(QByteArray("benchmark"));
+    QTest::newRow("QDateTime") << QVariant(QDateTime::currentDateTimeUtc());
+    QTest::newRow("void") << QVariant::fromValue(std::false_type());
+}
+
+void MicroBench::convertValue()
+{
+    QFETCH(QVariant, value);
+
+    CommonAccess common;
+    AllocationReport allocations;
+    QBENCHMARK {
+        allocations.operation();
+        const QJsonValue json = common.convertValue(value);
+        Q_UNUSED(json)
+    }
+}
+
+void MicroBench::valueToJson_data()
+{
+    QTest::addColumn<QString>("type");
+
+    QTest::newRow("int") << QString("int");
+    QTest::newRow("QString") << QString("QString");
+    QTest::newRow("QStringList") << QString("QStringList");
+    QTest::newRow("QVariantMap") << QString("QVariantMap");
+    QTest::newRow("QDateTime") << QString("QDateTime");
+}
+
+void MicroBench::valueToJson()
+{
+    QFETCH(QString, type);
+
+    if (type == "int") {
+        benchmarkValueToJson(42);
+    } else if (type == "QString") {
+        benchmarkValueToJson(QString("benchmark"));
+    } else if (type == "QStringList") {
+        benchmarkValueToJson(QStringList { "a", "b", "c" });
+    } else if (type == "QVariantMap") {
+        benchmarkValueToJson(QVariantMap { { "a", 1 }, { "b", 2 } });
+    } else if (type == "QDateTime") {
+        benchmarkValueToJson(QDateTime::currentDateTimeUtc());
+    }
+}
+
+void MicroBench::dispatch_data()
+{
+    QTest::addColumn<QString>("method");
+    QTest::addColumn<QJsonValue>("params");
+
+    QTest::newRow("first of 64") << QString("wide/method00")
+                                 << QJsonValue(QJsonArray { 1 });
+    QTest::newRow("last of 64") << QString("wide/method63")
+                                << QJsonValue(QJsonArray { 1 });
+    QTest::newRow("named") << QString("wide/method63")
+                           << QJsonValue(QJsonObject { { "value", 1 } });
+    QTest::newRow("mixed") << QString("mixed/mixed")
+                           << QJsonValue(QJsonArray {
+                                  5, 0.5, "benchmark", QJsonArray { 1, 2 } });
+}
+
+void MicroBench::dispatch()
+{
+    QFETCH(QString, method);
+    QFETCH(QJsonValue, params);
+
+    DirectServer server;
+    server.registerService(std::make_shared<WideService>(), "wide");
+    server.registerService(std::make_shared<MixedService>(), "mixed");
+
+    auto endpoint = std::make_shared<jcon::JsonRpcEndpoint>(
+        std::make_shared<FakeSocket>(), std::make_shared<NullLogger>(),
+        nullptr);
+
+    const QJsonObject request_object =
+        QJsonDocument::fromJson(request(method, params, 1)).object();
+
+    AllocationReport allocations;
+    QBENCHMARK {
+        allocations.operation();
+        server.jsonRequestReceived(request_object, endpoint.get());
+    }
+}
+
+QTEST_GUILESS_MAIN(MicroBench)
+
+#include "microbench.moc"
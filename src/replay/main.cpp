@@ -0,0 +1,109 @@
+#include "replay_session.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonDocument>
+#include <QTextStream>
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("jcon_replay");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Replays traffic captured with JsonRpcCapture against a server and "
+        "measures the latency of its responses.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("capture", "Capture file to replay.");
+
+    QCommandLineOption host_option(
+        "host", "Host of the server, or its name for the local transport.",
+        "host", "127.0.0.1");
+    QCommandLineOption port_option(
+        "port", "Port of the server.", "port", "6002");
+    QCommandLineOption transport_option(
+        "transport", "Transport to use, tcp, ws or local.", "transport",
+        "tcp");
+    QCommandLineOption speed_option(
+        "speed", "Factor to speed up the captured pacing by; 1 replays at "
+        "the original pacing, 0 as fast as possible.", "factor", "1");
+    QCommandLineOption window_option(
+        "window", "Requests kept outstanding per connection when replaying "
+        "as fast as possible.", "count", "64");
+    QCommandLineOption connections_option(
+        "connections", "Connections to replay on; 0 for one per captured "
+        "connection.", "count", "0");
+    QCommandLineOption drain_option(
+        "drain", "Milliseconds to wait for responses after the last "
+        "message.", "msecs", "5000");
+    QCommandLineOption timeout_option(
+        "timeout", "Milliseconds after which a request without response "
+        "counts as lost; 0 waits until the drain timeout.", "msecs", "5000");
+    QCommandLineOption output_option(
+        "output", "File to write the results to as JSON.", "file");
+
+    parser.addOption(host_option);
+    parser.addOption(port_option);
+    parser.addOption(transport_option);
+    parser.addOption(speed_option);
+    parser.addOption(window_option);
+    parser.addOption(connections_option);
+    parser.addOption(drain_option);
+    parser.addOption(timeout_option);
+    parser.addOption(output_option);
+    parser.process(app);
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    const QStringList arguments = parser.positionalArguments();
+    if (arguments.size() != 1) {
+        err << "expected exactly one capture file" << endl;
+        return 1;
+    }
+
+    ReplayOptions options;
+    options.host = parser.value(host_option);
+    options.port = parser.value(port_option).toInt();
+    options.transport = parser.value(transport_option);
+    options.speed = qMax(parser.value(speed_option).toDouble(), 0.0);
+    options.window = qMax(parser.value(window_option).toInt(), 1);
+    options.connections = qMax(parser.value(connections_option).toInt(), 0);
+    options.drain_timeout = parser.value(drain_option).toInt();
+    options.request_timeout = qMax(parser.value(timeout_option).toInt(), 0);
+
+    if (options.transport == "local" && !parser.isSet(host_option)) {
+        // Connect to the name JsonRpcLocalServer::listen(port) uses.
+        options.host.clear();
+    }
+
+    if (options.transport != "tcp" && options.transport != "ws" &&
+        options.transport != "local")
+    {
+        err << "unknown transport: " << options.transport << endl;
+        return 1;
+    }
+
+    ReplaySession session(options);
+
+    QString error;
+    if (!session.load(arguments.first(), error) || !session.run(error)) {
+        err << error << endl;
+        return 1;
+    }
+
+    out << session.summary() << endl;
+
+    if (parser.isSet(output_option)) {
+        QFile file(parser.value(output_option));
+        if (!file.open(QIODevice::WriteOnly)) {
+            err << "could not write " << file.fileName() << endl;
+            return 1;
+        }
+        file.write(QJsonDocument(session.results()).toJson());
+    }
+
+    return 0;
+}
@@ -0,0 +1,351 @@
+#include "replay_session.h"
+
+#include <jcon/json_rpc_async_logger.h>
+#include <jcon/json_rpc_capture.h>
+#include <jcon/json_rpc_local_socket.h>
+#include <jcon/json_rpc_tcp_socket.h>
+#include <jcon/json_rpc_websocket.h>
+
+#include <QJsonArray>
+#include <QJsonDocument>
+
+#include <memory>
+
+ReplaySession::ReplaySession(const ReplayOptions& options)
+    : m_options(options)
+    , m_next_id(1)
+    , m_next_message(0)
+    , m_messages_sent(0)
+    , m_done(false)
+    , m_requests_sent(0)
+    , m_responses(0)
+    , m_errors(0)
+    , m_lost(0)
+    , m_elapsed_nsecs(0)
+{
+    m_logger = jcon::JsonRpcAsyncLogger::shared("jcon_replay.log");
+    m_logger->setLevel(jcon::JsonRpcLogger::LL_Warning);
+
+    m_timer.setSingleShot(true);
+    m_timer.setTimerType(Qt::PreciseTimer);
+    connect(&m_timer, &QTimer::timeout, this, &ReplaySession::sendDue);
+
+    m_drain_timer.setSingleShot(true);
+    connect(&m_drain_timer, &QTimer::timeout, this, &ReplaySession::finish);
+
+    m_expiry_timer.setSingleShot(true);
+    connect(&m_expiry_timer, &QTimer::timeout,
+            this, &ReplaySession::expireRequests);
+}
+
+ReplaySession::~ReplaySession()
+{
+    for (auto& connection : m_connections) {
+        if (connection.endpoint)
+            connection.endpoint->disconnectFromHost();
+    }
+}
+
+bool ReplaySession::load(const QString& filename, QString& error)
+{
+    jcon::JsonRpcCaptureReader reader(filename);
+    if (!reader.isValid()) {
+        error = "not a capture file: " + filename;
+        return false;
+    }
+
+    QHash<quint32, int> connections;
+    jcon::JsonRpcCaptureReader::Message captured;
+    while (reader.readNext(captured)) {
+        Message message;
+        message.time = captured.time;
+
+        if (m_options.connections > 0) {
+            message.connection =
+                static_cast<int>(captured.connection % m_options.connections);
+        } else {
+            auto it = connections.find(captured.connection);
+            if (it == connections.end()) {
+                it = connections.insert(captured.connection,
+                                        connections.size());
+            }
+            message.connection = it.value();
+        }
+
+        QJsonDocument document = QJsonDocument::fromJson(captured.data);
+        if (document.isObject()) {
+            QJsonObject request = document.object();
+            rewriteIds(request, message);
+            document.setObject(request);
+        } else if (document.isArray()) {
+            QJsonArray batch;
+            for (const auto& element : document.array()) {
+                QJsonObject request = element.toObject();
+                rewriteIds(request, message);
+                batch.append(element.isObject() ? request : element);
+            }
+            document.setArray(batch);
+        }
+
+        // Malformed messages are replayed as captured, the server has to
+        // cope with them as well.
+        message.data = document.isNull() ?
+            captured.data : document.toJson(QJsonDocument::Compact);
+        m_messages.push_back(std::move(message));
+    }
+
+    if (m_messages.empty()) {
+        error = "no messages in " + filename;
+        return false;
+    }
+
+    m_connections.resize(m_options.connections > 0 ?
+                         m_options.connections : connections.size());
+    return true;
+}
+
+bool ReplaySession::run(QString& error)
+{
+    for (size_t i = 0; i < m_connections.size(); ++i) {
+        jcon::JsonRpcSocketPtr socket;
+        if (m_options.transport == "ws")
+            socket = std::make_shared<jcon::JsonRpcWebSocket>();
+        else if (m_options.transport == "local")
+            socket = std::make_shared<jcon::JsonRpcLocalSocket>();
+        else
+            socket = std::make_shared<jcon::JsonRpcTcpSocket>();
+
+        auto endpoint = std::make_shared<jcon::JsonRpcEndpoint>(socket,
+                                                                m_logger);
+        if (!endpoint->connectToHost(m_options.host, m_options.port)) {
+            error = QString("could not connect to %1:%2")
+                .arg(m_options.host).arg(m_options.port);
+            return false;
+        }
+
+        connect(endpoint.get(), &jcon::JsonRpcEndpoint::jsonObjectReceived,
+                this, &ReplaySession::jsonObjectReceived);
+        connect(endpoint.get(), &jcon::JsonRpcEndpoint::jsonArrayReceived,
+                this, &ReplaySession::jsonArrayReceived);
+
+        m_connection_index.insert(endpoint.get(), static_cast<int>(i));
+        m_connections[i].endpoint = endpoint;
+    }
+
+    m_clock.start();
+
+    if (m_options.speed > 0) {
+        sendDue();
+    } else {
+        for (size_t i = 0; i < m_messages.size(); ++i)
+            m_connections[m_messages[i].connection].pending.push_back(i);
+        for (auto& connection : m_connections)
+            pump(connection);
+    }
+
+    if (!m_done)
+        m_loop.exec();
+    return true;
+}
+
+QJsonObject ReplaySession::results() const
+{
+    const double nsecs_per_usec = 1000.0;
+    const double seconds = m_elapsed_nsecs / 1e9;
+    const auto latency = m_latency.snapshot();
+
+    return QJsonObject {
+        { "transport", m_options.transport },
+        { "speed", m_options.speed },
+        { "connections", static_cast<int>(m_connections.size()) },
+        { "messages", static_cast<double>(m_messages_sent) },
+        { "requests", static_cast<double>(m_requests_sent) },
+        { "responses", static_cast<double>(m_responses) },
+        { "errors", static_cast<double>(m_errors) },
+        { "lost", static_cast<double>(m_lost + m_sent.size()) },
+        { "seconds", seconds },
+        { "responses_per_second", seconds > 0 ? m_responses / seconds : 0.0 },
+        { "latency_us", QJsonObject {
+                { "mean", latency.count ?
+                          latency.sum / nsecs_per_usec / latency.count : 0.0 },
+                { "p50", latency.p50 / nsecs_per_usec },
+                { "p99", latency.p99 / nsecs_per_usec },
+                { "p999", latency.p999 / nsecs_per_usec },
+                { "max", latency.max / nsecs_per_usec }
+            }
+        }
+    };
+}
+
+QString ReplaySession::summary() const
+{
+    const double seconds = m_elapsed_nsecs / 1e9;
+    const auto latency = m_latency.snapshot();
+
+    return QString("%1 messages, %2 requests on %3 connections in %4 s: "
+                   "%5 responses/s, %6 errors, %7 lost, latency p50 %8 us, "
+                   "p99 %9 us, p999 %10 us")
+        .arg(m_messages_sent)
+        .arg(m_requests_sent)
+        .arg(m_connections.size())
+        .arg(seconds, 0, 'f', 2)
+        .arg(seconds > 0 ? m_responses / seconds : 0.0, 0, 'f', 0)
+        .arg(m_errors)
+        .arg(m_lost + m_sent.size())
+        .arg(latency.p50 / 1000.0, 0, 'f', 1)
+        .arg(latency.p99 / 1000.0, 0, 'f', 1)
+        .arg(latency.p999 / 1000.0, 0, 'f', 1);
+}
+
+void ReplaySession::sendDue()
+{
+    const qint64 now_usecs = m_clock.nsecsElapsed() / 1000;
+    // Pacing starts with the first message, not with the capture.
+    const qint64 start_usecs = m_messages.front().time;
+    auto due = [this, start_usecs](size_t index) {
+        return static_cast<qint64>(
+            (m_messages[index].time - start_usecs) / m_options.speed);
+    };
+
+    while (m_next_message < m_messages.size() &&
+           due(m_next_message) <= now_usecs)
+    {
+        send(m_next_message++);
+    }
+
+    if (m_next_message < m_messages.size()) {
+        // Messages due within the same millisecond go out together, the
+        // timer can't do better.
+        m_timer.start(static_cast<int>(
+            (due(m_next_message) - now_usecs) / 1000));
+    }
+}
+
+void ReplaySession::jsonObjectReceived(const QJsonObject& obj,
+                                       jcon::JsonRpcEndpoint* endpoint)
+{
+    responseReceived(obj, endpoint);
+}
+
+void ReplaySession::jsonArrayReceived(const QJsonArray& array,
+                                      jcon::JsonRpcEndpoint* endpoint)
+{
+    for (const auto& element : array)
+        responseReceived(element.toObject(), endpoint);
+}
+
+void ReplaySession::expireRequests()
+{
+    const qint64 timeout_nsecs = m_options.request_timeout * 1000000LL;
+    const qint64 now = m_clock.nsecsElapsed();
+
+    while (!m_expiry.empty() && !m_done) {
+        const SentRequest request = m_expiry.front();
+        if (m_sent.contains(request.id) &&
+            now - request.time < timeout_nsecs)
+        {
+            m_expiry_timer.start(static_cast<int>(
+                (request.time + timeout_nsecs - now) / 1000000) + 1);
+            return;
+        }
+
+        // A server may never answer, e.g. requests it can't parse. Give
+        // up on them rather than stalling the window for good.
+        m_expiry.pop_front();
+        if (m_sent.remove(request.id) > 0) {
+            ++m_lost;
+            requestDone(request.connection);
+        }
+    }
+}
+
+void ReplaySession::finish()
+{
+    if (m_done)
+        return;
+
+    m_elapsed_nsecs = m_clock.nsecsElapsed();
+    m_done = true;
+    m_timer.stop();
+    m_drain_timer.stop();
+    m_expiry_timer.stop();
+    m_loop.quit();
+}
+
+void ReplaySession::rewriteIds(QJsonObject& request, Message& message)
+{
+    // Notifications have no ID, and responses to server requests are not
+    // answered.
+    if (!request.contains("id") || !request.contains("method"))
+        return;
+
+    const qint64 id = m_next_id++;
+    request["id"] = static_cast<double>(id);
+    message.ids.push_back(id);
+}
+
+void ReplaySession::send(size_t index)
+{
+    const Message& message = m_messages[index];
+    Connection& connection = m_connections[message.connection];
+
+    const qint64 now = m_clock.nsecsElapsed();
+    for (qint64 id : message.ids) {
+        m_sent.insert(id, now);
+        if (m_options.request_timeout > 0)
+            m_expiry.push_back({ id, now, message.connection });
+    }
+    if (!m_expiry.empty() && !m_expiry_timer.isActive())
+        m_expiry_timer.start(m_options.request_timeout);
+
+    connection.outstanding += static_cast<int>(message.ids.size());
+    m_requests_sent += message.ids.size();
+    connection.endpoint->send(message.data);
+
+    if (++m_messages_sent == m_messages.size()) {
+        if (m_sent.isEmpty())
+            finish();
+        else
+            m_drain_timer.start(m_options.drain_timeout);
+    }
+}
+
+void ReplaySession::pump(Connection& connection)
+{
+    while (!connection.pending.empty() &&
+           connection.outstanding < m_options.window)
+    {
+        const size_t index = connection.pending.front();
+        connection.pending.pop_front();
+        send(index);
+    }
+}
+
+void ReplaySession::responseReceived(const QJsonObject& response,
+                                     jcon::JsonRpcEndpoint* endpoint)
+{
+    const qint64 id = static_cast<qint64>(response.value("id").toDouble(-1));
+    auto it = m_sent.find(id);
+    if (it == m_sent.end())
+        return;
+
+    m_latency.record(static_cast<quint64>(m_clock.nsecsElapsed() - *it));
+    m_sent.erase(it);
+    ++m_responses;
+    if (response.contains("error"))
+        ++m_errors;
+
+    const auto index = m_connection_index.find(endpoint);
+    requestDone(index != m_connection_index.end() ? index.value() : -1);
+}
+
+void ReplaySession::requestDone(int connection)
+{
+    if (connection >= 0) {
+        --m_connections[connection].outstanding;
+        pump(m_connections[connection]);
+    }
+
+    if (m_messages_sent == m_messages.size() && m_sent.isEmpty())
+        finish();
+}
@@ -0,0 +1,144 @@
+#ifndef REPLAY_SESSION_H
+#define REPLAY_SESSION_H
+
+#include <jcon/json_rpc_endpoint.h>
+#include <jcon/json_rpc_metrics.h>
+
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QHash>
+#include <QJsonObject>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+
+#include <deque>
+#include <vector>
+
+struct ReplayOptions {
+    /// Host of the server, or its name for the local transport.
+    QString host = "127.0.0.1";
+    int port = 6002;
+
+    /// "tcp", "ws" or "local".
+    QString transport = "tcp";
+
+    /// Factor to speed up the captured pacing by; 0 sends as fast as the
+    /// server answers.
+    double speed = 1;
+
+    /// Requests kept outstanding per connection when sending as fast as
+    /// possible.
+    int window = 64;
+
+    /// Number of connections to replay on; 0 for one per captured
+    /// connection, otherwise captured connections are spread over them.
+    int connections = 0;
+
+    /// Milliseconds to wait for the outstanding responses after the last
+    /// message has been sent.
+    int drain_timeout = 5000;
+
+    /// Milliseconds after which a request without response counts as lost
+    /// and no longer takes up room in the window; 0 waits forever.
+    int request_timeout = 5000;
+};
+
+/**
+ * Replays the messages of a capture file against a server and records the
+ * latency of the responses.
+ *
+ * The request IDs are rewritten when loading, so that every request has an
+ * ID of its own even when several captured connections share one
+ * connection.
+ */
+class ReplaySession : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ReplaySession(const ReplayOptions& options);
+    ~ReplaySession();
+
+    bool load(const QString& filename, QString& error);
+
+    /// Connect and replay; returns when all responses have arrived or the
+    /// drain timeout has passed.
+    bool run(QString& error);
+
+    QJsonObject results() const;
+
+    /// One line summary for the console.
+    QString summary() const;
+
+private slots:
+    void sendDue();
+    void jsonObjectReceived(const QJsonObject& obj,
+                            jcon::JsonRpcEndpoint* endpoint);
+    void jsonArrayReceived(const QJsonArray& array,
+                           jcon::JsonRpcEndpoint* endpoint);
+    void expireRequests();
+    void finish();
+
+private:
+    struct Message {
+        /// Microseconds since the start of the capture.
+        qint64 time;
+        int connection;
+        QByteArray data;
+        std::vector<qint64> ids;
+    };
+
+    struct Connection {
+        jcon::JsonRpcEndpointPtr endpoint;
+        int outstanding = 0;
+
+        /// Messages not sent yet, when sending as fast as possible.
+        std::deque<size_t> pending;
+    };
+
+    struct SentRequest {
+        qint64 id;
+        qint64 time;
+        int connection;
+    };
+
+    void rewriteIds(QJsonObject& request, Message& message);
+    void send(size_t index);
+    void pump(Connection& connection);
+    void responseReceived(const QJsonObject& response,
+                          jcon::JsonRpcEndpoint* endpoint);
+    void requestDone(int connection);
+
+    ReplayOptions m_options;
+    jcon::JsonRpcLoggerPtr m_logger;
+    std::vector<Message> m_messages;
+    std::vector<Connection> m_connections;
+    QHash<jcon::JsonRpcEndpoint*, int> m_connection_index;
+
+    /// Send time, in nanoseconds of m_clock, of every outstanding request.
+    QHash<qint64, qint64> m_sent;
+
+    /// Requests in the order they were sent, i.e. the order they expire
+    /// in; answered ones are skipped when they come up.
+    std::deque<SentRequest> m_expiry;
+
+    qint64 m_next_id;
+    size_t m_next_message;
+    size_t m_messages_sent;
+    bool m_done;
+    quint64 m_requests_sent;
+    quint64 m_responses;
+    quint64 m_errors;
+    quint64 m_lost;
+    qint64 m_elapsed_nsecs;
+
+    QElapsedTimer m_clock;
+    QEventLoop m_loop;
+    QTimer m_timer;
+    QTimer m_drain_timer;
+    QTimer m_expiry_timer;
+    jcon::JsonRpcHistogram m_latency;
+};
+
+#endif